@@ -26,5 +26,7 @@ ENDIF()
 SET(CMAKE_C_FLAGS_RELEASE "${CMAKE_C_FLAGS_RELEASE} -ffast-math -O3") 
 SET(CMAKE_CXX_FLAGS_RELEASE "${CMAKE_CXX_FLAGS_RELEASE} -ffast-math -O3")
 
-LINK_LIBRARIES(${OpenCV_LIBS})
+FIND_PACKAGE(Threads REQUIRED)
+
+LINK_LIBRARIES(${OpenCV_LIBS} ${CMAKE_THREAD_LIBS_INIT})
 INCLUDE_DIRECTORIES(AFTER ${CMAKE_CURRENT_BINARY_DIR} ${OpenCV_INCLUDE_DIR} ${CMAKE_CURRENT_SOURCE_DIR}/src)
@@ -36,6 +36,17 @@ namespace legit
 namespace common
 {
 
+float histogram_sqrt_table[HIST_SQRT_TABLE];
+
+static struct HistogramSqrtTableInitializer
+{
+  HistogramSqrtTableInitializer()
+  {
+    for (int i = 0; i < HIST_SQRT_TABLE; i++)
+      histogram_sqrt_table[i] = sqrtf((float) i);
+  }
+} histogram_sqrt_table_initializer;
+
 void print_histogram(SimpleHistogram h)
 {
 
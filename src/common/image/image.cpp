@@ -36,7 +36,7 @@ namespace legit
 namespace common
 {
 
-Image::Image() : offset(0, 0), integral_image(NULL), inthist16(NULL), inthist32(NULL)
+Image::Image() : inthist8(NULL), inthist16(NULL), inthist32(NULL), integral_image(NULL), offset(0, 0)
 {
 
   reset();
@@ -45,7 +45,7 @@ Image::Image() : offset(0, 0), integral_image(NULL), inthist16(NULL), inthist32(
 
 }
 
-Image::Image(int width, int height) : offset(0, 0), integral_image(NULL), inthist16(NULL), inthist32(NULL)
+Image::Image(int width, int height) : inthist8(NULL), inthist16(NULL), inthist32(NULL), integral_image(NULL), offset(0, 0)
 {
 
   reset();
@@ -57,14 +57,14 @@ Image::Image(int width, int height) : offset(0, 0), integral_image(NULL), inthis
 
 }
 
-Image::Image(const std::string& path) : offset(0, 0), integral_image(NULL), inthist16(NULL), inthist32(NULL)
+Image::Image(const std::string& path) : inthist8(NULL), inthist16(NULL), inthist32(NULL), integral_image(NULL), offset(0, 0)
 {
 
   load(path);
 
 }
 
-Image::Image(Mat& src) : offset(0, 0), integral_image(NULL), inthist16(NULL), inthist32(NULL)
+Image::Image(Mat& src) : inthist8(NULL), inthist16(NULL), inthist32(NULL), integral_image(NULL), offset(0, 0)
 {
 
   update(src);
@@ -72,7 +72,7 @@ Image::Image(Mat& src) : offset(0, 0), integral_image(NULL), inthist16(NULL), in
 }
 
 // TODO: improve !!!
-Image::Image(Image& image, Rect region) : offset(0, 0), integral_image(NULL), inthist16(NULL), inthist32(NULL)
+Image::Image(Image& image, Rect region) : inthist8(NULL), inthist16(NULL), inthist32(NULL), integral_image(NULL), offset(0, 0)
 {
 
   copy_region(image, region);
@@ -84,6 +84,18 @@ Image::~Image()
 
   reset();
 
+  if (integral_image)
+    delete integral_image;
+
+  if (inthist8)
+    delete inthist8;
+
+  if (inthist16)
+    delete inthist16;
+
+  if (inthist32)
+    delete inthist32;
+
 }
 
 void Image::capture(Sequence* capture)
@@ -181,6 +193,14 @@ void Image::update(Mat& data, int format, bool overwrite)
     throw LegitException("Unknown image format");
 
   if (overwrite) reset();
+  else
+    {
+      // Integral structures depend on the content of the image
+      has_inthist8 = false;
+      has_inthist16 = false;
+      has_inthist32 = false;
+      has_integral_image = false;
+    }
 
   data.copyTo(formats[format]);
   has_format[format] = true;
@@ -330,27 +350,13 @@ void Image::update_size()
 void Image::reset()
 {
 
-  if (has_integral_image && integral_image)
-    {
-      delete integral_image;
-      integral_image = NULL;
-    }
-
-  if (has_inthist16 && inthist16)
-    {
-      delete inthist16;
-      inthist16 = NULL;
-    }
-
-  if (has_inthist32 && inthist32)
-    {
-      delete inthist32;
-      inthist32 = NULL;
-    }
+  // Integral structures are kept allocated so that their buffers can be
+  // reused for the next frame, only their content is invalidated.
 
   for (int i = 0; i < IMAGE_FORMATS; i++)
     has_format[i] = false;
 
+  has_inthist8 = false;
   has_inthist16 = false;
   has_inthist32 = false;
   has_integral_image = false;
@@ -386,6 +392,64 @@ Mat Image::get_float_mask()
 
 }
 
+IntegralHistogram* Image::get_integral_histogram(int bins, cv::Rect region)
+{
+
+  switch (bins)
+    {
+    case HIST_SIZE_8:
+      return update_integral_histogram(inthist8, has_inthist8, HIST_SIZE_8, region);
+    case HIST_SIZE_16:
+      return update_integral_histogram(inthist16, has_inthist16, HIST_SIZE_16, region);
+    case HIST_SIZE_32:
+      return update_integral_histogram(inthist32, has_inthist32, HIST_SIZE_32, region);
+    default:
+      throw LegitException("Unsupported bins number");
+    }
+
+}
+
+IntegralImage* Image::get_integral_image()
+{
+
+  if (has_integral_image)
+    return integral_image;
+
+  Mat gray = get_gray();
+
+  if (integral_image)
+    integral_image->update(gray);
+  else
+    integral_image = new IntegralImage(gray);
+
+  has_integral_image = true;
+
+  return integral_image;
+
+}
+
+IntegralHistogram* Image::update_integral_histogram(IntegralHistogram*& histogram, bool& valid, int bins, cv::Rect region)
+{
+
+  if (valid && histogram->covers(region))
+    return histogram;
+
+  if (valid)
+    region |= histogram->get_region();
+
+  Mat gray = get_gray();
+
+  if (histogram)
+    histogram->update(gray, region);
+  else
+    histogram = new IntegralHistogram(gray, bins, region);
+
+  valid = true;
+
+  return histogram;
+
+}
+
 }
 
 }
@@ -87,6 +87,35 @@ public:
 
   Mat get_float_mask();
 
+  /**
+      Integral histograms of the grayscale image are built lazily and only over
+      the requested region. Requesting a region that is not covered by the
+      existing histogram rebuilds it over the union of both regions.
+  */
+  IntegralHistogram* get_integral_histogram(int bins, cv::Rect region);
+
+  /**
+      Returns the integral histogram with the given number of bins if it has
+      already been built for this image or NULL otherwise. Never builds
+      anything, so it is safe to call while the image is shared between threads.
+  */
+  inline IntegralHistogram* find_integral_histogram(int bins)
+  {
+    switch (bins)
+      {
+      case HIST_SIZE_8:
+        return has_inthist8 ? inthist8 : NULL;
+      case HIST_SIZE_16:
+        return has_inthist16 ? inthist16 : NULL;
+      case HIST_SIZE_32:
+        return has_inthist32 ? inthist32 : NULL;
+      default:
+        return NULL;
+      }
+  }
+
+  IntegralImage* get_integral_image();
+
   inline bool empty()
   {
     return _width == 0 && _height == 0;
@@ -110,6 +139,11 @@ private:
 
   void update_size();
 
+  IntegralHistogram* update_integral_histogram(IntegralHistogram*& histogram, bool& valid, int bins, cv::Rect region);
+
+  Image(const Image&) = delete;
+  Image& operator=(const Image&) = delete;
+
   int _width;
   int _height;
 
@@ -122,6 +156,9 @@ private:
   bool has_float_mask;
   Mat float_mask;
 
+  bool has_inthist8;
+  IntegralHistogram* inthist8;
+
   bool has_inthist16;
   IntegralHistogram* inthist16;
 
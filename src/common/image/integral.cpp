@@ -171,26 +171,41 @@ void IntegralImage::print()
 
 }
 
-IntegralHistogram::IntegralHistogram(Mat& src, int bins) : data(NULL), bins(bins)
+static int integral_histogram_shift(int bins)
 {
 
-
   switch(bins)
     {
+    case 8:
+      return 5;
     case 16:
-      shift = 4;
-      break;
+      return 4;
     case 32:
-      shift = 3;
-      break;
+      return 3;
     default:
       throw LegitException("Unsupported bins number");
     }
 
+}
+
+IntegralHistogram::IntegralHistogram(Mat& src, int bins) : bins(bins), capacity(0), data(NULL)
+{
+
+  shift = integral_histogram_shift(bins);
+
   update(src);
 
 }
 
+IntegralHistogram::IntegralHistogram(Mat& src, int bins, cv::Rect region) : bins(bins), capacity(0), data(NULL)
+{
+
+  shift = integral_histogram_shift(bins);
+
+  update(src, region);
+
+}
+
 IntegralHistogram::~IntegralHistogram()
 {
 
@@ -204,55 +219,62 @@ IntegralHistogram::~IntegralHistogram()
 void IntegralHistogram::update(Mat& src)
 {
 
-  if (!data || (src.cols != width || src.rows != height))
-    {
-      if (data)
-        delete [] data;
+  update(src, cv::Rect(0, 0, src.cols, src.rows));
 
-      width = src.cols;
-      height = src.rows;
+}
 
-      data = new uint32_t[width * height * bins];
+void IntegralHistogram::update(Mat& src, cv::Rect r)
+{
 
-    }
+  if (src.type() != CV_8UC1)
+    throw LegitException("Integral histogram requires a grayscale image");
 
-  memset(data, 0, width * height * bins * sizeof(uint32_t));
+  bounds = cv::Size(src.cols, src.rows);
+  region = r & cv::Rect(0, 0, src.cols, src.rows);
 
-  uchar* src_current = src.ptr<uchar>(0);
-  uint32_t* dst_current = data;
+  width = region.width;
+  height = region.height;
 
-  uint32_t* row_sum = new uint32_t[bins];
-  memset(row_sum, 0, bins * sizeof(uint32_t));
+  int stride = width + 1;
+  int size = stride * (height + 1) * bins;
 
-  for (int i = 0; i < width; i++)
+  if (!data || size > capacity)
     {
-      for (int b = 0; b < bins; b++)
-        dst_current[b] = row_sum[b];
-      row_sum[src_current[i] >> shift]++;
-      dst_current += bins;
+      if (data)
+        delete [] data;
+
+      capacity = size;
+      data = new uint32_t[capacity];
     }
 
-  uint32_t* dst_previous = data;
-  for (int j = 1; j < height; j++)
+  memset(data, 0, stride * bins * sizeof(uint32_t));
+
+  uint32_t row_sum[32];
+
+  for (int j = 0; j < height; j++)
     {
-      src_current = src.ptr<uchar>(j);
+      uchar* src_current = src.ptr<uchar>(region.y + j) + region.x;
+      uint32_t* dst_previous = &(data[j * stride * bins]);
+      uint32_t* dst_current = dst_previous + stride * bins;
 
       memset(row_sum, 0, bins * sizeof(uint32_t));
+      memset(dst_current, 0, bins * sizeof(uint32_t));
 
       for (int i = 0; i < width; i++)
         {
+          row_sum[src_current[i] >> shift]++;
+
+          dst_current += bins;
+          dst_previous += bins;
+
           for (int b = 0; b < bins; b++)
             {
               dst_current[b] = row_sum[b] + dst_previous[b];
             }
-          dst_current += bins;
-          dst_previous += bins;
-          row_sum[src_current[i] >> shift]++;
         }
 
     }
 
-  delete [] row_sum;
 }
 
 void IntegralHistogram::print(int bin)
@@ -260,12 +282,12 @@ void IntegralHistogram::print(int bin)
 
   printf("Integral histogram (bin %d): \n", bin);
 
-  for (int j = 0; j < height; j++)
+  for (int j = 0; j <= height; j++)
     {
 
-      for (int i = 0; i < width; i++)
+      for (int i = 0; i <= width; i++)
         {
-          printf("%02d ", data[(j * width + i) * bins + bin]);
+          printf("%02d ", data[(j * (width + 1) + i) * bins + bin]);
         }
 
       printf("\n");
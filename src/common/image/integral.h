@@ -84,13 +84,22 @@ protected:
 };
 
 
+/**
+    Integral histogram of a grayscale image, optionally limited to a rectangular
+    region of the image. Cell (x, y) of the table holds the histogram of the pixels
+    in [0, x) x [0, y) relative to the region, so the table has an extra row
+    and column and a box query costs O(bins) regardless of the size of the box.
+    Queries use image coordinates.
+*/
 class IntegralHistogram
 {
 public:
   IntegralHistogram(Mat& src, int bins);
+  IntegralHistogram(Mat& src, int bins, cv::Rect region);
   ~IntegralHistogram();
 
   void update(Mat& src);
+  void update(Mat& src, cv::Rect region);
 
   inline SimpleHistogram sum(int x1, int y1, int x2, int y2)
   {
@@ -109,35 +118,116 @@ public:
     DEBUGGING
     {
       assert(hist.size == bins);
+      assert(x1 >= region.x && y1 >= region.y && x2 <= region.x + region.width && y2 <= region.y + region.height);
     }
 
-    uint32_t* dp = &(data[y2 * width + x2]);
-    uint32_t* bp = &(data[y1 * width + x2]);
-    uint32_t* cp = &(data[y2 * width + x1]);
-    uint32_t* ap = &(data[y1 * width + x1]);
+    x1 -= region.x;
+    x2 -= region.x;
+    y1 -= region.y;
+    y2 -= region.y;
 
-    hist.sum = 0;
+    int stride = width + 1;
 
-    for (int b = 0; b < bins; b++)
+    uint32_t* dp = &(data[(y2 * stride + x2) * bins]);
+    uint32_t* bp = &(data[(y1 * stride + x2) * bins]);
+    uint32_t* cp = &(data[(y2 * stride + x1) * bins]);
+    uint32_t* ap = &(data[(y1 * stride + x1) * bins]);
+
+    int b = 0;
+
+#ifdef HISTOGRAM_SSE2
+
+    // Bins are combined four at a time, the total is the area of the box
+    for (; b + 4 <= bins; b += 4)
+      {
+        __m128i d = _mm_loadu_si128((const __m128i*) &(dp[b]));
+        __m128i c = _mm_loadu_si128((const __m128i*) &(cp[b]));
+        __m128i u = _mm_loadu_si128((const __m128i*) &(bp[b]));
+        __m128i a = _mm_loadu_si128((const __m128i*) &(ap[b]));
+        _mm_storeu_si128((__m128i*) &(hist.data[b]), _mm_add_epi32(_mm_sub_epi32(_mm_sub_epi32(d, c), u), a));
+      }
+
+#endif
+
+    for (; b < bins; b++)
       {
         hist.data[b] = dp[b] - cp[b] - bp[b] + ap[b];
-        hist.sum += hist.data[b];
       }
 
+    hist.sum = (x2 - x1) * (y2 - y1);
+
   }
 
+  /**
+      Histogram of the square window around a point, clipped to the image in
+      the same way as update_histogram.
+  */
   inline void sum(cv::Point p, int half_size, SimpleHistogram& hist)
   {
 
     int x1 = MAX(p.x - half_size, 0);
     int y1 = MAX(p.y - half_size, 0);
-    int x2 = MIN(p.x + half_size, width);
-    int y2 = MIN(p.y + half_size, height);
+    int x2 = MIN(p.x + half_size, bounds.width);
+    int y2 = MIN(p.y + half_size, bounds.height);
+
+    if (x2 <= x1 || y2 <= y1)
+      {
+        memset(hist.data, 0, sizeof(int32_t) * bins);
+        hist.sum = MAX((x2 - x1) * (y2 - y1), 0);
+        return;
+      }
 
     sum(x1, y1, x2, y2, hist);
 
   }
 
+  template <int N>
+  inline void sum(cv::Point p, int half_size, Histogram<N>& hist)
+  {
+
+    DEBUGGING
+    {
+      assert(bins == N);
+    }
+
+    SimpleHistogram view;
+    view.data = hist.data;
+    view.size = N;
+
+    sum(p, half_size, view);
+
+    hist.sum = view.sum;
+
+  }
+
+  /**
+      Checks if the (clipped) window around a point lies within the region
+      covered by the integral histogram.
+  */
+  inline bool covers(cv::Point p, int half_size)
+  {
+
+    int x1 = MAX(p.x - half_size, 0);
+    int y1 = MAX(p.y - half_size, 0);
+    int x2 = MIN(p.x + half_size, bounds.width);
+    int y2 = MIN(p.y + half_size, bounds.height);
+
+    if (x2 <= x1 || y2 <= y1)
+      return true;
+
+    return x1 >= region.x && y1 >= region.y && x2 <= region.x + region.width && y2 <= region.y + region.height;
+
+  }
+
+  inline bool covers(cv::Rect r)
+  {
+
+    r &= cv::Rect(0, 0, bounds.width, bounds.height);
+
+    return (r & region) == r;
+
+  }
+
   inline int get_width()
   {
     return width;
@@ -150,6 +240,10 @@ public:
   {
     return bins;
   };
+  inline cv::Rect get_region()
+  {
+    return region;
+  };
 
   void print(int bin);
 
@@ -159,11 +253,31 @@ private:
   int height;
   int bins;
   int shift;
+  int capacity;
+
+  cv::Rect region;
+  cv::Size bounds;
 
   uint32_t* data;
 
 };
 
+/**
+  Bhattacharyya distance between the reference and the N bin histogram of the
+  square region around a given position, computed from an integral histogram
+  with the same number of bins.
+*/
+template <int N>
+inline float histogram_distance(IntegralHistogram& integral, cv::Point position, int half_size, HistogramRoots& reference)
+{
+
+  Histogram<N> temporary;
+
+  integral.sum(position, half_size, temporary);
+
+  return (1.0 - compare_histogram(temporary, reference));
+}
+
 }
 
 }
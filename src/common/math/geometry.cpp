@@ -189,7 +189,7 @@ Matrix3f simple_affine_transformation(float tx, float ty, float r, float sx, flo
   return m;
 }
 
-Matrix3f compute_affine_transformation(vector<Point2f> from, vector<Point2f> to)
+Matrix3f compute_affine_transformation(const vector<Point2f>& from, const vector<Point2f>& to)
 {
 
   if (from.size() != to.size())
@@ -273,55 +273,81 @@ Matrix3f compute_affine_transformation(vector<Point2f> from, vector<Point2f> to)
 
 }
 
-Matrix3f compute_affine_transformation(vector<Point2f> from, vector<Point2f> to, vector<float> weights)
+Matrix3f compute_affine_transformation(const vector<Point2f>& from, const vector<Point2f>& to, const vector<float>& weights)
 {
   if (from.size() != to.size() || from.size() != weights.size())
     throw LegitException("Unable to compute affine transform: from/to point set not the same size.");
 
-  Mat_<float> A = Mat_<float>(from.size() * 2, 6);
-  Mat_<float> L = Mat_<float>(from.size() * 2, 1);
+  if (from.empty())
+    return compute_affine_transformation((const Point2f*) NULL, NULL, NULL, 0);
 
-  A.setTo(0);
+  return compute_affine_transformation(&(from[0]), &(to[0]), &(weights[0]), from.size());
 
-  float weights_total = 0;
+}
 
-  for (int i = 0; i < from.size(); i++)
-    {
-      weights_total += weights[i];
-    }
+Matrix3f compute_affine_transformation(const Point2f* from, const Point2f* to, const float* weights, int count)
+{
 
-  for (int i = 0; i < from.size(); i++)
-    {
-      float w = sqrt(weights[i] / (2 * weights_total));
+  // Normal equations M * [a b c]' = r for both output coordinates, where
+  // M = sum w * [x y 1]' * [x y 1]
+  double sxx = 0, sxy = 0, syy = 0, sx = 0, sy = 0, sw = 0;
+  double tx_x = 0, tx_y = 0, tx_1 = 0, ty_x = 0, ty_y = 0, ty_1 = 0;
 
-      A(i*2, 0) = from[i].x * w;
-      A(i*2, 1) = from[i].y * w;
-      A(i*2, 2) = w;
-      A(i*2+1, 3) = from[i].x * w;
-      A(i*2+1, 4) = from[i].y * w;
-      A(i*2+1, 5) = w;
-      L(i*2, 0) = to[i].x * w;
-      L(i*2+1, 0) = to[i].y * w;
+  for (int i = 0; i < count; i++)
+    {
+      double w = weights[i];
+      double x = from[i].x;
+      double y = from[i].y;
+
+      sxx += w * x * x;
+      sxy += w * x * y;
+      syy += w * y * y;
+      sx += w * x;
+      sy += w * y;
+      sw += w;
+
+      tx_x += w * to[i].x * x;
+      tx_y += w * to[i].x * y;
+      tx_1 += w * to[i].x;
+      ty_x += w * to[i].y * x;
+      ty_y += w * to[i].y * y;
+      ty_1 += w * to[i].y;
     }
 
-  // TODO: optimize
-  Mat inv;
-  invert(A.t() * A, inv);
-  Mat X = inv * A.t() * L;
-
   Matrix3f result;
-  result.m00 = X.at<float>(0, 0);
-  result.m10 = X.at<float>(1, 0);
-  result.m20 = X.at<float>(2, 0);
-
-  result.m01 = X.at<float>(3, 0);
-  result.m11 = X.at<float>(4, 0);
-  result.m21 = X.at<float>(5, 0);
-
   result.m02 = 0;
   result.m12 = 0;
   result.m22 = 1;
 
+  // Cofactors of the symmetric matrix [sxx sxy sx; sxy syy sy; sx sy sw]
+  double c00 = syy * sw - sy * sy;
+  double c01 = sx * sy - sxy * sw;
+  double c02 = sxy * sy - syy * sx;
+  double c11 = sxx * sw - sx * sx;
+  double c12 = sxy * sx - sxx * sy;
+  double c22 = sxx * syy - sxy * sxy;
+
+  double det = sxx * c00 + sxy * c01 + sx * c02;
+
+  if (sw <= 0 || fabs(det) < 1e-9 * sw * sw * sw)
+    {
+      result.m00 = 1;
+      result.m10 = 0;
+      result.m01 = 0;
+      result.m11 = 1;
+      result.m20 = (sw > 0) ? (tx_1 - sx) / sw : 0;
+      result.m21 = (sw > 0) ? (ty_1 - sy) / sw : 0;
+      return result;
+    }
+
+  result.m00 = (c00 * tx_x + c01 * tx_y + c02 * tx_1) / det;
+  result.m10 = (c01 * tx_x + c11 * tx_y + c12 * tx_1) / det;
+  result.m20 = (c02 * tx_x + c12 * tx_y + c22 * tx_1) / det;
+
+  result.m01 = (c00 * ty_x + c01 * ty_y + c02 * ty_1) / det;
+  result.m11 = (c01 * ty_x + c11 * ty_y + c12 * ty_1) / det;
+  result.m21 = (c02 * ty_x + c12 * ty_y + c22 * ty_1) / det;
+
   return result;
 
 }
@@ -319,9 +319,16 @@ Matrix2f transpose(Matrix2f m);
 
 Matrix3f simple_affine_transformation(float tx, float ty, float r, float sx, float sy);
 
-Matrix3f compute_affine_transformation(vector<Point2f> from, vector<Point2f> to);
+Matrix3f compute_affine_transformation(const vector<Point2f>& from, const vector<Point2f>& to);
 
-Matrix3f compute_affine_transformation(vector<Point2f> from, vector<Point2f> to, vector<float> weights);
+Matrix3f compute_affine_transformation(const vector<Point2f>& from, const vector<Point2f>& to, const vector<float>& weights);
+
+/**
+ Weighted least-squares affine transformation between two point sets given as
+ arrays. Solves the 3x3 normal equations directly and does not allocate memory.
+ Falls back to a weighted translation if the points are degenerate.
+*/
+Matrix3f compute_affine_transformation(const Point2f* from, const Point2f* to, const float* weights, int count);
 
 Rect4f compute_bounds(Rect4f bounds, vector<Point2f> from, vector<Point2f> to, vector<float> weights);
 
@@ -0,0 +1,153 @@
+/*******************************************************************************
+* Copyright (c) 2013, Luka Cehovin
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the University of Ljubljana nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL LUKA CEHOVIN BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*******************************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#ifndef KALMAN_H
+#define KALMAN_H
+
+#include "common/math/small.h"
+
+/**
+ Linear Kalman filter with S state and M measurement dimensions. Same model
+ as cv::KalmanFilter, but all the matrices and temporaries have a constant
+ size, so neither predict nor correct allocates memory.
+*/
+template <int S, int M>
+class SmallKalmanFilter
+{
+public:
+
+  SmallKalmanFilter()
+  {
+    transition.identity();
+    measurement.zeros();
+    process_noise.identity();
+    measurement_noise.identity();
+    state_pre.zeros();
+    state_post.zeros();
+    covariance_pre.zeros();
+    covariance_post.zeros();
+  }
+
+  /**
+      Projects the state to the next step and returns the prediction.
+  */
+  const SmallVector<S>& predict()
+  {
+
+    product(transition, state_post, state_pre);
+
+    SmallMatrix<S, S> temp;
+    product(transition, covariance_post, temp);
+    product_transposed(temp, transition, covariance_pre);
+
+    for (int i = 0; i < S * S; i++)
+      covariance_pre.data[i] += process_noise.data[i];
+
+    state_post = state_pre;
+    covariance_post = covariance_pre;
+
+    return state_pre;
+
+  }
+
+  /**
+      Residual of a measurement with respect to the prediction and its
+      covariance.
+  */
+  void innovation(const SmallVector<M>& z, SmallVector<M>& residual, SmallMatrix<M, M>& covariance)
+  {
+
+    SmallVector<M> projected;
+    product(measurement, state_pre, projected);
+
+    for (int i = 0; i < M; i++)
+      residual[i] = z[i] - projected[i];
+
+    SmallMatrix<M, S> temp;
+    product(measurement, covariance_pre, temp);
+    product_transposed(temp, measurement, covariance);
+
+    for (int i = 0; i < M * M; i++)
+      covariance.data[i] += measurement_noise.data[i];
+
+  }
+
+  /**
+      Updates the predicted state with a measurement.
+  */
+  const SmallVector<S>& correct(const SmallVector<M>& z)
+  {
+
+    SmallVector<M> residual;
+    SmallMatrix<M, M> covariance, inverse;
+
+    innovation(z, residual, covariance);
+
+    if (!invert(covariance, inverse))
+      return state_post;
+
+    // gain = P * H' * S^-1
+    SmallMatrix<S, M> ph;
+    product_transposed(covariance_pre, measurement, ph);
+    product(ph, inverse, gain);
+
+    SmallVector<S> change;
+    product(gain, residual, change);
+
+    for (int i = 0; i < S; i++)
+      state_post[i] = state_pre[i] + change[i];
+
+    // P = P - K * H * P
+    SmallMatrix<M, S> hp;
+    product(measurement, covariance_pre, hp);
+    SmallMatrix<S, S> khp;
+    product(gain, hp, khp);
+
+    for (int i = 0; i < S * S; i++)
+      covariance_post.data[i] = covariance_pre.data[i] - khp.data[i];
+
+    return state_post;
+
+  }
+
+  SmallMatrix<S, S> transition;
+  SmallMatrix<M, S> measurement;
+  SmallMatrix<S, S> process_noise;
+  SmallMatrix<M, M> measurement_noise;
+
+  SmallVector<S> state_pre;
+  SmallVector<S> state_post;
+  SmallMatrix<S, S> covariance_pre;
+  SmallMatrix<S, S> covariance_post;
+
+  SmallMatrix<S, M> gain;
+
+};
+
+#endif
@@ -311,13 +311,18 @@ static const double wtab[128] =
  ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  */
 double random_MT_normal()
+{
+  return random_MT_normal(&random_sampler);
+}
+
+double random_MT_normal(tinymt32_t* random)
 {
   unsigned long  U, sign, i, j;
   double  x, y;
 
   while (1)
     {
-      U = tinymt32_generate_uint32(&random_sampler) ; //randomMT_ulong() ; //gsl_rng_uint32 (r); // uniformly distributed random number (unsigned long)
+      U = tinymt32_generate_uint32(random) ; //randomMT_ulong() ; //gsl_rng_uint32 (r); // uniformly distributed random number (unsigned long)
       i = U & 0x0000007F;		/* 7 bit to choose the step */
       sign = U & 0x00000080;	/* 1 bit for the sign */
       j = U>>8;			/* 24 bit for the x-value */
@@ -331,7 +336,7 @@ double random_MT_normal()
           y0 = ytab[i];
           y1 = ytab[i+1];
           //y = y1+(y0-y1)*gsl_rng_uniform(r); // random number between zero and one (double)
-          y = y1+(y0-y1)*(float)tinymt32_generate_float( &random_sampler ) ; //randomMT_no1();
+          y = y1+(y0-y1)*(float)tinymt32_generate_float(random) ; //randomMT_no1();
 
           /*   if(y~=0.0){
                  y = log(y);
@@ -344,11 +349,11 @@ double random_MT_normal()
         {
           //x = PARAM_R - log(1.0-gsl_rng_uniform(r))/PARAM_R;
 
-          x = PARAM_R - log(1.0-(float)tinymt32_generate_float( &random_sampler ))/PARAM_R;
+          x = PARAM_R - log(1.0-(float)tinymt32_generate_float(random))/PARAM_R;
 
           //y = exp(-PARAM_R*(x-0.5*PARAM_R))*gsl_rng_uniform(r);
 
-          y = exp(-PARAM_R*(x-PARAM_R05))*(float)tinymt32_generate_float( &random_sampler );
+          y = exp(-PARAM_R*(x-PARAM_R05))*(float)tinymt32_generate_float(random);
 
         }
       if (y < exp(-0.5*x*x))  break;
@@ -86,6 +86,7 @@ float random_MT_uniform ( void ) ;
 void set_seedMT ( uint32 seed ) ;
 void initializeMTwister ( void ) ;
 double random_MT_normal() ;
+double random_MT_normal(tinymt32_t* random) ;
 
 
 #if defined(__GNUC__)
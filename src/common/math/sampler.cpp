@@ -0,0 +1,263 @@
+/*******************************************************************************
+* Copyright (c) 2013, Luka Cehovin
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the University of Ljubljana nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL LUKA CEHOVIN BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*******************************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#include <math.h>
+#include <string.h>
+#include "common/math/math.h"
+#include "common/math/sampler.h"
+
+// Index of the element where the prefix sum of a Fenwick tree (1-based)
+// exceeds the given value, the value is reduced by the preceding sum
+static int fenwick_search(const double* tree, int size, double& value)
+{
+
+  int position = 0;
+  int step = 1;
+
+  while (step * 2 <= size) step *= 2;
+
+  for (; step > 0; step >>= 1)
+    {
+      if (position + step <= size && tree[position + step] <= value)
+        {
+          position += step;
+          value -= tree[position];
+        }
+    }
+
+  return MIN(position, size - 1);
+
+}
+
+// Converts the values in tree[1 ... size] to a Fenwick tree in linear time
+static void fenwick_build(double* tree, int size)
+{
+
+  for (int i = 1; i <= size; i++)
+    {
+      int parent = i + (i & -i);
+      if (parent <= size) tree[parent] += tree[i];
+    }
+
+}
+
+MapSampler::MapSampler() : width(0), height(0), sum(0)
+{
+
+}
+
+MapSampler::~MapSampler()
+{
+
+}
+
+void MapSampler::build_row(int row)
+{
+
+  float* data = map.ptr<float>(row);
+  double* tree = &(cells[row * (width + 1)]);
+
+  double total = 0;
+
+  tree[0] = 0;
+  for (int i = 0; i < width; i++)
+    {
+      tree[i + 1] = data[i];
+      total += data[i];
+    }
+
+  fenwick_build(tree, width);
+
+  rows[row + 1] = total;
+
+}
+
+void MapSampler::build(Mat& source)
+{
+
+  map = source;
+  width = map.cols;
+  height = map.rows;
+
+  cells.resize(height * (width + 1));
+  rows.resize(height + 1);
+  rows[0] = 0;
+
+  for (int j = 0; j < height; j++)
+    build_row(j);
+
+  sum = 0;
+  for (int j = 1; j <= height; j++)
+    sum += rows[j];
+
+  fenwick_build(&(rows[0]), height);
+
+}
+
+void MapSampler::build(Mat& source, float threshold, int window, float percent)
+{
+
+  map = source;
+  width = map.cols;
+  height = map.rows;
+
+  cells.resize(height * (width + 1));
+  rows.resize(height + 1);
+  rows[0] = 0;
+
+  counts.assign(width, 0);
+
+  int window_threshold = ((float) window * window) * percent;
+  int window_offset = ceil( ((float) window) / 2);
+
+  // Column counts of the elements above the threshold in rows (j, added].
+  // The decision for a row only depends on the rows below it, so the map can
+  // be modified in place going downwards.
+  int added = 0;
+
+  for (int j = 0; j < height; j++)
+    {
+      int end = MIN(height - 1, j + window);
+
+      if (j > 0 && j <= added)
+        {
+          const float* data = map.ptr<float>(j);
+          for (int i = 0; i < width; i++)
+            counts[i] -= (data[i] > threshold) ? 1 : 0;
+        }
+
+      while (added < end)
+        {
+          const float* data = map.ptr<float>(++added);
+          for (int i = 0; i < width; i++)
+            counts[i] += (data[i] > threshold) ? 1 : 0;
+        }
+
+      float* data = map.ptr<float>(j);
+
+      if (j - window_offset <= 0 || j + window_offset >= height - 1)
+        {
+          memset(data, 0, sizeof(float) * width);
+        }
+      else
+        {
+          for (int i = 0; i < window_offset && i < width; i++)
+            {
+              data[i] = 0;
+              data[width - 1 - i] = 0;
+            }
+
+          int count = 0;
+          for (int i = 0; i < window && i < width; i++)
+            count += counts[i];
+
+          for (int i = 0; i < width - window; i++)
+            {
+              if (count < window_threshold)
+                data[i + window_offset] = 0;
+
+              count += counts[i + window] - counts[i];
+            }
+        }
+
+      build_row(j);
+    }
+
+  sum = 0;
+  for (int j = 1; j <= height; j++)
+    sum += rows[j];
+
+  fenwick_build(&(rows[0]), height);
+
+}
+
+cv::Point MapSampler::sample()
+{
+
+  if (height < 1 || width < 1 || sum <= 0)
+    return cv::Point(-1, -1);
+
+  double value = RANDOM_UNIFORM * sum;
+
+  int y = fenwick_search(&(rows[0]), height, value);
+  int x = fenwick_search(&(cells[y * (width + 1)]), width, value);
+
+  return cv::Point(x, y);
+
+}
+
+void MapSampler::update(int row, int column, double delta)
+{
+
+  double* tree = &(cells[row * (width + 1)]);
+
+  for (int i = column + 1; i <= width; i += (i & -i))
+    tree[i] += delta;
+
+}
+
+void MapSampler::multiply(Mat& mask, cv::Point position)
+{
+
+  int ox = position.x - mask.cols / 2;
+  int oy = position.y - mask.rows / 2;
+
+  int x1 = MAX(0, ox), x2 = MIN(width, ox + mask.cols);
+  int y1 = MAX(0, oy), y2 = MIN(height, oy + mask.rows);
+
+  for (int j = y1; j < y2; j++)
+    {
+      float* data = map.ptr<float>(j);
+      const float* factors = mask.ptr<float>(j - oy);
+
+      double delta = 0;
+
+      for (int i = x1; i < x2; i++)
+        {
+          float value = data[i] * factors[i - ox];
+          double difference = (double) value - data[i];
+          data[i] = value;
+
+          if (difference != 0)
+            {
+              update(j, i, difference);
+              delta += difference;
+            }
+        }
+
+      if (delta != 0)
+        {
+          for (int k = j + 1; k <= height; k += (k & -k))
+            rows[k] += delta;
+
+          sum += delta;
+        }
+    }
+
+}
@@ -0,0 +1,102 @@
+/*******************************************************************************
+* Copyright (c) 2013, Luka Cehovin
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the University of Ljubljana nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL LUKA CEHOVIN BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*******************************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+using namespace cv;
+using namespace std;
+
+/**
+    Draws positions from an unnormalized probability map (1 channel CV_32F).
+    Every row is kept in a Fenwick tree and the row totals in another one,
+    so a draw takes O(log rows + log cols) and changing a region of the map
+    only updates the trees for the changed elements. The sampler works
+    directly on the given map, the storage for the trees is reused between
+    builds.
+*/
+class MapSampler
+{
+public:
+  MapSampler();
+  ~MapSampler();
+
+  void build(Mat& map);
+
+  /**
+      Suppresses noise in the map before building the sampler. An element is
+      set to zero unless enough elements in the window next to it are above
+      the threshold. Border rows and columns are always set to zero.
+  */
+  void build(Mat& map, float threshold, int window, float percent);
+
+  /**
+      Draws a position with probability proportional to its value. Returns
+      (-1, -1) if the map is empty.
+  */
+  cv::Point sample();
+
+  /**
+      Multiplies the map with a mask centered at the given position.
+  */
+  void multiply(Mat& mask, cv::Point position);
+
+  inline float get(cv::Point position)
+  {
+    return map.at<float>(position.y, position.x);
+  }
+
+  inline double total()
+  {
+    return sum;
+  }
+
+private:
+
+  void build_row(int row);
+
+  void update(int row, int column, double delta);
+
+  Mat map;
+
+  int width;
+  int height;
+
+  double sum;
+
+  vector<double> cells;
+  vector<double> rows;
+  vector<int> counts;
+
+};
+
+#endif
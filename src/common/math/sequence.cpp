@@ -0,0 +1,298 @@
+/*******************************************************************************
+* Copyright (c) 2013, Luka Cehovin
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the University of Ljubljana nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL LUKA CEHOVIN BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*******************************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#include <math.h>
+#include "sequence.h"
+
+// Sobol direction numbers for dimensions 2 to 8 (Joe and Kuo): degree of the
+// primitive polynomial, its coefficients and the initial direction numbers
+static const int sobol_degree[SEQUENCE_MAX_DIMENSIONS - 1] = {1, 2, 3, 3, 4, 4, 5};
+static const int sobol_coefficients[SEQUENCE_MAX_DIMENSIONS - 1] = {0, 1, 1, 2, 1, 4, 2};
+static const int sobol_initial[SEQUENCE_MAX_DIMENSIONS - 1][5] =
+{
+  {1}, {1, 3}, {1, 3, 1}, {1, 1, 1}, {1, 1, 3, 3}, {1, 3, 5, 13}, {1, 1, 5, 5, 17}
+};
+
+static const int halton_bases[SEQUENCE_MAX_DIMENSIONS] = {2, 3, 5, 7, 11, 13, 17, 19};
+
+double inverse_normal(double p)
+{
+
+  static const double a[6] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                              1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00
+                             };
+  static const double b[5] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                              6.680131188771972e+01, -1.328068155288572e+01
+                             };
+  static const double c[6] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                              -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00
+                             };
+  static const double d[4] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+                              3.754408661907416e+00
+                             };
+
+  static const double low = 0.02425;
+
+  if (p <= 0) return -HUGE_VAL;
+  if (p >= 1) return HUGE_VAL;
+
+  if (p < low)
+    {
+      double q = sqrt(-2 * log(p));
+      return (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+             ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+    }
+
+  if (p > 1 - low)
+    {
+      double q = sqrt(-2 * log(1 - p));
+      return -(((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+             ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+    }
+
+  double q = p - 0.5;
+  double r = q * q;
+
+  return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+         (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+
+}
+
+static inline uint32_t random_bits(tinymt32_t* random)
+{
+
+  return random ? tinymt32_generate_uint32(random) : (uint32_t) (RANDOM_UNIFORM * 4294967295.0);
+
+}
+
+GaussianSequence::GaussianSequence() : type(SEQUENCE_RANDOM), dimensions(0), index(0)
+{
+
+  // The first dimension is the van der Corput sequence in base 2
+  for (int i = 0; i < 32; i++)
+    directions[0][i] = 1U << (31 - i);
+
+  for (int k = 1; k < SEQUENCE_MAX_DIMENSIONS; k++)
+    {
+      int s = sobol_degree[k - 1];
+      int a = sobol_coefficients[k - 1];
+      uint32_t* v = directions[k];
+
+      for (int i = 0; i < s; i++)
+        v[i] = ((uint32_t) sobol_initial[k - 1][i]) << (31 - i);
+
+      for (int i = s; i < 32; i++)
+        {
+          v[i] = v[i - s] ^ (v[i - s] >> s);
+
+          for (int j = 1; j < s; j++)
+            if ((a >> (s - 1 - j)) & 1) v[i] ^= v[i - j];
+        }
+    }
+
+  for (int k = 0; k < SEQUENCE_MAX_DIMENSIONS; k++)
+    {
+      state[k] = 0;
+      shift[k] = 0;
+      rotation[k] = 0;
+    }
+
+}
+
+GaussianSequence::~GaussianSequence()
+{
+
+}
+
+void GaussianSequence::reset(int type, int dimensions, tinymt32_t* random)
+{
+
+  this->type = type;
+  this->dimensions = dimensions;
+  index = 0;
+
+  // Pseudo-random sampling does not consume any random numbers here
+  if (type == SEQUENCE_RANDOM) return;
+
+  for (int k = 0; k < MIN(dimensions, SEQUENCE_MAX_DIMENSIONS); k++)
+    {
+      state[k] = 0;
+      shift[k] = random_bits(random);
+      rotation[k] = (double) shift[k] / 4294967296.0;
+    }
+
+}
+
+void GaussianSequence::next(double* point)
+{
+
+  int count = MIN(dimensions, SEQUENCE_MAX_DIMENSIONS);
+
+  if (type == SEQUENCE_SOBOL)
+    {
+      // Gray code order, the direction of the lowest zero bit of the index
+      // is added to the previous point
+      if (index > 0)
+        {
+          uint32_t n = index - 1;
+          int c = 0;
+          while (n & 1)
+            {
+              n >>= 1;
+              c++;
+            }
+
+          for (int k = 0; k < count; k++)
+            state[k] ^= directions[k][c];
+        }
+
+      for (int k = 0; k < count; k++)
+        point[k] = ((double) (state[k] ^ shift[k]) + 0.5) / 4294967296.0;
+    }
+  else
+    {
+      for (int k = 0; k < count; k++)
+        {
+          double f = 1.0 / halton_bases[k];
+          double value = 0;
+
+          for (uint32_t n = index + 1; n > 0; n /= halton_bases[k])
+            {
+              value += f * (n % halton_bases[k]);
+              f /= halton_bases[k];
+            }
+
+          value += rotation[k];
+          value -= floor(value);
+
+          point[k] = MIN(MAX(value, 1e-10), 1 - 1e-10);
+        }
+    }
+
+  index++;
+
+}
+
+void GaussianSequence::sample(Matrix& mu, Matrix& sigma, int N, Matrix& out, int offset, SVD& svd, tinymt32_t* random)
+{
+
+  if (type == SEQUENCE_RANDOM)
+    {
+      sample_gaussian2(mu, sigma, N, out, offset, svd, random);
+      return;
+    }
+
+  int n = mu.cols;
+
+  svd(sigma);
+
+  sqrt(svd.w, svd.w);
+
+  double* u_direct = (double *) svd.u.data;
+  double* w_direct = (double *) svd.w.data;
+  double* mu_direct = (double *) mu.data;
+
+  double point[SEQUENCE_MAX_DIMENSIONS];
+  if ((int) deviates.size() < n)
+    deviates.resize(n);
+
+  double* z = &(deviates[0]);
+
+  for (int r = 0; r < N; r++)
+    {
+
+      next(point);
+
+      // Singular values are sorted, so the best distributed dimensions of
+      // the sequence are used for the largest variances
+      for (int i = 0; i < n; i++)
+        z[i] = (i < SEQUENCE_MAX_DIMENSIONS && i < dimensions) ? inverse_normal(point[i]) :
+               (random ? random_MT_normal(random) : randn());
+
+      double* out_direct = (double *)out.ptr(r + offset);
+      for (int j = 0; j < n; j++)
+        {
+
+          double sum = 0;
+
+          for (int i = 0; i < n; i++)
+            {
+              sum += u_direct[j*n + i] * w_direct[i] * z[i];
+            }
+
+          out_direct[j] = sum + mu_direct[j];
+        }
+
+    }
+
+}
+
+void GaussianSequence::sample(const double* mu, const double* factor, int n, int N, Matrix& out, int offset, tinymt32_t* random)
+{
+
+  double point[SEQUENCE_MAX_DIMENSIONS];
+  if ((int) deviates.size() < n)
+    deviates.resize(n);
+
+  double* z = &(deviates[0]);
+
+  for (int r = 0; r < N; r++)
+    {
+
+      if (type == SEQUENCE_RANDOM)
+        {
+          for (int i = 0; i < n; i++)
+            z[i] = random ? random_MT_normal(random) : randn();
+        }
+      else
+        {
+          next(point);
+
+          for (int i = 0; i < n; i++)
+            z[i] = (i < SEQUENCE_MAX_DIMENSIONS && i < dimensions) ? inverse_normal(point[i]) :
+                   (random ? random_MT_normal(random) : randn());
+        }
+
+      double* out_direct = (double *)out.ptr(r + offset);
+      for (int j = 0; j < n; j++)
+        {
+
+          double sum = 0;
+
+          for (int i = 0; i < n; i++)
+            {
+              sum += factor[j*n + i] * z[i];
+            }
+
+          out_direct[j] = sum + mu[j];
+        }
+
+    }
+
+}
@@ -0,0 +1,118 @@
+/*******************************************************************************
+* Copyright (c) 2013, Luka Cehovin
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the University of Ljubljana nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL LUKA CEHOVIN BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*******************************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "common/math/statistics.h"
+#include "common/math/small.h"
+
+using namespace cv;
+using namespace std;
+
+#define SEQUENCE_RANDOM 0
+#define SEQUENCE_HALTON 1
+#define SEQUENCE_SOBOL 2
+
+#define SEQUENCE_MAX_DIMENSIONS 8
+
+/**
+ Inverse of the standard normal cumulative distribution function (rational
+ approximation by P. J. Acklam, relative error below 1.15e-9).
+*/
+double inverse_normal(double p);
+
+/**
+    Generates samples from a Gaussian distribution using either pseudo-random
+    numbers or a randomized low-discrepancy sequence (Sobol with a random
+    digital shift or Halton with a random rotation). The uniform points are
+    mapped through the inverse normal CDF and the covariance factor, the first
+    dimension of the sequence is assigned to the principal axis. Consecutive
+    calls continue the sequence until it is reset, so adding samples to an
+    existing set keeps the coverage uniform. Dimensions above
+    SEQUENCE_MAX_DIMENSIONS are filled with pseudo-random numbers.
+*/
+class GaussianSequence
+{
+public:
+  GaussianSequence();
+  ~GaussianSequence();
+
+  /**
+      Starts a new point set. The randomization is drawn from the given
+      stream or from the global generator if no stream is given.
+  */
+  void reset(int type, int dimensions, tinymt32_t* random = NULL);
+
+  void sample(Matrix& mu, Matrix& sigma, int N, Matrix& out, int offset, SVD& svd, tinymt32_t* random = NULL);
+
+  /**
+      Fixed-size version that does not use any temporary matrices. The
+      pseudo-random sequence uses the Cholesky factor, the low-discrepancy
+      ones the principal axes of the covariance.
+  */
+  template <int D>
+  void sample(const SmallVector<D>& mu, const SmallMatrix<D, D>& sigma, int N, Matrix& out, int offset, tinymt32_t* random = NULL)
+  {
+    SmallMatrix<D, D> factor;
+    gaussian_factor(sigma, type != SEQUENCE_RANDOM, factor);
+    sample(mu.data, factor.data, D, N, out, offset, random);
+  }
+
+  /**
+      Samples x = mu + F * z, where F is a row-major n by n factor of the
+      covariance.
+  */
+  void sample(const double* mu, const double* factor, int n, int N, Matrix& out, int offset, tinymt32_t* random = NULL);
+
+  inline int get_type()
+  {
+    return type;
+  }
+
+private:
+
+  void next(double* point);
+
+  int type;
+  int dimensions;
+  uint32_t index;
+
+  uint32_t directions[SEQUENCE_MAX_DIMENSIONS][32];
+  uint32_t state[SEQUENCE_MAX_DIMENSIONS];
+  uint32_t shift[SEQUENCE_MAX_DIMENSIONS];
+  double rotation[SEQUENCE_MAX_DIMENSIONS];
+
+  vector<double> deviates;
+
+};
+
+#endif
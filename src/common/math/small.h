@@ -0,0 +1,487 @@
+/*******************************************************************************
+* Copyright (c) 2013, Luka Cehovin
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the University of Ljubljana nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL LUKA CEHOVIN BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*******************************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#ifndef SMALL_H
+#define SMALL_H
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "common/math/statistics.h"
+
+/**
+ Vector of a dimension that is known at compile time. It lives on the stack
+ and is used instead of Matrix in the small hot computations.
+*/
+template <int N>
+class SmallVector
+{
+public:
+
+  SmallVector() {}
+
+  SmallVector(const double* values)
+  {
+    memcpy(data, values, sizeof(double) * N);
+  }
+
+  inline double& operator[](int i)
+  {
+    return data[i];
+  }
+
+  inline const double& operator[](int i) const
+  {
+    return data[i];
+  }
+
+  inline void zeros()
+  {
+    memset(data, 0, sizeof(double) * N);
+  }
+
+  /**
+      Reads a row or a column vector.
+  */
+  void load(const Matrix& m)
+  {
+    for (int i = 0; i < N; i++)
+      data[i] = m.rows == 1 ? m(0, i) : m(i, 0);
+  }
+
+  void store(Matrix& m) const
+  {
+    for (int i = 0; i < N; i++)
+      (m.rows == 1 ? m(0, i) : m(i, 0)) = data[i];
+  }
+
+  double data[N];
+
+};
+
+/**
+ Row-major matrix of a size that is known at compile time.
+*/
+template <int R, int C>
+class SmallMatrix
+{
+public:
+
+  SmallMatrix() {}
+
+  SmallMatrix(const double* values)
+  {
+    memcpy(data, values, sizeof(double) * R * C);
+  }
+
+  inline double& operator()(int i, int j)
+  {
+    return data[i * C + j];
+  }
+
+  inline const double& operator()(int i, int j) const
+  {
+    return data[i * C + j];
+  }
+
+  inline void zeros()
+  {
+    memset(data, 0, sizeof(double) * R * C);
+  }
+
+  inline void identity(double value = 1)
+  {
+    zeros();
+    for (int i = 0; i < R && i < C; i++)
+      data[i * C + i] = value;
+  }
+
+  void load(const Matrix& m)
+  {
+    for (int i = 0; i < R; i++)
+      for (int j = 0; j < C; j++)
+        data[i * C + j] = m(i, j);
+  }
+
+  void store(Matrix& m) const
+  {
+    for (int i = 0; i < R; i++)
+      for (int j = 0; j < C; j++)
+        m(i, j) = data[i * C + j];
+  }
+
+  double data[R * C];
+
+};
+
+// out = a * b
+template <int R, int K, int C>
+inline void product(const SmallMatrix<R, K>& a, const SmallMatrix<K, C>& b, SmallMatrix<R, C>& out)
+{
+  for (int i = 0; i < R; i++)
+    for (int j = 0; j < C; j++)
+      {
+        double sum = 0;
+        for (int k = 0; k < K; k++)
+          sum += a(i, k) * b(k, j);
+        out(i, j) = sum;
+      }
+}
+
+// out = a * b'
+template <int R, int K, int C>
+inline void product_transposed(const SmallMatrix<R, K>& a, const SmallMatrix<C, K>& b, SmallMatrix<R, C>& out)
+{
+  for (int i = 0; i < R; i++)
+    for (int j = 0; j < C; j++)
+      {
+        double sum = 0;
+        for (int k = 0; k < K; k++)
+          sum += a(i, k) * b(j, k);
+        out(i, j) = sum;
+      }
+}
+
+// out = a * v
+template <int R, int C>
+inline void product(const SmallMatrix<R, C>& a, const SmallVector<C>& v, SmallVector<R>& out)
+{
+  for (int i = 0; i < R; i++)
+    {
+      double sum = 0;
+      for (int k = 0; k < C; k++)
+        sum += a(i, k) * v[k];
+      out[i] = sum;
+    }
+}
+
+template <int N>
+inline double determinant(const SmallMatrix<N, N>& m)
+{
+
+  if (N == 1)
+    return m.data[0];
+
+  if (N == 2)
+    return m.data[0] * m.data[3] - m.data[1] * m.data[2];
+
+  // Gaussian elimination with partial pivoting
+  SmallMatrix<N, N> a = m;
+  double det = 1;
+
+  for (int c = 0; c < N; c++)
+    {
+      int pivot = c;
+      for (int r = c + 1; r < N; r++)
+        if (fabs(a(r, c)) > fabs(a(pivot, c))) pivot = r;
+
+      if (a(pivot, c) == 0)
+        return 0;
+
+      if (pivot != c)
+        {
+          for (int k = 0; k < N; k++)
+            std::swap(a(c, k), a(pivot, k));
+          det = -det;
+        }
+
+      det *= a(c, c);
+
+      for (int r = c + 1; r < N; r++)
+        {
+          double f = a(r, c) / a(c, c);
+          for (int k = c; k < N; k++)
+            a(r, k) -= f * a(c, k);
+        }
+    }
+
+  return det;
+
+}
+
+/**
+ Inverse by Gauss-Jordan elimination, returns false if the matrix is singular.
+*/
+template <int N>
+inline bool invert(const SmallMatrix<N, N>& m, SmallMatrix<N, N>& out)
+{
+
+  if (N == 2)
+    {
+      double det = m.data[0] * m.data[3] - m.data[1] * m.data[2];
+      if (det == 0) return false;
+      out.data[0] = m.data[3] / det;
+      out.data[1] = -m.data[1] / det;
+      out.data[2] = -m.data[2] / det;
+      out.data[3] = m.data[0] / det;
+      return true;
+    }
+
+  SmallMatrix<N, N> a = m;
+  out.identity();
+
+  for (int c = 0; c < N; c++)
+    {
+      int pivot = c;
+      for (int r = c + 1; r < N; r++)
+        if (fabs(a(r, c)) > fabs(a(pivot, c))) pivot = r;
+
+      if (a(pivot, c) == 0)
+        return false;
+
+      for (int k = 0; k < N; k++)
+        {
+          std::swap(a(c, k), a(pivot, k));
+          std::swap(out(c, k), out(pivot, k));
+        }
+
+      double d = a(c, c);
+      for (int k = 0; k < N; k++)
+        {
+          a(c, k) /= d;
+          out(c, k) /= d;
+        }
+
+      for (int r = 0; r < N; r++)
+        {
+          if (r == c) continue;
+          double f = a(r, c);
+          for (int k = 0; k < N; k++)
+            {
+              a(r, k) -= f * a(c, k);
+              out(r, k) -= f * out(c, k);
+            }
+        }
+    }
+
+  return true;
+
+}
+
+/**
+ Cholesky factor of a symmetric matrix, m = L * L' with a lower triangular L.
+ Returns false if the matrix is not positive definite, the columns of the
+ non-positive pivots are then set to zero, which still gives a valid factor
+ of a positive semi-definite matrix.
+*/
+template <int N>
+inline bool cholesky(const SmallMatrix<N, N>& m, SmallMatrix<N, N>& L)
+{
+
+  bool definite = true;
+
+  L.zeros();
+
+  for (int j = 0; j < N; j++)
+    {
+      double d = m(j, j);
+      for (int k = 0; k < j; k++)
+        d -= L(j, k) * L(j, k);
+
+      if (!(d > 0))
+        {
+          definite = false;
+          continue;
+        }
+
+      d = sqrt(d);
+      L(j, j) = d;
+
+      for (int i = j + 1; i < N; i++)
+        {
+          double s = m(i, j);
+          for (int k = 0; k < j; k++)
+            s -= L(i, k) * L(j, k);
+          L(i, j) = s / d;
+        }
+    }
+
+  return definite;
+
+}
+
+/**
+ Eigenvalues (in descending order) and eigenvectors (in columns) of a
+ symmetric matrix, computed with cyclic Jacobi rotations.
+*/
+template <int N>
+inline void eigen_symmetric(const SmallMatrix<N, N>& m, SmallVector<N>& values, SmallMatrix<N, N>& vectors)
+{
+
+  SmallMatrix<N, N> a = m;
+  vectors.identity();
+
+  for (int sweep = 0; sweep < 50; sweep++)
+    {
+      double off = 0;
+      for (int p = 0; p < N; p++)
+        for (int q = p + 1; q < N; q++)
+          off += a(p, q) * a(p, q);
+
+      if (off < 1e-24)
+        break;
+
+      for (int p = 0; p < N; p++)
+        for (int q = p + 1; q < N; q++)
+          {
+            if (a(p, q) == 0) continue;
+
+            double theta = (a(q, q) - a(p, p)) / (2 * a(p, q));
+            double t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
+            double c = 1 / sqrt(t * t + 1);
+            double s = t * c;
+
+            for (int k = 0; k < N; k++)
+              {
+                double akp = a(k, p), akq = a(k, q);
+                a(k, p) = c * akp - s * akq;
+                a(k, q) = s * akp + c * akq;
+              }
+
+            for (int k = 0; k < N; k++)
+              {
+                double apk = a(p, k), aqk = a(q, k);
+                a(p, k) = c * apk - s * aqk;
+                a(q, k) = s * apk + c * aqk;
+              }
+
+            for (int k = 0; k < N; k++)
+              {
+                double vkp = vectors(k, p), vkq = vectors(k, q);
+                vectors(k, p) = c * vkp - s * vkq;
+                vectors(k, q) = s * vkp + c * vkq;
+              }
+          }
+    }
+
+  for (int i = 0; i < N; i++)
+    values[i] = a(i, i);
+
+  // Selection sort of the eigenpairs
+  for (int i = 0; i < N; i++)
+    {
+      int best = i;
+      for (int j = i + 1; j < N; j++)
+        if (values[j] > values[best]) best = j;
+
+      if (best == i) continue;
+
+      std::swap(values[i], values[best]);
+      for (int k = 0; k < N; k++)
+        std::swap(vectors(k, i), vectors(k, best));
+    }
+
+}
+
+/**
+ Factor F of a covariance matrix, sigma = F * F'. If principal is set, the
+ columns of the factor are the scaled principal axes in the order of
+ decreasing variance, otherwise the Cholesky factor is used.
+*/
+template <int N>
+inline void gaussian_factor(const SmallMatrix<N, N>& sigma, bool principal, SmallMatrix<N, N>& factor)
+{
+
+  if (!principal && cholesky(sigma, factor))
+    return;
+
+  SmallVector<N> values;
+  eigen_symmetric(sigma, values, factor);
+
+  for (int j = 0; j < N; j++)
+    {
+      double s = values[j] > 0 ? sqrt(values[j]) : 0;
+      for (int i = 0; i < N; i++)
+        factor(i, j) *= s;
+    }
+
+}
+
+/**
+ Weighted mean and unbiased weighted covariance of the rows of a matrix,
+ same as row_weighted_covariance.
+*/
+template <int N>
+inline void weighted_mean_covariance(Matrix& samples, Matrix& weights, SmallVector<N>& mean, SmallMatrix<N, N>& covariance)
+{
+
+  int count = samples.rows;
+
+  double wsum = 0;
+  for (int i = 0; i < count; i++)
+    wsum += weights(i, 0);
+
+  mean.zeros();
+
+  for (int i = 0; i < count; i++)
+    {
+      const double* row = samples.ptr<double>(i);
+      double w = weights(i, 0);
+      for (int j = 0; j < N; j++)
+        mean[j] += row[j] * w;
+    }
+
+  for (int j = 0; j < N; j++)
+    mean[j] /= wsum;
+
+  double factor = 0;
+  for (int i = 0; i < count; i++)
+    {
+      double f = weights(i, 0) / wsum;
+      factor += f * f;
+    }
+
+  factor = 1 / (1 - factor);
+
+  covariance.zeros();
+
+  for (int i = 0; i < count; i++)
+    {
+      const double* row = samples.ptr<double>(i);
+      double w = weights(i, 0);
+      double d[N];
+
+      for (int j = 0; j < N; j++)
+        d[j] = row[j] - mean[j];
+
+      for (int a = 0; a < N; a++)
+        for (int b = a; b < N; b++)
+          covariance(a, b) += w * d[a] * d[b];
+    }
+
+  for (int a = 0; a < N; a++)
+    for (int b = a; b < N; b++)
+      {
+        covariance(a, b) = covariance(a, b) / wsum * factor;
+        covariance(b, a) = covariance(a, b);
+      }
+
+}
+
+#endif
@@ -147,6 +147,22 @@ void sample_gaussian(Matrix& mu, Matrix& sigma, int N, Matrix& out, int offset)
 static double w_direct_static[2];
 */
 void sample_gaussian2(Matrix& mu, Matrix& sigma, int N, Matrix& out, int offset)
+{
+
+  SVD svd;
+
+  sample_gaussian2(mu, sigma, N, out, offset, svd);
+
+}
+
+void sample_gaussian2(Matrix& mu, Matrix& sigma, int N, Matrix& out, int offset, SVD& svd)
+{
+
+  sample_gaussian2(mu, sigma, N, out, offset, svd, NULL);
+
+}
+
+void sample_gaussian2(Matrix& mu, Matrix& sigma, int N, Matrix& out, int offset, SVD& svd, tinymt32_t* random)
 {
 
   // If Y = CX, Var(Y) = C Var(X) C'.
@@ -190,7 +206,7 @@ void sample_gaussian2(Matrix& mu, Matrix& sigma, int N, Matrix& out, int offset)
        w_direct[1] = SQRT(w_direct[1]);
 
    } else {*/
-  SVD svd(sigma);
+  svd(sigma);
 
   sqrt(svd.w, svd.w);
 
@@ -212,7 +228,7 @@ void sample_gaussian2(Matrix& mu, Matrix& sigma, int N, Matrix& out, int offset)
 
           for (int i = 0; i < n; i++)
             {
-              sum += u_direct[j*n + i] * w_direct[i] * randn(); // RANDOM_NORMAL;
+              sum += u_direct[j*n + i] * w_direct[i] * (random ? random_MT_normal(random) : randn()); // RANDOM_NORMAL;
             }
 
           out_direct[j] = sum + mu_direct[j];
@@ -512,6 +528,84 @@ Matrix row_weighted_covariance(Matrix& mtr, Matrix& weights)
 
 }
 
+void row_weighted_mean(Matrix& mtr, Matrix& weights, Matrix& mean)
+{
+
+  int nc = mtr.cols;
+  int nr = mtr.rows;
+
+  mean.create(1, nc);
+
+  double wsum = 0;
+
+  for (int i = 0; i < nr; i++)
+    {
+      wsum += weights(i, 0);
+    }
+
+  double* m = mean.ptr<double>(0);
+
+  for (int j = 0; j < nc; j++)
+    m[j] = 0;
+
+  for (int i = 0; i < nr; i++)
+    {
+      double* row = mtr.ptr<double>(i);
+      double w = weights(i, 0);
+      for (int j = 0; j < nc; j++)
+        m[j] += row[j] * w;
+    }
+
+  for (int j = 0; j < nc; j++)
+    m[j] /= wsum;
+
+}
+
+void row_weighted_covariance(Matrix& mtr, Matrix& weights, Matrix& mean, Matrix& covariance)
+{
+
+  int nc = mtr.cols;
+  int nr = mtr.rows;
+
+  row_weighted_mean(mtr, weights, mean);
+
+  covariance.create(nc, nc);
+
+  double wsum = 0;
+  for (int i = 0; i < nr; i++)
+    {
+      wsum += weights(i, 0);
+    }
+
+  double factor = 0;
+
+  for (int i = 0; i < nr; i++)
+    {
+      double f = weights(i, 0) / wsum;
+      factor += f * f;
+    }
+
+  factor = 1 / (1 - factor);
+
+  double* m = mean.ptr<double>(0);
+
+  for (int a = 0; a < nc; a++)
+    {
+      for (int b = a; b < nc; b++)
+        {
+          double sum = 0;
+          for (int i = 0; i < nr; i++)
+            {
+              double* row = mtr.ptr<double>(i);
+              sum += weights(i, 0) * (row[a] - m[a]) * (row[b] - m[b]);
+            }
+          covariance(a, b) = sum / wsum * factor;
+          covariance(b, a) = covariance(a, b);
+        }
+    }
+
+}
+
 void threshold(Mat& mat, float threshold)
 {
 
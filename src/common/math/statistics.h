@@ -31,6 +31,7 @@
 #define STATISTICS_H
 
 #include "common/math/math.h"
+#include "common/math/mersenne.h"
 #include <opencv2/core/core.hpp>
 
 using namespace cv;
@@ -98,6 +99,19 @@ void sample_gaussian(Matrix& mu, Matrix& sigma, int N, Matrix& out, int offset);
 */
 void sample_gaussian2(Matrix& mu, Matrix& sigma, int N, Matrix& out, int offset);
 
+/**
+ Same as above, but reuses the given SVD object for the decomposition of the
+ covariance so that repeated calls do not allocate memory.
+*/
+void sample_gaussian2(Matrix& mu, Matrix& sigma, int N, Matrix& out, int offset, SVD& svd);
+
+/**
+ Same as above, but draws the normal deviates from the given random stream
+ instead of the global generator, so that it can be used concurrently with
+ a stream per thread (or per task).
+*/
+void sample_gaussian2(Matrix& mu, Matrix& sigma, int N, Matrix& out, int offset, SVD& svd, tinymt32_t* random);
+
 void sample_map(Mat& map, cv::Point* points, int count, float* values = NULL);
 
 
@@ -115,6 +129,14 @@ Matrix row_weighted_mean(Matrix& mtr, Matrix& weights);
 
 Matrix row_weighted_covariance(Matrix& mtr, Matrix& weights);
 
+/**
+ Versions of the weighted statistics that write to preallocated matrices. The
+ mean is a 1 x cols matrix, the covariance a cols x cols matrix.
+*/
+void row_weighted_mean(Matrix& mtr, Matrix& weights, Matrix& mean);
+
+void row_weighted_covariance(Matrix& mtr, Matrix& weights, Matrix& mean, Matrix& covariance);
+
 void threshold(Mat& mat, float threshold);
 
 void high_pass(Mat& mat, float threshold);
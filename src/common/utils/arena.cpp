@@ -0,0 +1,131 @@
+/*******************************************************************************
+* Copyright (c) 2013, Luka Cehovin
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the University of Ljubljana nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL LUKA CEHOVIN BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*******************************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#include <stdint.h>
+#include <algorithm>
+#include "arena.h"
+
+namespace legit
+{
+
+namespace common
+{
+
+FrameArena::FrameArena(size_t capacity) : current(0), offset(0), total_used(0), peak(0)
+{
+
+  grow(capacity);
+
+}
+
+FrameArena::~FrameArena()
+{
+
+  for (size_t i = 0; i < blocks.size(); i++)
+    delete [] blocks[i].data;
+
+}
+
+void FrameArena::grow(size_t bytes)
+{
+
+  Block block;
+  block.size = bytes;
+  block.data = new char[bytes];
+  blocks.push_back(block);
+
+}
+
+void* FrameArena::allocate(size_t bytes, size_t alignment)
+{
+
+  while (true)
+    {
+      Block& block = blocks[current];
+
+      uintptr_t base = (uintptr_t) block.data;
+      size_t start = ((base + offset + alignment - 1) & ~(uintptr_t) (alignment - 1)) - base;
+
+      if (start + bytes <= block.size)
+        {
+          offset = start + bytes;
+          return block.data + start;
+        }
+
+      total_used += offset;
+      offset = 0;
+      current++;
+
+      if (current == blocks.size())
+        grow(std::max(bytes + alignment, blocks[current - 1].size * 2));
+    }
+
+}
+
+void FrameArena::reset()
+{
+
+  peak = std::max(peak, used());
+
+  // Several blocks are merged into one that fits the largest frame so far
+  if (blocks.size() > 1)
+    {
+      size_t size = 0;
+
+      for (size_t i = 0; i < blocks.size(); i++)
+        {
+          size += blocks[i].size;
+          delete [] blocks[i].data;
+        }
+
+      blocks.clear();
+      grow(std::max(size, peak));
+    }
+
+  current = 0;
+  offset = 0;
+  total_used = 0;
+
+}
+
+size_t FrameArena::capacity()
+{
+
+  size_t size = 0;
+
+  for (size_t i = 0; i < blocks.size(); i++)
+    size += blocks[i].size;
+
+  return size;
+
+}
+
+}
+
+}
@@ -0,0 +1,102 @@
+/*******************************************************************************
+* Copyright (c) 2013, Luka Cehovin
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the University of Ljubljana nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL LUKA CEHOVIN BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*******************************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#ifndef LEGIT_ARENA
+#define LEGIT_ARENA
+
+#include <stddef.h>
+#include <vector>
+
+namespace legit
+{
+
+namespace common
+{
+
+/**
+    A bump allocator for memory that only lives within one frame. Memory is
+    taken from a list of blocks and released all at once by reset. If more
+    than one block was needed, the blocks are replaced by a single block of
+    the combined size on reset, so once the arena has seen the largest frame
+    no further allocations are made. Objects placed in the arena are not
+    destructed, so it should only hold plain data.
+*/
+class FrameArena
+{
+public:
+  FrameArena(size_t capacity = 65536);
+  ~FrameArena();
+
+  void* allocate(size_t bytes, size_t alignment = 16);
+
+  template <class T>
+  T* allocate(size_t count)
+  {
+    return (T*) allocate(sizeof(T) * count, alignof(T) > 16 ? alignof(T) : 16);
+  }
+
+  /**
+      Releases all the memory at once.
+  */
+  void reset();
+
+  inline size_t used()
+  {
+    return total_used + offset;
+  }
+
+  size_t capacity();
+
+private:
+
+  FrameArena(const FrameArena&) = delete;
+  FrameArena& operator=(const FrameArena&) = delete;
+
+  void grow(size_t bytes);
+
+  struct Block
+  {
+    char* data;
+    size_t size;
+  };
+
+  std::vector<Block> blocks;
+
+  size_t current;
+  size_t offset;
+  size_t total_used;
+  size_t peak;
+
+};
+
+}
+
+}
+
+#endif
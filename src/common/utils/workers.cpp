@@ -0,0 +1,218 @@
+/*******************************************************************************
+* Copyright (c) 2013, Luka Cehovin
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the University of Ljubljana nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL LUKA CEHOVIN BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*******************************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#include "common/utils/workers.h"
+#include "common/utils/utils.h"
+
+namespace legit
+{
+
+namespace common
+{
+
+WorkerPool::WorkerPool(int threads) : task(NULL), count(0), pending(0), generation(0), terminate(false), failed(false)
+{
+
+  start(threads);
+
+}
+
+WorkerPool::~WorkerPool()
+{
+
+  stop();
+
+}
+
+void WorkerPool::resize(int threads)
+{
+
+  if (threads < 1) threads = 1;
+
+  if (threads == size())
+    return;
+
+  stop();
+  start(threads);
+
+}
+
+void WorkerPool::start(int threads)
+{
+
+  terminate = false;
+
+  for (int i = 1; i < threads; i++)
+    workers.push_back(std::thread(&WorkerPool::loop, this, i, generation));
+
+}
+
+void WorkerPool::stop()
+{
+
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    terminate = true;
+  }
+
+  wake.notify_all();
+
+  for (size_t i = 0; i < workers.size(); i++)
+    workers[i].join();
+
+  workers.clear();
+
+}
+
+void WorkerPool::run(WorkerTask& t, int c)
+{
+
+  if (c < 1)
+    return;
+
+  int chunks = size();
+
+  if (chunks == 1 || c == 1)
+    {
+      t.execute(0, c, 0);
+      return;
+    }
+
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    task = &t;
+    count = c;
+    pending = chunks - 1;
+    failed = false;
+    generation++;
+  }
+
+  wake.notify_all();
+
+  bool local_failed = false;
+  std::string local_error;
+
+  try
+    {
+      t.execute(0, (int) ((long long) c / chunks), 0);
+    }
+  catch (std::exception& e)
+    {
+      local_failed = true;
+      local_error = e.what();
+    }
+
+  std::unique_lock<std::mutex> guard(lock);
+
+  while (pending > 0)
+    done.wait(guard);
+
+  task = NULL;
+
+  if (local_failed)
+    throw LegitException(local_error);
+
+  if (failed)
+    throw LegitException(error);
+
+}
+
+void WorkerPool::loop(int index, unsigned int seen)
+{
+
+  while (true)
+    {
+
+      WorkerTask* current;
+      int begin, end;
+
+      {
+        std::unique_lock<std::mutex> guard(lock);
+
+        while (!terminate && generation == seen)
+          wake.wait(guard);
+
+        if (terminate)
+          return;
+
+        seen = generation;
+        current = task;
+
+        int chunks = (int) workers.size() + 1;
+        begin = (int) (((long long) count * index) / chunks);
+        end = (int) (((long long) count * (index + 1)) / chunks);
+      }
+
+      std::string message;
+      bool error_raised = false;
+
+      try
+        {
+          if (begin < end) current->execute(begin, end, index);
+        }
+      catch (std::exception& e)
+        {
+          error_raised = true;
+          message = e.what();
+        }
+
+      {
+        std::unique_lock<std::mutex> guard(lock);
+
+        if (error_raised && !failed)
+          {
+            failed = true;
+            error = message;
+          }
+
+        pending--;
+      }
+
+      done.notify_one();
+
+    }
+
+}
+
+void parallel_execute(WorkerPool* pool, WorkerTask& task, int count)
+{
+
+  if (!pool || pool->size() < 2)
+    {
+      if (count > 0) task.execute(0, count, 0);
+      return;
+    }
+
+  pool->run(task, count);
+
+}
+
+}
+
+}
@@ -0,0 +1,122 @@
+/*******************************************************************************
+* Copyright (c) 2013, Luka Cehovin
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the University of Ljubljana nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL LUKA CEHOVIN BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*******************************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#ifndef LEGIT_WORKERS
+#define LEGIT_WORKERS
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace legit
+{
+
+namespace common
+{
+
+/**
+    A unit of work that can be split into contiguous index ranges. Each call
+    to execute processes the indices in [begin, end) and must only write to
+    the outputs that belong to these indices.
+*/
+class WorkerTask
+{
+public:
+  virtual ~WorkerTask() {}
+  virtual void execute(int begin, int end) = 0;
+
+  /**
+      Also receives the index of the chunk (from 0 to the size of the pool - 1),
+      which tasks can use to select per-thread scratch space.
+  */
+  virtual void execute(int begin, int end, int chunk)
+  {
+    execute(begin, end);
+  }
+};
+
+/**
+    A persistent pool of worker threads. The range of a task is always split
+    into the same contiguous chunks for a given pool size and the calling
+    thread processes the first chunk, so a task that writes only to its own
+    indices produces the same result regardless of the number of threads.
+*/
+class WorkerPool
+{
+public:
+  WorkerPool(int threads = 1);
+  ~WorkerPool();
+
+  void resize(int threads);
+
+  inline int size()
+  {
+    return (int) workers.size() + 1;
+  };
+
+  void run(WorkerTask& task, int count);
+
+private:
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  void start(int threads);
+  void stop();
+  void loop(int index, unsigned int seen);
+
+  std::vector<std::thread> workers;
+
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable done;
+
+  WorkerTask* task;
+  int count;
+  int pending;
+  unsigned int generation;
+  bool terminate;
+
+  bool failed;
+  std::string error;
+
+};
+
+/**
+    Runs the task on the pool if one is given, otherwise in the calling thread.
+*/
+void parallel_execute(WorkerPool* pool, WorkerTask& task, int count);
+
+}
+
+}
+
+#endif
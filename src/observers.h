@@ -44,6 +44,9 @@
 #define OBSERVER_CHANNEL_OPTIMIZATION 3
 #define OBSERVER_CHANNEL_REWEIGHT 4
 #define OBSERVER_CHANNEL_PATCH_ADD 5
+#define OBSERVER_CHANNEL_BUDGET 6
+#define OBSERVER_CHANNEL_ACTIVE_SET 7
+#define OBSERVER_CHANNEL_PRUNING 8
 
 #define OBSERVER_CHANNEL_INITIALIZE 100
 
@@ -76,6 +79,47 @@ typedef struct
   vector<float> weights;
 } PatchReweight;
 
+/**
+    Degradation decisions of a tracker that runs with a per-frame time
+    budget. Times are in milliseconds, quality is the fraction of the
+    configured optimization effort that was used in the frame.
+*/
+typedef struct
+{
+  float budget;
+  float elapsed;
+  float quality;
+  int global_samples;
+  int global_iterations;
+  int local_samples;
+  int local_iterations;
+  int refined;
+  bool modalities;
+  bool sampling;
+} BudgetReport;
+
+/**
+    Patches that took part in the local refinement of a frame. Frozen
+    patches were skipped, reduced ones were refined with fewer samples.
+*/
+typedef struct
+{
+  int patches;
+  int frozen;
+  int reduced;
+  int refined;
+} ActiveSetReport;
+
+/**
+    Samples scored by the global optimization in a frame and the number of
+    them that were rejected before all patches were evaluated.
+*/
+typedef struct
+{
+  int scored;
+  int rejected;
+} PruningReport;
+
 }
 
 class TimeStage
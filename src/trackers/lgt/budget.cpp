@@ -0,0 +1,162 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "budget.h"
+
+namespace legit
+{
+
+namespace tracker
+{
+
+FrameBudget::FrameBudget(float budget, float minimum) : budget(budget), minimum(minimum), quality(1), frame_start(0), stage_start(0), current(-1)
+{
+
+  for (int i = 0; i < BUDGET_STAGES; i++)
+    stages[i] = 0;
+
+  memset(&report, 0, sizeof(BudgetReport));
+
+}
+
+FrameBudget::~FrameBudget()
+{
+
+}
+
+double FrameBudget::now()
+{
+
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+}
+
+void FrameBudget::start()
+{
+
+  frame_start = stage_start = now();
+  current = -1;
+
+  memset(&report, 0, sizeof(BudgetReport));
+  report.budget = budget;
+  report.quality = quality;
+  report.modalities = true;
+  report.sampling = true;
+
+}
+
+void FrameBudget::stage(int stage)
+{
+
+  double time = now();
+
+  if (current >= 0)
+    {
+      float duration = time - stage_start;
+      // Running average of the stage duration
+      stages[current] = (stages[current] <= 0) ? duration : 0.8 * stages[current] + 0.2 * duration;
+    }
+
+  current = (stage >= 0 && stage < BUDGET_STAGES) ? stage : -1;
+  stage_start = time;
+
+}
+
+void FrameBudget::finish()
+{
+
+  stage(-1);
+
+  float total = elapsed();
+
+  report.elapsed = total;
+
+  if (!is_enabled()) return;
+
+  if (total > budget)
+    quality *= std::max(0.5f, 0.9f * budget / total);
+  else if (total < 0.75f * budget)
+    quality *= 1.1f;
+
+  quality = std::min(1.0f, std::max(minimum, quality));
+
+}
+
+float FrameBudget::elapsed()
+{
+
+  return now() - frame_start;
+
+}
+
+bool FrameBudget::allow(int stage)
+{
+
+  if (!is_enabled() || stage < 0 || stage >= BUDGET_STAGES) return true;
+
+  return elapsed() + stages[stage] <= budget;
+
+}
+
+CrossEntropyParameters FrameBudget::scale(const CrossEntropyParameters& parameters)
+{
+
+  CrossEntropyParameters result = parameters;
+
+  if (!is_enabled()) return result;
+
+  // Samples and iterations are scaled equally, so the work is proportional
+  // to the quality
+  float factor = sqrt(quality);
+
+  result.min_samples = std::max(parameters.elite_samples + 1, (int) round(parameters.min_samples * factor));
+  result.max_samples = std::max(result.min_samples, (int) round(parameters.max_samples * factor));
+  result.reduced_samples = std::max(parameters.elite_samples + 1, std::min(result.max_samples,
+                                    (int) round(parameters.reduced_samples * factor)));
+  result.iterations = std::max(1, (int) round(parameters.iterations * factor));
+
+  return result;
+
+}
+
+int FrameBudget::refined(int count, int minimum)
+{
+
+  if (!is_enabled()) return count;
+
+  int n = (int) ceil(count * quality);
+
+  float expected = stages[STAGE_OPTIMIZATION_LOCAL];
+  float remaining = budget - elapsed();
+
+  // Reduce the number further if the frame is already running late
+  if (expected > 0 && remaining < expected)
+    n = (int) (n * std::max(0.0f, remaining) / expected);
+
+  return std::min(count, std::max(std::min(minimum, count), n));
+
+}
+
+}
+
+}
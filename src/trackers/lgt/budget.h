@@ -0,0 +1,109 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#ifndef LEGIT_LGT_BUDGET
+#define LEGIT_LGT_BUDGET
+
+#include <chrono>
+#include "observers.h"
+#include "optimization/crossentropy.h"
+
+namespace legit
+{
+
+namespace tracker
+{
+
+#define BUDGET_STAGES 8
+
+/**
+    Adapts the amount of work done by the tracker so that frames finish
+    within a fixed time budget. The elapsed wall time of every stage is
+    measured and a quality factor in [minimum, 1] is adjusted after each
+    frame. Optimization effort is scaled by the quality, while the optional
+    stages are skipped within a frame if their expected duration does not
+    fit into the remaining time.
+*/
+class FrameBudget
+{
+public:
+  FrameBudget(float budget = 0, float minimum = 0.1);
+  ~FrameBudget();
+
+  inline bool is_enabled()
+  {
+    return budget > 0;
+  }
+
+  void start();
+
+  /**
+      Marks the beginning of a stage. The time since the previous mark is
+      attributed to the previous stage.
+  */
+  void stage(int stage);
+
+  /**
+      Marks the end of the frame and adapts the quality for the next one.
+  */
+  void finish();
+
+  float elapsed();
+
+  /**
+      Returns true if the given stage is expected to finish within the budget.
+  */
+  bool allow(int stage);
+
+  CrossEntropyParameters scale(const CrossEntropyParameters& parameters);
+
+  /**
+      Number of patches out of count that should be refined locally.
+  */
+  int refined(int count, int minimum);
+
+  inline float get_quality()
+  {
+    return quality;
+  }
+
+  BudgetReport report;
+
+private:
+
+  double now();
+
+  float budget;
+  float minimum;
+  float quality;
+
+  double frame_start;
+  double stage_start;
+  int current;
+
+  float stages[BUDGET_STAGES];
+
+};
+
+}
+
+}
+
+#endif
@@ -39,6 +39,42 @@ int compare_cost_pair (const void* i, const void* j)
   return (c < 0) ? -1 : (c > 0) ? 1 : 0;
 }
 
+// Sample generator of an optimizer, pseudo-random unless a low-discrepancy sequence is requested
+static int sampling_type(string name)
+{
+
+  if (name == "sobol") return SEQUENCE_SOBOL;
+  if (name == "halton") return SEQUENCE_HALTON;
+
+  return SEQUENCE_RANDOM;
+
+}
+
+// Resets the starting distribution of a global search in place, the mean is
+// the identity transform and the covariance is diagonal
+static void initialize_search(Matrix& mean, Matrix& covariance, int dimension, double move, double rotation, double scale)
+{
+
+  mean.create(1, dimension);
+  covariance.create(dimension, dimension);
+  covariance.setTo(0);
+
+  mean(0, 0) = 0;
+  mean(0, 1) = 0;
+  covariance(0, 0) = move;
+  covariance(1, 1) = move;
+
+  if (dimension < 5) return;
+
+  mean(0, 2) = 0;
+  mean(0, 3) = 1;
+  mean(0, 4) = 1;
+  covariance(2, 2) = rotation;
+  covariance(3, 3) = scale;
+  covariance(4, 4) = scale;
+
+}
+
 LGTTracker::LGTTracker(Config& config, string inst) :
   patches(6, 30),
   modalities(config),
@@ -50,15 +86,17 @@ LGTTracker::LGTTracker(Config& config, string inst) :
     config.read<int>("optimization.global.add", 10),
     config.read<int>("optimization.global.elite", 10),
     config.read<int>("optimization.global.iterations", 10),
-    config.read<float>("optimization.global.terminate", 0.1)),
+    config.read<float>("optimization.global.terminate", 0.1),
+    sampling_type(config.read<string>("optimization.global.sampling", "random"))),
   local_optimization(
     config.read<int>("optimization.local.samples", 40),
     config.read<int>("optimization.local.samples", 40),
     0,
     config.read<int>("optimization.local.elite", 5),
     config.read<int>("optimization.local.iterations", 10),
-    config.read<float>("optimizationl.local.terminate", 0.001)),
-  motion(4, 2, 0)
+    config.read<float>("optimizationl.local.terminate", 0.001),
+    sampling_type(config.read<string>("optimization.local.sampling", "random"))),
+  workers(MAX(1, config.read<int>("optimization.global.threads", 1)))
 {
 
   instance = inst;
@@ -67,8 +105,13 @@ LGTTracker::LGTTracker(Config& config, string inst) :
 
   patch_scale = configuration.read<double>("patch.scale", 1.0);
 
+  integral_histograms = configuration.read<bool>("patch.integral", false);
+  integral_margin = MAX(0, configuration.read<int>("patch.integral.margin", 30));
+
   patches_max = configuration.read<int>("pool.max");
   patches_min = configuration.read<int>("pool.min");
+
+  patches.reserve(patches_max);
   patches_persistence = configuration.read<double>("pool.persistence");
 
   reweight_persistence = configuration.read<double>("reweight.persistence", 0.5);
@@ -86,6 +129,36 @@ LGTTracker::LGTTracker(Config& config, string inst) :
   optimization_global_S = configuration.read<double>("optimization.global.scale", 0.001);
 
   optimization_local_M = configuration.read<double>("optimization.local.move", 5);
+  optimization_local_parallel = configuration.read<bool>("optimization.local.parallel", false);
+
+  optimization_maps = configuration.read<bool>("optimization.maps", false);
+  optimization_maps_range = MAX(1, configuration.read<int>("optimization.maps.range", 20));
+
+  optimization_pyramid_levels = MAX(0, configuration.read<int>("optimization.pyramid.levels", 0));
+  optimization_pyramid_samples = CLAMP3(configuration.read<float>("optimization.pyramid.samples", 0.25), 0, 1);
+  optimization_pyramid_shrink = CLAMP3(configuration.read<float>("optimization.pyramid.shrink", 0.25), 0, 1);
+
+  // Patches that match reasonably well after the global stage can be refined with fewer samples
+  local_optimization.reduced_samples = std::max(local_optimization.elite_samples + 1,
+                                       std::min(local_optimization.max_samples,
+                                                configuration.read<int>("optimization.local.reduced", local_optimization.max_samples)));
+
+  active_set = ActiveSet(configuration.read<bool>("optimization.local.active", false),
+                         configuration.read<float>("optimization.local.freeze", 0.8),
+                         configuration.read<float>("optimization.local.consistency", 0.6),
+                         configuration.read<float>("optimization.local.reduce", 0.5));
+
+  // Use the affine global model only while the patches rotate or scale
+  model_selector = ModelSelector(configuration.read<bool>("optimization.global.adaptive", false),
+                                 configuration.read<float>("optimization.global.adaptive.rotate", 0.02),
+                                 configuration.read<float>("optimization.global.adaptive.scale", 0.01),
+                                 MAX(1, configuration.read<int>("optimization.global.adaptive.quiet", 10)));
+
+  // Seed the optimization with the converged distributions of the previous frame
+  warm_start = WarmStart(configuration.read<bool>("optimization.warm", false),
+                         MAX(0, configuration.read<float>("optimization.warm.inflation", 4)),
+                         configuration.read<float>("optimization.warm.gate", 9.21),
+                         CLAMP3(configuration.read<float>("optimization.warm.floor", 0.1), 0, 1));
 
   // TODO: probably needs rethinking
   median_size_min = configuration.read<float>("size.min", 0);
@@ -100,12 +173,19 @@ LGTTracker::LGTTracker(Config& config, string inst) :
   sampling_threshold = configuration.read<double>("sampling.threshold", 0.2);
   addition_distance = configuration.read<double>("sampling.mask", 3);
 
+  // Per-frame time budget in milliseconds, disabled if not positive
+  budget = FrameBudget(configuration.read<float>("tracker.budget_ms", 0), configuration.read<float>("tracker.budget.minimum", 0.1));
+
   string patch_type_string = config.read<string>("patch.type", "histogram");
 
   if (patch_type_string == "histogram")
     patch_type = HISTOGRAM;
+  else if (patch_type_string == "ssd")
+    patch_type = SSD;
   else throw LegitException("Unknown patch type");
 
+  patches.set_histogram_bins(config.read<int>("patch.histogram.bins", HIST_SIZE_16));
+
 }
 
 LGTTracker::~LGTTracker()
@@ -226,6 +306,10 @@ void LGTTracker::initialize(Image& image, Mat points)
 
   modalities.flush();
 
+  warm_start.reset();
+
+  model_selector.reset();
+
   notify_observers(OBSERVER_CHANNEL_INITIALIZE, & patches);
 
   cv::Rect region = patches.region();
@@ -247,31 +331,32 @@ void LGTTracker::initialize(Image& image, Mat points)
   //optimization_global_M = 20; //  4.0* diagonal*0.15;  //20  ;
   //optimization_local_M = 5; // diagonal*0.05 ; //5
   // initialize motion model
-  motion.transitionMatrix = (Mat_<float>(4, 4) << 1, 0, delta_t, 0,
-                             0, 1, 0, delta_t,
-                             0, 0, 1, 0,
-                             0, 0, 0, 1);
-  motion.measurementMatrix = (Mat_<float>(2, 4) << 1, 0, 0, 0,
-                              0, 1, 0, 0);
+  motion.transition.identity();
+  motion.transition(0, 2) = delta_t;
+  motion.transition(1, 3) = delta_t;
+  motion.measurement.zeros();
+  motion.measurement(0, 0) = 1;
+  motion.measurement(1, 1) = 1;
   // intitialize process noise
   meas_noise = diagonal * 0.1 *10;
   meas_noise = meas_noise*meas_noise ; //10.0 ;	  0.01
   spectral_density = diagonal*0.2 *10;
   spectral_density = spectral_density*spectral_density ; // 0.2  5.0*5.0; //
-  motion.processNoiseCov = (Mat_<float>(4,4) << third*delta_t3, 0, half*delta_t2, 0,
-                            0, third*delta_t3, 0,  half*delta_t2,
-                            half*delta_t2, 0, delta_t, 0,
-                            0, half*delta_t2, 0, delta_t) ;
-
-  motion.processNoiseCov = motion.processNoiseCov*spectral_density ;
+  motion.process_noise.zeros();
+  motion.process_noise(0, 0) = motion.process_noise(1, 1) = third*delta_t3*spectral_density;
+  motion.process_noise(0, 2) = motion.process_noise(1, 3) = half*delta_t2*spectral_density;
+  motion.process_noise(2, 0) = motion.process_noise(3, 1) = half*delta_t2*spectral_density;
+  motion.process_noise(2, 2) = motion.process_noise(3, 3) = delta_t*spectral_density;
   // initialize measurement noise
-  setIdentity(motion.measurementNoiseCov, Scalar(meas_noise));
+  motion.measurement_noise.identity(meas_noise);
   // initialize the posterior state
-  motion.statePost = (Mat_<float>(4, 1) << mean.x, mean.y, 0, 0) ;
-  motion.statePre = (Mat_<float>(4, 1) << mean.x, mean.y, 0, 0) ;
+  motion.state_post.zeros();
+  motion.state_post[0] = mean.x;
+  motion.state_post[1] = mean.y;
+  motion.state_pre = motion.state_post;
   // initialize posterior covariances
-  setIdentity(motion.errorCovPost, Scalar(meas_noise*4.0));
-  setIdentity(motion.errorCovPre, Scalar(meas_noise*4.0));
+  motion.covariance_post.identity(meas_noise*4.0);
+  motion.covariance_pre.identity(meas_noise*4.0);
 
   track(image, false, false);
 
@@ -290,23 +375,39 @@ void LGTTracker::track(Image& image, bool announce, bool push, DebugOutput* debu
 
   if (announce) notify_stage(STAGE_BEGIN);
 
+  arena.reset();
+
+  budget.start();
+
   if (push) patches.push(); // allocate new state for patches
 
-  Mat kalman_prediction = motion.predict();
+  const SmallVector<4>& kalman_prediction = motion.predict();
 
   Point2f move;
 
   Point2f center = patches.mean_position();
-  move.x = kalman_prediction.at<float>(0, 0) - center.x ;
-  move.y = kalman_prediction.at<float>(1, 0) - center.y ;
+  move.x = kalman_prediction[0] - center.x ;
+  move.y = kalman_prediction[1] - center.y ;
 
-  /*move.x = kalman_prediction.at<float>(2, 0)*3 ;
-  move.y = kalman_prediction.at<float>(3, 0)*3 ;*/
+  /*move.x = kalman_prediction[2]*3 ;
+  move.y = kalman_prediction[3]*3 ;*/
 
   patches.move(move);
 
   if (announce) notify_observers(OBSERVER_CHANNEL_STRUCTURE, &patches);
 
+  if (integral_histograms && patch_type == HISTOGRAM)
+    {
+      // Patches are only evaluated in the vicinity of their predicted positions,
+      // so the integral histogram is limited to that region.
+      Rect4f bounds = patches.region();
+      int margin = integral_margin + patches.get_patch_size();
+      image.get_integral_histogram(patches.get_histogram_bins(), cv::Rect((int)bounds.x - margin, (int)bounds.y - margin,
+                                   (int)bounds.width + 2 * margin, (int)bounds.height + 2 * margin));
+    }
+
+  budget.stage(STAGE_OPTIMIZATION_GLOBAL);
+
   stage_optimization(image, announce, push, debug);
 
   /********************************************************************************
@@ -315,6 +416,8 @@ void LGTTracker::track(Image& image, bool announce, bool push, DebugOutput* debu
   *
   *********************************************************************************/
 
+  budget.stage(STAGE_UPDATE_WEIGHTS);
+
   stage_update_weights(image, announce, push, debug);
 
 #ifdef BUILD_DEBUG
@@ -340,23 +443,27 @@ void LGTTracker::track(Image& image, bool announce, bool push, DebugOutput* debu
 
   // recalculate center, update Kalman
   center = patches.mean_position();
-  motion.correct((Mat_<float>(2, 1) << center.x, center.y));
+  warm_start.innovation(motion, center);
+  SmallVector<2> measured;
+  measured[0] = center.x;
+  measured[1] = center.y;
+  motion.correct(measured);
 
 #ifdef BUILD_DEBUG
   {
     Canvas* canvas = get_canvas("motion");
     if (canvas->get_zoom() > 0)
       {
-        Mat statePost = motion.statePost ;
-        Mat errorCovPost = motion.errorCovPost ;
+        SmallVector<4>& statePost = motion.state_post ;
+        SmallMatrix<4, 4>& errorCovPost = motion.covariance_post ;
         Point2f mean, pred ;
         Matrix2f cov ;
-        mean.x = statePost.at<float>(0,0) ;
-        mean.y = statePost.at<float>(1,0) ;
-        cov.m00 = errorCovPost.at<float>(0,0) ;
-        cov.m11 = errorCovPost.at<float>(1,1) ;
-        cov.m01 = errorCovPost.at<float>(0,1) ;
-        cov.m10 = errorCovPost.at<float>(1,0) ;
+        mean.x = statePost[0] ;
+        mean.y = statePost[1] ;
+        cov.m00 = errorCovPost(0,0) ;
+        cov.m11 = errorCovPost(1,1) ;
+        cov.m01 = errorCovPost(0,1) ;
+        cov.m10 = errorCovPost(1,0) ;
 
         Point offset = mean - cv::Point(canvas->width(), canvas->height()) / (2 * canvas->get_zoom());
 
@@ -369,11 +476,8 @@ void LGTTracker::track(Image& image, bool announce, bool push, DebugOutput* debu
 
         //proxy.rectangle(region(), Scalar(0, 255, 0), 2);
 
-        float ppx = statePost.at<float>(2, 0) ;
-        float ppy = statePost.at<float>(3, 0) ;
-
-        pred.x = mean.x + statePost.at<float>(2, 0) * motion.transitionMatrix.at<float>(0, 2) ;
-        pred.y = mean.y + statePost.at<float>(3, 0) * motion.transitionMatrix.at<float>(1, 3) ;
+        pred.x = mean.x + statePost[2] * motion.transition(0, 2) ;
+        pred.y = mean.y + statePost[3] * motion.transition(1, 3) ;
         proxy.line(mean, pred, Scalar(100, 255, 120), 2);
 
         proxy.push();
@@ -387,7 +491,17 @@ void LGTTracker::track(Image& image, bool announce, bool push, DebugOutput* debu
   *
   *********************************************************************************/
 
-  stage_update_modalities(image, announce, push, debug);
+  if (budget.allow(STAGE_UPDATE_MODALITIES))
+    {
+      budget.stage(STAGE_UPDATE_MODALITIES);
+      stage_update_modalities(image, announce, push, debug);
+    }
+  else
+    {
+      DEBUGMSG("Skipping modality update (%.1fms elapsed)\n", budget.elapsed());
+      budget.stage(-1);
+      budget.report.modalities = false;
+    }
 
   /********************************************************************************
   *
@@ -395,10 +509,28 @@ void LGTTracker::track(Image& image, bool announce, bool push, DebugOutput* debu
   *
   *********************************************************************************/
 
-  stage_add_patches(image, announce, push, debug);
+  // The patch set is always replenished if it falls below the minimum
+  if (patches.size() < patches_min || budget.allow(STAGE_ADD_PATCHES))
+    {
+      budget.stage(STAGE_ADD_PATCHES);
+      stage_add_patches(image, announce, push, debug);
+    }
+  else
+    {
+      DEBUGMSG("Skipping patch addition (%.1fms elapsed)\n", budget.elapsed());
+      budget.report.sampling = false;
+    }
+
+  // Coarse references of the new patches come from the frame they were added in
+  if (optimization_pyramid_levels > 0 && !optimization_maps)
+    pyramid_response.remember(image, patches, optimization_pyramid_levels);
 
   DEBUGMSG("Patch set size: %d (capacity: %.2f)\n", patches.size(), patches_capacity);
 
+  budget.finish();
+
+  if (announce && budget.is_enabled()) notify_observers(OBSERVER_CHANNEL_BUDGET, &budget.report);
+
   if (announce) notify_stage(STAGE_END);
 
   if (announce) notify_observers(OBSERVER_CHANNEL_STRUCTURE, &patches);
@@ -417,28 +549,107 @@ void LGTTracker::stage_optimization(Image& image, bool announce, bool push, Debu
 
   cv::Point2f center = patches.mean_position();
 
-  OptimizationStatus status(patches);
+  CrossEntropyParameters global_parameters = budget.scale(global_optimization);
+  CrossEntropyParameters local_parameters = budget.scale(local_optimization);
+
+  model_selector.begin(patches);
+
+  pruning_report.scored = 0;
+  pruning_report.rejected = 0;
+
+  int pyramid_levels = optimization_pyramid_levels;
+
+  if (pyramid_levels > 0 && !optimization_maps)
+    {
+      // Coarse-to-fine search: the transformation is first estimated on a
+      // downsampled level with a proportionally larger search range, then
+      // refined at full resolution with fewer samples and a smaller range.
+      float factor = (float) (1 << pyramid_levels);
+      float range = 3 * sqrt(optimization_global_M) * factor + patches.get_patch_size();
+
+      Rect4f bounds = patches.region();
+      pyramid_response.update(image, patches, pyramid_levels,
+                              cv::Rect((int) (bounds.x - range), (int) (bounds.y - range),
+                                       (int) (bounds.width + 2 * range), (int) (bounds.height + 2 * range)));
+
+      initialize_search(search_mean, search_covariance, 5, optimization_global_M * factor * factor,
+                        optimization_global_R, optimization_global_S);
+
+      OptimizationStatus coarse(patches, arena);
+
+      cross_entropy_global_affine2(coarse, pyramid_response, search_mean, search_covariance, global_parameters, size_constraints, &optimization_workspace);
+
+      pruning_report.scored += optimization_workspace.global_scored;
+      pruning_report.rejected += optimization_workspace.global_rejected;
+
+      for (int i = 0; i < coarse.size(); i++)
+        patches.set_position(i, coarse.get_position(i));
+
+      global_parameters.min_samples = MAX(global_parameters.elite_samples + 1, (int) round(global_parameters.min_samples * optimization_pyramid_samples));
+      global_parameters.max_samples = MAX(global_parameters.min_samples, (int) round(global_parameters.max_samples * optimization_pyramid_samples));
+
+      DEBUGMSG("Coarse search at level %d (scale %.0f)\n", pyramid_levels, pyramid_response.get_scale());
+    }
+
+  OptimizationStatus status(patches, arena);
+
+  // The full resolution search range shrinks after a coarse search
+  float global_move = (pyramid_levels > 0 && !optimization_maps) ?
+                      optimization_global_M * optimization_pyramid_shrink : optimization_global_M;
+
+  budget.report.global_samples = global_parameters.max_samples;
+  budget.report.global_iterations = global_parameters.iterations;
+  budget.report.local_samples = local_parameters.max_samples;
+  budget.report.local_iterations = local_parameters.iterations;
+
+  bool warm = false;
 
-  if (optimization_global_R < 0.00001 && optimization_global_S < 0.00001)
+  if (optimization_maps)
     {
-      Matrix globalC = Mat::diag( (Mat_<double>(2, 1) << optimization_global_M,
-                                   optimization_global_M));
-      Matrix globalM = (Matrix(1, 2) << 0, 0);
+      response_maps.update(image, patches, optimization_maps_range);
 
-      cross_entropy_global_move(image,
-                                patches, globalM, globalC, global_optimization, status);
+      initialize_search(search_mean, search_covariance, 5, optimization_global_M, optimization_global_R, optimization_global_S);
+
+      warm = warm_start.global(search_mean, search_covariance);
+
+      cross_entropy_global_affine2(status, response_maps, search_mean, search_covariance, global_parameters, size_constraints, &optimization_workspace);
+
+    }
+  else if ((optimization_global_R < 0.00001 && optimization_global_S < 0.00001) ||
+           (model_selector.is_enabled() && !model_selector.is_affine()))
+    {
+      initialize_search(search_mean, search_covariance, 2, global_move, 0, 0);
+
+      warm = warm_start.global(search_mean, search_covariance);
+
+      search_global_move(image, search_mean, search_covariance, global_parameters, status);
 
     }
   else
     {
-      Matrix globalC = Mat::diag( (Mat_<double>(5, 1) << optimization_global_M,
-                                   optimization_global_M, optimization_global_R, optimization_global_S,
-                                   optimization_global_S));
-      Matrix globalM = (Matrix(1, 5) << 0, 0, 0, 1, 1);
+      initialize_search(search_mean, search_covariance, 5, global_move, optimization_global_R, optimization_global_S);
+
+      warm = warm_start.global(search_mean, search_covariance);
+
+      search_global_affine(image, search_mean, search_covariance, global_parameters, status);
+
+    }
+
+  pruning_report.scored += optimization_workspace.global_scored;
+  pruning_report.rejected += optimization_workspace.global_rejected;
+
+  if (announce) notify_observers(OBSERVER_CHANNEL_PRUNING, &pruning_report);
+
+  if (status.size() > 0)
+    {
+      // Iteration counts are only kept by the global stage until the local one resets them
+      PatchStatus gs = status.get(0);
+      bool converged = (gs.flags & OPTIMIZATION_CONVERGED) != 0;
 
-      cross_entropy_global_affine(image,
-                                  patches, globalM, globalC, global_optimization, size_constraints, status);
+      DEBUGMSG("Global search: %s start, %d iterations\n", warm ? "warm" : "cold",
+               converged ? gs.iterations + 1 : global_parameters.iterations);
 
+      warm_start.store_global(optimization_workspace.global_mean, optimization_workspace.global_covariance, converged);
     }
 
 
@@ -449,6 +660,7 @@ void LGTTracker::stage_optimization(Image& image, bool announce, bool push, Debu
       PatchStatus ps = status.get(i);
       patches.set_position(i, ps.position);
       float value = exp(-patches.response(image, i, ps.position)); //
+      status.value(i, value);
       //  if (value > 0.8) status.set_flags(i, OPTIMIZATION_FIXED); // Zakaj mora biti vecji ravno od 0.8
 
 //        }
@@ -460,28 +672,66 @@ void LGTTracker::stage_optimization(Image& image, bool announce, bool push, Debu
 
   if (announce) notify_stage(STAGE_OPTIMIZATION_LOCAL);
 
+  budget.stage(STAGE_OPTIMIZATION_LOCAL);
+
+  budget.report.refined = patches.size();
+
   if (patches.size() > 4)
     {
       DEBUGMSG("Delaunay start\n");
-      DelaunayConstraints* cn = new DelaunayConstraints(patches);
+      local_constraints.update(patches);
       DEBUGMSG("Delaunay stop\n");
 
-      cross_entropy_local_refine(image, patches,*cn, optimization_local_M,
-                                 lambda_geometry, lambda_visual, local_optimization, status);
+      // Well matching patches are frozen or refined with fewer samples, with a
+      // time budget the best matching ones are also left out
+      active_set.schedule(status, local_constraints, budget.refined(patches.size(), patches_min));
 
-      delete cn;
+      budget.report.refined = active_set.report.refined;
+
+      DEBUGMSG("Active set: %d refined (%d reduced), %d frozen\n", active_set.report.refined,
+               active_set.report.reduced, active_set.report.frozen);
+
+      if (announce) notify_observers(OBSERVER_CHANNEL_ACTIVE_SET, &active_set.report);
+
+      // Parallel local optimization uses the same worker pool as the global one
+      WorkerPool* local_pool = optimization_local_parallel ? &workers : NULL;
+
+      Matrix* local_seed = NULL;
+      if (warm_start.local(patches, optimization_local_M, warm_covariances))
+        local_seed = &warm_covariances;
+
+      if (optimization_maps)
+        cross_entropy_local_refine(response_maps, patches, local_constraints, optimization_local_M,
+                                   lambda_geometry, lambda_visual, local_parameters, status, local_pool, &optimization_workspace, local_seed);
+      else
+        refine_local(image, local_parameters, status, local_pool, local_seed);
+
+      warm_start.store_local(patches, optimization_workspace.local_covariances);
+
+      int converged = 0, iterations = 0;
 
       for (int i = 0; i < status.size(); i++)
         {
           PatchStatus ps = status.get(i);
+          if (ps.flags & OPTIMIZATION_CONVERGED)
+            {
+              converged++;
+              iterations += ps.iterations + 1;
+            }
           // if (status[i].flags & OPTIMIZATION_CONVERGED) {
           //if (announce) notify_observers(OBSERVER_CHANNEL_OPTIMIZATION, & status[i]);
           patches.set_position(i, ps.position);
           // }
         }
 
+      if (converged > 0)
+        DEBUGMSG("Local search: %s start, %.1f iterations on average (%d converged)\n",
+                 local_seed ? "warm" : "cold", (float) iterations / converged, converged);
+
     }
 
+  model_selector.update(patches);
+
 }
 
 void LGTTracker::stage_update_weights(Image& image, bool announce, bool push, DebugOutput* debug)
@@ -489,86 +739,45 @@ void LGTTracker::stage_update_weights(Image& image, bool announce, bool push, De
 
   if (announce) notify_stage(STAGE_UPDATE_WEIGHTS);
 
-  Point2f *positions = new Point2f[patches.size()];
-  vector<float> similarity_score;
-  vector<float> proximity_score;
+  float* similarity_score = arena.allocate<float>(patches.size());
+  float* proximity_score = arena.allocate<float>(patches.size());
 
   for (int i = 0; i < patches.size(); i++)
     {
-      float similarity = exp(- patches.response(image, i, patches.get_position(i)) * reweight_similarity);
-      similarity_score.push_back(similarity);
-      positions[i] = patches.get_position(i);
+      similarity_score[i] = exp(- patches.response(image, i, patches.get_position(i)) * reweight_similarity);
     }
 
-  Matrix D = distances(positions, patches.size());
-
-  vector<double> medians;
-
-  for (int p = 0; p < patches.size(); p++)
-    {
-      Matrix r = D.row(p);
-
-      float m = median(r);
-      medians.push_back(m);
-    }
+  SpatialGrid& grid = patches.get_grid();
 
   for (int p = 0; p < patches.size(); p++)
     {
-      proximity_score.push_back(1 / (1 + exp((medians[p] - median_threshold) * reweight_distance)));
+      float m = grid.median_distance(p);
+      proximity_score[p] = 1 / (1 + exp((m - median_threshold) * reweight_distance));
     }
 
-  PatchReweight reweight;
+  // The report is a member so that its weight vector keeps its capacity
+  reweight_report.weights.resize(2);
 
   for (int i = 0; i < patches.size(); i++)
     {
-      reweight.id = patches.get_id(i);
-      reweight.weights.clear();
       patches.set_weight(i, reweight_persistence * patches.get_weight(i) + (1 - reweight_persistence) * similarity_score[i] * proximity_score[i]);
-      reweight.weights.push_back(similarity_score[i]);
-      reweight.weights.push_back(proximity_score[i]);
-      if (announce) notify_observers(OBSERVER_CHANNEL_REWEIGHT, & reweight);
+      if (!announce) continue;
+      reweight_report.id = patches.get_id(i);
+      reweight_report.weights[0] = similarity_score[i];
+      reweight_report.weights[1] = proximity_score[i];
+      notify_observers(OBSERVER_CHANNEL_REWEIGHT, & reweight_report);
     }
 
-  // Merging or inhibition
+  // Merging or inhibition: all groups of patches that are closer than the
+  // threshold are merged at once
   float merge_threshold = merge_distance * patches.get_radius();
 
-  vector<int> selection;
-
-  while (true)
+  if (grid.clusters(merge_threshold, merge_groups) > 0)
     {
-      for (int i = 0; i < patches.size(); i++)
-        positions[i] = patches.get_position(i);
-
-
-      D = distances(positions, patches.size());
-
-      int p;
-      for (p = 0; p < patches.size(); p++)
-        {
-          selection.clear();
-
-          for (int m = p; m < patches.size(); m++)
-            {
-              if (D(p, m) < merge_threshold)
-                {
-                  selection.push_back(m);
-                }
-            }
-          if (selection.size() > 1)
-            {
-              DEBUGMSG("Merging %d patches\n", (int)selection.size());
-              patches.merge(image, selection, patch_type);
-              break;
-            }
-
-        }
-
-      if (p == patches.size())
-        break;
+      DEBUGMSG("Merging %d groups of patches\n", (int)merge_groups.size());
+      patches.merge(image, merge_groups, patch_type);
     }
 
-  delete [] positions;
-
   // remove patches
   WeightLowerFilter remove_filter(weight_remove_threshold);
   int removed = patches.remove(remove_filter);
@@ -580,7 +789,15 @@ void LGTTracker::stage_update_modalities(Image& image, bool announce, bool push,
 
   if (announce) notify_stage(STAGE_UPDATE_MODALITIES);
 
-  modalities.update(image, &patches, patches.region());
+  // Cues with an adaptive schedule are refreshed if new patches are going to be sampled
+  modalities.update(image, &patches, patches.region(), patches_required() > 0);
+
+}
+
+int LGTTracker::patches_required()
+{
+
+  return MAX( MIN((int)round(patches_capacity) - (float)patches.size() + 1, patches_max - patches.size()),  patches_min - patches.size());
 
 }
 
@@ -594,21 +811,28 @@ void LGTTracker::stage_add_patches(Image& image, bool announce, bool push, Debug
   cv::Rect region = intersection(cv::Rect(0, 0, image.width(), image.height()),  cv::Rect((int)center.x - probability_size / 2,
                                  (int)center.y - probability_size / 2, probability_size, probability_size));
 
-  Image crop(image, region);
+  // The crop and the probability map are reused, only the derived formats
+  // of the crop are computed again
+  Image& crop = addition_crop;
+  crop.copy_region(image, region);
 
-  int patches_new = MAX( MIN((int)round(patches_capacity) - (float)patches.size() + 1, patches_max - patches.size()),  patches_min - patches.size());
+  int patches_new = patches_required();
 
   DEBUGMSG("%f %d %d\n", patches_capacity, patches.size(), patches_max);
 
-  Mat mask;
-  patch_create(mask, (float)patches.get_patch_size() * addition_distance, (float)patches.get_patch_size() * addition_distance, PATCH_CONE, FLAG_INVERT);
+  // The mask only changes with the size of the patches
+  int mask_size = (int) ((float)patches.get_patch_size() * addition_distance);
+  if (addition_mask.empty() || addition_mask.cols != mask_size)
+    patch_create(addition_mask, mask_size, mask_size, PATCH_CONE, FLAG_INVERT);
+
+  Mat& mask = addition_mask;
 
   DEBUGMSG("Adding %d patches \n", patches_new);
 
   if (patches_new > 0)
     {
 
-      Mat map;
+      Mat& map = addition_probability;
       modalities.probability(crop, map);
 
       if (!map.empty())
@@ -617,41 +841,44 @@ void LGTTracker::stage_add_patches(Image& image, bool announce, bool push, Debug
           double max;
           minMaxLoc(map, NULL, &max, NULL, NULL, Mat());
 
-          supress_noise(map, max * sampling_threshold, 5, 1);
+          // noise suppression is done while building the sampler
+          sampler.build(map, max * sampling_threshold, 5, 1);
+
+          // now we mask out the positions of existing patches in the probability,
+          // only the patches close enough to the region can affect it
+          vector<int>& nearby = addition_nearby;
+          patches.get_grid().query(Rect(region.x - mask.cols / 2 - 1, region.y - mask.rows / 2 - 1,
+                                        region.width + mask.cols + 2, region.height + mask.rows + 2), nearby);
 
-          // now we mask out the positions of existing patches in the probability
-          for (int i = 0; i < patches.size(); i++)
+          for (int i = 0; i < nearby.size(); i++)
             {
-              cv::Point p = patches.get_relative_position(i, region.tl());
-              patch_operation(map, mask, p, OPERATION_MULTIPLY);
+              cv::Point p = patches.get_relative_position(nearby[i], region.tl());
+              sampler.multiply(mask, p);
             }
 
           // add new patches if possible
           for (int i = 0; i < patches_new; i++)
             {
 
-              double total = sum(map)[0];
+              double total = sampler.total();
 
               if (total < 1e-16) //TODO: hardcoded
                 break;
 
-              map /= total; // normalize masked probability
-
-              cv::Point p;
-              float value;
-
-              sample_map(map, &p, 1, &value);
+              cv::Point p = sampler.sample();
 
               if (p.x == -1)
                 break;
 
-              if (map.at<float>(p.y, p.x) < 0.00001)
+              float probability = sampler.get(p) / total; // normalized masked probability
+
+              if (probability < 0.00001)
                 break;
 
-              DEBUGMSG("Adding patch to %d,%d (probability %f)\n", p.x, p.y, map.at<float>(p.y, p.x));
+              DEBUGMSG("Adding patch to %d,%d (probability %f)\n", p.x, p.y, probability);
 
               // mask again
-              patch_operation(map, mask, p, OPERATION_MULTIPLY);
+              sampler.multiply(mask, p);
 
               patches.add(image, patch_type, p + region.tl(), 0.5); //TODO: hardcoded
 
@@ -718,25 +945,22 @@ void LGTTracker::visualize(Canvas& canvas)
   if (verbosity > 1)
     {
 
-      Mat statePost = motion.statePost ;
-      Mat errorCovPost = motion.errorCovPost ;
+      SmallVector<4>& statePost = motion.state_post ;
+      SmallMatrix<4, 4>& errorCovPost = motion.covariance_post ;
       Point2f mean, pred ;
       Matrix2f cov ;
-      mean.x = statePost.at<float>(0,0) ;
-      mean.y = statePost.at<float>(1,0) ;
-      cov.m00 = errorCovPost.at<float>(0,0) ;
-      cov.m11 = errorCovPost.at<float>(1,1) ;
-      cov.m01 = errorCovPost.at<float>(0,1) ;
-      cov.m10 = errorCovPost.at<float>(1,0) ;
+      mean.x = statePost[0] ;
+      mean.y = statePost[1] ;
+      cov.m00 = errorCovPost(0,0) ;
+      cov.m11 = errorCovPost(1,1) ;
+      cov.m01 = errorCovPost(0,1) ;
+      cov.m10 = errorCovPost(1,0) ;
       canvas.ellipse(mean, cov, Scalar(0, 0, 255));
 
       canvas.rectangle(region(), Scalar(0, 255, 0), 2);
 
-      float ppx = statePost.at<float>(2, 0) ;
-      float ppy = statePost.at<float>(3, 0) ;
-
-      pred.x = mean.x + statePost.at<float>(2, 0) * motion.transitionMatrix.at<float>(0, 2) ;
-      pred.y = mean.y + statePost.at<float>(3, 0) * motion.transitionMatrix.at<float>(1, 3) ;
+      pred.x = mean.x + statePost[2] * motion.transition(0, 2) ;
+      pred.y = mean.y + statePost[3] * motion.transition(1, 3) ;
       canvas.line(mean, pred, Scalar(100, 255, 120), 2);
     }
 }
@@ -816,58 +1040,70 @@ string LGTTracker::get_name()
   return "LG tracker";
 }
 
-void supress_noise(Mat& mat, float threshold, int window, float percent, IntegralImage* integral)
+void LGTTracker::search_global_move(Image& image, Matrix& mean, Matrix& covariance, CrossEntropyParameters& parameters, OptimizationStatus& status)
 {
 
-  int window_threshold = ((float)  window * window) * percent;
-  IntegralImage* temp = NULL;
+  cross_entropy_global_move(image, patches, mean, covariance, parameters, status, &workers, &optimization_workspace);
 
-  int window_offset = ceil( ((float) window) / 2);
+}
 
-  if (integral)
-    {
-      temp = integral;
-      temp->update(mat, threshold);
-    }
-  else
-    {
-      temp = new IntegralImage(mat, threshold);
-    }
+void LGTTracker::search_global_affine(Image& image, Matrix& mean, Matrix& covariance, CrossEntropyParameters& parameters, OptimizationStatus& status)
+{
 
-  for (int i = 0; i < mat.rows; i++)
-    {
-      float* data = (float *) mat.ptr(i);
+  cross_entropy_global_affine(image, patches, mean, covariance, parameters, size_constraints, status, &workers, &optimization_workspace);
 
-      if (i - window_offset <= 0 || i + window_offset >= mat.cols-1)
-        {
-          memset(data, 0, sizeof(float) * mat.cols);
-        }
-      else
-        {
+}
 
-          for (int j = 0; j < window_offset; j++)
-            {
-              data[j] = 0;
-              data[mat.cols - 1 - j] = 0;
-            }
+void LGTTracker::refine_local(Image& image, CrossEntropyParameters& parameters, OptimizationStatus& status, WorkerPool* pool, Matrix* seed)
+{
 
-          for (int j = 0; j < mat.cols - window; j++)
-            {
-              if (temp->sum(MAX(0, j), MAX(0, i), MIN(mat.cols-1, j + window),
-                            MIN(mat.rows-1, i + window)) < window_threshold)
-                data[j + window_offset] = 0;
-            }
+  cross_entropy_local_refine(image, patches, local_constraints, optimization_local_M,
+                             lambda_geometry, lambda_visual, parameters, status, pool, &optimization_workspace, seed);
 
-        }
-    }
+}
 
-  if (!integral)
-    {
-      delete temp;
-    }
+template <class P>
+LGTTrackerT<P>::LGTTrackerT(Config& config, string instance) : LGTTracker(config, instance)
+{
+
+  // The registered name determines the patch type
+  if (patch_type != P::TYPE)
+    DEBUGMSG("Warning: patch.type ignored, the tracker is specialized for a different patch type\n");
+
+  patch_type = P::TYPE;
 
 }
 
+template <class P>
+void LGTTrackerT<P>::search_global_move(Image& image, Matrix& mean, Matrix& covariance, CrossEntropyParameters& parameters, OptimizationStatus& status)
+{
+
+  cross_entropy_global_move<P>(image, patches, mean, covariance, parameters, status, &workers, &optimization_workspace);
+
+}
+
+template <class P>
+void LGTTrackerT<P>::search_global_affine(Image& image, Matrix& mean, Matrix& covariance, CrossEntropyParameters& parameters, OptimizationStatus& status)
+{
+
+  cross_entropy_global_affine<P>(image, patches, mean, covariance, parameters, size_constraints, status, &workers, &optimization_workspace);
+
+}
+
+template <class P>
+void LGTTrackerT<P>::refine_local(Image& image, CrossEntropyParameters& parameters, OptimizationStatus& status, WorkerPool* pool, Matrix* seed)
+{
+
+  cross_entropy_local_refine<P>(image, patches, local_constraints, optimization_local_M,
+                                lambda_geometry, lambda_visual, parameters, status, pool, &optimization_workspace, seed);
+
+}
+
+template class LGTTrackerT<HistogramPatch>;
+
+template class LGTTrackerT<SSDPatch>;
+
+
 }
 
 }
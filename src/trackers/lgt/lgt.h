@@ -23,21 +23,30 @@
 
 #include <string.h>
 #include <opencv2/core/core.hpp>
-#include <opencv2/video/tracking.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
 #include "common/utils/config.h"
 #include "common/utils/utils.h"
 #include "common/utils/debug.h"
 #include "common/utils/defs.h"
+#include "common/utils/workers.h"
+#include "common/utils/arena.h"
 #include "common/math/geometry.h"
 #include "common/math/statistics.h"
+#include "common/math/sampler.h"
+#include "common/math/kalman.h"
 #include "tracker.h"
 #include "observers.h"
 #include "patches/patchset.h"
+#include "patches/patch.h"
 #include "modalities/modalities.h"
 #include "optimization/optimization.h"
 #include "optimization/crossentropy.h"
+#include "optimization/pyramid.h"
+#include "optimization/activeset.h"
+#include "budget.h"
+#include "warmstart.h"
+#include "selector.h"
 
 using namespace cv;
 using namespace std;
@@ -95,6 +104,22 @@ protected:
 
   virtual void stage_add_patches(Image& image, bool announce, bool push, DebugOutput* debug);
 
+  /**
+      Global searches on the image, the generic versions dispatch the patch
+      responses that the batch can not evaluate directly through virtual calls.
+  */
+  virtual void search_global_move(Image& image, Matrix& mean, Matrix& covariance, CrossEntropyParameters& parameters, OptimizationStatus& status);
+
+  virtual void search_global_affine(Image& image, Matrix& mean, Matrix& covariance, CrossEntropyParameters& parameters, OptimizationStatus& status);
+
+  /**
+      Local refinement on the image, the generic version dispatches the patch
+      responses through virtual calls.
+  */
+  virtual void refine_local(Image& image, CrossEntropyParameters& parameters, OptimizationStatus& status, WorkerPool* pool, Matrix* seed);
+
+  int patches_required();
+
   void notify_observers(int channel, void* data, int flags = 0);
 
   void notify_stage(int stage);
@@ -111,6 +136,10 @@ protected:
 
   float patch_scale;
 
+  bool integral_histograms;
+
+  int integral_margin;
+
   int patches_max, patches_min;
 
   double patches_persistence, patches_capacity;
@@ -135,6 +164,12 @@ protected:
 
   CrossEntropyParameters local_optimization;
 
+  CrossEntropyWorkspace optimization_workspace;
+
+  DelaunayConstraints local_constraints;
+
+  ActiveSet active_set;
+
   float optimization_global_M;
 
   float optimization_global_R;
@@ -143,16 +178,66 @@ protected:
 
   float optimization_local_M;
 
+  bool optimization_local_parallel;
+
+  bool optimization_maps;
+
+  int optimization_maps_range;
+
+  ResponseMaps response_maps;
+
+  int optimization_pyramid_levels;
+
+  float optimization_pyramid_samples;
+
+  float optimization_pyramid_shrink;
+
+  PyramidResponse pyramid_response;
+
+  WarmStart warm_start;
+
+  ModelSelector model_selector;
+
+  Matrix warm_covariances;
+
+  // Starting distribution of the global search, reused between frames
+  Matrix search_mean;
+
+  Matrix search_covariance;
+
   float sampling_threshold;
 
   float addition_distance;
 
-  KalmanFilter motion;
+  FrameBudget budget;
+
+  PruningReport pruning_report;
+
+  PatchReweight reweight_report;
+
+  MapSampler sampler;
+
+  // Transient memory of a single frame, released at the beginning of the next one
+  FrameArena arena;
+
+  Mat addition_mask;
+
+  Image addition_crop;
+
+  Mat addition_probability;
+
+  vector<int> addition_nearby;
+
+  vector<vector<int> > merge_groups;
+
+  SmallKalmanFilter<4, 2> motion;
 
   Patches patches;
 
   Modalities modalities;
 
+  WorkerPool workers;
+
   vector<Ptr<Observer> > observers;
 
   PatchType patch_type;
@@ -163,14 +248,41 @@ protected:
 
 };
 
-void supress_noise(Mat& mat, float threshold, int window, float percent, IntegralImage* integral = NULL);
+/**
+    Tracker specialized for a single patch type. The global searches and the
+    local refinement are instantiated for the concrete patch class so that the
+    per-sample responses are resolved at compile time. The patch type is given
+    by the specialization, patch.type is ignored.
+*/
+template <class P>
+class LGTTrackerT : public LGTTracker
+{
+public:
+
+  LGTTrackerT(Config& config, string instance = "default");
+
+protected:
+
+  virtual void search_global_move(Image& image, Matrix& mean, Matrix& covariance, CrossEntropyParameters& parameters, OptimizationStatus& status);
+
+  virtual void search_global_affine(Image& image, Matrix& mean, Matrix& covariance, CrossEntropyParameters& parameters, OptimizationStatus& status);
+
+  virtual void refine_local(Image& image, CrossEntropyParameters& parameters, OptimizationStatus& status, WorkerPool* pool, Matrix* seed);
+
+};
+
+typedef LGTTrackerT<HistogramPatch> LGTHistogramTracker;
+
+typedef LGTTrackerT<SSDPatch> LGTSSDTracker;
 
 }
 
 }
 
 #ifdef REGISTER_TRACKER
-REGISTER_TRACKER(LGTTracker, "lgt");
+REGISTER_TRACKER(LGTTracker, "lgt-generic");
+REGISTER_TRACKER(LGTHistogramTracker, "lgt");
+REGISTER_TRACKER(LGTSSDTracker, "lgt-ssd");
 #endif
 
 #endif
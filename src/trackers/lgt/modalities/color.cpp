@@ -142,11 +142,9 @@ void ModalityColor3DHistogram::flush()
   has_data = false;
 }
 
-void ModalityColor3DHistogram::update(Image& image, PatchSet* patchSet, Rect bounds)
+void ModalityColor3DHistogram::update(Image& image, PatchSelection& patches, Rect bounds)
 {
 
-  Ptr<PatchSet> patches = reliablePatchesFilter.empty() ? patchSet : patchSet->filter(*reliablePatchesFilter);
-
   Rect background_outer = expand(bounds, background_size + background_margin);
   Rect background_inner = expand(bounds, background_margin);
 
@@ -158,12 +156,12 @@ void ModalityColor3DHistogram::update(Image& image, PatchSet* patchSet, Rect bou
   Mat mask = image.get_mask();
   mask.setTo(0);
 
-  int half_size = patches->get_radius() * foreground_size;
+  int half_size = patches.get_radius() * foreground_size;
 
 // Foreground histogram
-  for (int i = 0; i < patches->size(); i++)
+  for (int i = 0; i < patches.size(); i++)
     {
-      Point2f pos = patches->get_position(i);
+      Point2f pos = patches.get_position(i);
 
       Rect r;
       r.x = CLAMP3( ((int)pos.x - half_size), 0, mask.cols);
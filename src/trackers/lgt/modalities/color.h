@@ -42,7 +42,7 @@ public:
 
   virtual void flush();
 
-  virtual void update(Image& image, PatchSet* patches, cv::Rect bounds);
+  virtual void update(Image& image, PatchSelection& patches, cv::Rect bounds);
 
   virtual bool usable();
 
@@ -18,6 +18,7 @@
 ********************************************************************/
 /* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
 
+#include <algorithm>
 #include "common/math/geometry.h"
 #include "common/utils/debug.h"
 
@@ -81,6 +82,31 @@ Modalities::Modalities(Config& config)
 
   DEBUGMSG("Total cues: %d \n", size());
 
+  for (int i = 0; i < modalities.size(); i++)
+    {
+      int index = -1;
+      for (int j = 0; j < i; j++)
+        {
+          ReliablePatchesFilter& a = modalities[i]->get_filter();
+          ReliablePatchesFilter& b = modalities[j]->get_filter();
+          if (a.get_weight() == b.get_weight() && a.get_age() == b.get_age())
+            {
+              index = selection_index[j];
+              break;
+            }
+        }
+
+      if (index < 0)
+        {
+          index = selections.size();
+          selections.push_back(PatchSelection());
+        }
+
+      selection_index.push_back(index);
+    }
+
+  selected.resize(selections.size(), false);
+
   debugCanvas = get_canvas("modalities");
 
 }
@@ -96,18 +122,44 @@ void Modalities::flush()
   for (int i = 0; i < modalities.size(); i++)
     {
       modalities[i]->flush();
+      modalities[i]->reschedule();
     }
 
 }
 
-void Modalities::update(Image& image, PatchSet* patches, Rect bounds)
+void Modalities::update(Image& image, PatchSet* patches, Rect bounds, bool consumed)
 {
 
+  int skipped = 0;
+
+  for (int i = 0; i < selected.size(); i++)
+    selected[i] = false;
+
   for (int i = 0; i < modalities.size(); i++)
     {
-      modalities[i]->update(image, patches, bounds);
+      PatchSelection& selection = selections[selection_index[i]];
+
+      if (!selected[selection_index[i]])
+        {
+          selection.select(*patches, modalities[i]->get_filter());
+          selected[selection_index[i]] = true;
+        }
+
+      if (modalities[i]->scheduled(bounds, consumed))
+        {
+          modalities[i]->update(image, selection, bounds);
+          modalities[i]->refreshed(bounds);
+        }
+      else
+        {
+          modalities[i]->skip(image, selection, bounds);
+          skipped++;
+        }
     }
 
+  if (skipped > 0)
+    DEBUGMSG("Modalities refreshed: %d of %d\n", size() - skipped, size());
+
 }
 
 void Modalities::probability(Image& image, Mat& p)
@@ -124,7 +176,6 @@ void Modalities::probability(Image& image, Mat& p)
 
   debugCanvas->clear();
 
-  Mat pmap;
   pmap.create(region.height, region.width, CV_32FC1);
 
   p.create(region.height, region.width, CV_32FC1);
@@ -174,7 +225,7 @@ void Modalities::probability(Image& image, Mat& p)
             }
         }
 
-      p = p.mul(pmap);
+      multiply(p, pmap, p);
       usable = true;
     }
 
@@ -218,12 +269,75 @@ Modality::Modality(Config& config, string configbase)
 {
 
   double weight = (config.keyExists(configbase + ".filter.weight")) ? config.read<double>(configbase + ".filter.weight", 0) : config.read<double>("cues.filter.weight", 0);
-  int age = (config.keyExists(configbase + ".filter.age")) ? config.read<int>(configbase + ".filter.weight", 0) : config.read<int>("cues.filter.age", 0);
+  int age = (config.keyExists(configbase + ".filter.age")) ? config.read<int>(configbase + ".filter.age", 0) : config.read<int>("cues.filter.age", 0);
 
   reliablePatchesFilter = new ReliablePatchesFilter(weight, age);
 
   debugCanvas = get_canvas(config.read<string>(configbase + ".debug", ""));
 
+  update_adaptive = config.read<bool>(configbase + ".update.adaptive", false);
+
+  // In the adaptive mode the interval is only an upper bound, unbounded if not positive
+  update_interval = config.read<int>(configbase + ".update.interval", update_adaptive ? 0 : 1);
+  if (!update_adaptive)
+    update_interval = MAX(1, update_interval);
+  update_drift = config.read<float>(configbase + ".update.drift", 0.1);
+
+  reschedule();
+
+}
+
+ReliablePatchesFilter& Modality::get_filter()
+{
+
+  return *reliablePatchesFilter;
+
+}
+
+void Modality::reschedule()
+{
+
+  update_age = 0;
+  update_bounds = Rect();
+
+}
+
+void Modality::refreshed(Rect bounds)
+{
+
+  update_age = 0;
+  update_bounds = bounds;
+
+}
+
+bool Modality::scheduled(Rect bounds, bool consumed)
+{
+
+  update_age++;
+
+  if (!usable() || update_bounds.area() == 0)
+    return true;
+
+  if (update_interval > 0 && update_age >= update_interval)
+    return true;
+
+  if (!update_adaptive)
+    return false;
+
+  if (consumed)
+    return true;
+
+  // Drift of the region since the last refresh, the displacement relative to
+  // the size of the region and the relative change of its area
+  Point2f shift = (Point2f(bounds.x, bounds.y) + Point2f(bounds.width, bounds.height) * 0.5f) -
+                  (Point2f(update_bounds.x, update_bounds.y) + Point2f(update_bounds.width, update_bounds.height) * 0.5f);
+
+  float diagonal = sqrt((float) (update_bounds.width * update_bounds.width + update_bounds.height * update_bounds.height));
+
+  float drift = distance(shift) / diagonal + fabs(log((float) std::max(1, bounds.area()) / (float) update_bounds.area()));
+
+  return drift > update_drift;
+
 }
 
 }
@@ -44,10 +44,12 @@ class ReliablePatchesFilter : public Filter
 public:
   ReliablePatchesFilter(float weight, int age) : weight(weight), age(age) {}
   ~ReliablePatchesFilter() {}
-  virtual bool operator() (Ptr<Patch>& patch)
+  virtual bool operator() (PatchSet& set, int index)
   {
-    return (patch->get_weight(0) > weight && patch->get_age() > age);
+    return (set.get_weight(index) > weight && set.get_age(index) > age);
   }
+  float get_weight() { return weight; }
+  int get_age() { return age; }
 private:
   float weight;
   int age;
@@ -60,12 +62,36 @@ public:
 
   virtual void flush() = 0;
 
-  virtual void update(Image& image, PatchSet* patches, cv::Rect bounds) = 0;
+  virtual void update(Image& image, PatchSelection& patches, cv::Rect bounds) = 0;
 
   virtual bool usable() = 0;
 
   virtual void probability(Image& image, Mat& p) = 0;
 
+  /**
+      Called instead of update in frames in which the cue is not refreshed.
+      Cues that depend on consecutive frames can keep their history here.
+  */
+  virtual void skip(Image& image, PatchSelection& patches, cv::Rect bounds) {};
+
+  /**
+      Decides if the cue has to be refreshed in the current frame. A cue is
+      refreshed every update.interval frames. In the adaptive mode it is
+      refreshed when its output is going to be consumed or when the tracked
+      region has drifted from the one it was last refreshed for, and the
+      interval, if positive, only bounds the time between refreshes.
+  */
+  bool scheduled(cv::Rect bounds, bool consumed);
+
+  void refreshed(cv::Rect bounds);
+
+  void reschedule();
+
+  /**
+      Returns the filter that selects the patches the cue is updated with.
+  */
+  ReliablePatchesFilter& get_filter();
+
   //virtual string get_name() = 0;
 
 protected:
@@ -74,6 +100,15 @@ protected:
 
   Canvas* debugCanvas;
 
+private:
+
+  int update_interval;
+  bool update_adaptive;
+  float update_drift;
+
+  int update_age;
+  cv::Rect update_bounds;
+
 };
 
 class Modalities
@@ -86,7 +121,11 @@ public:
 
   void flush();
 
-  void update(Image& image, PatchSet* patches, cv::Rect bounds);
+  /**
+      Updates the cues that are scheduled for refresh in this frame, the
+      consumed flag tells if the probability is going to be used.
+  */
+  void update(Image& image, PatchSet* patches, cv::Rect bounds, bool consumed = true);
 
   void probability(Image& image, Mat& p);
 
@@ -98,6 +137,17 @@ protected:
 
   vector<Ptr<Modality> > modalities;
 
+  // Cues with equal filters share a selection of patches, the selections
+  // are views into the patch set that are recomputed once per frame
+  vector<PatchSelection> selections;
+  vector<int> selection_index;
+
+  // Selections that were already recomputed in the current update
+  vector<bool> selected;
+
+  // Probability of a single cue, kept between frames
+  Mat pmap;
+
   Canvas* debugCanvas;
 
 };
@@ -73,22 +73,21 @@ void ModalityMotionLK::flush()
   motion.flush();
 }
 
-void ModalityMotionLK::update(Image& image, PatchSet* patchSet, Rect bounds)
+// Keeps the images and the global motion of consecutive frames
+void ModalityMotionLK::record(Image& image, PatchSelection& patches)
 {
 
-  Ptr<PatchSet> patches = reliablePatchesFilter.empty() ? patchSet : patchSet->filter(*reliablePatchesFilter);
-
   Point2f globalMotion(0, 0);
   float w = 0;
 
-  for (int i = 0; i < patches->size(); i++)
+  for (int i = 0; i < patches.size(); i++)
     {
-      if (patches->get_age(i) < step) continue;
-      Point2f current = patches->get_position(i, 0);
-      Point2f past = patches->get_position(i, step-1);
-      globalMotion.x += (current.x - past.x) * patches->get_weight(i);
-      globalMotion.y += (current.y - past.y) * patches->get_weight(i);
-      w += patches->get_weight(i);
+      if (patches.get_age(i) < step) continue;
+      Point2f current = patches.get_position(i, 0);
+      Point2f past = patches.get_position(i, step-1);
+      globalMotion.x += (current.x - past.x) * patches.get_weight(i);
+      globalMotion.y += (current.y - past.y) * patches.get_weight(i);
+      w += patches.get_weight(i);
     }
 
   if (w != 0)
@@ -103,6 +102,22 @@ void ModalityMotionLK::update(Image& image, PatchSet* patchSet, Rect bounds)
       history.push(Ptr<Mat>(img));
     }
 
+}
+
+void ModalityMotionLK::skip(Image& image, PatchSelection& patches, Rect bounds)
+{
+
+  // The flow is computed between consecutive frames, so the history has to
+  // be kept up to date even if the map is not
+  record(image, patches);
+
+}
+
+void ModalityMotionLK::update(Image& image, PatchSelection& patches, Rect bounds)
+{
+
+  record(image, patches);
+
   if (!usable())
     return;
 
@@ -115,7 +130,7 @@ void ModalityMotionLK::update(Image& image, PatchSet* patchSet, Rect bounds)
   float texture_threshold = 3;
 
   // a simple hack (otherwise this function takes too much time)
-  Rect roi = intersection(image.get_roi(), expand(patches->region(), 50));
+  Rect roi = intersection(image.get_roi(), expand(patches.region(), 50));
   Mat grayscale = image.get_gray();
   vector<Point2f> points(50);
   Point2f offset = roi.tl();
@@ -158,7 +173,7 @@ void ModalityMotionLK::update(Image& image, PatchSet* patchSet, Rect bounds)
   ProxyCanvas proxyDebug(debugCanvas);
   if (debugCanvas->get_zoom() > 0)
     {
-      Point proxyOffset = patches->mean_position() - cv::Point(debugCanvas->width(), debugCanvas->height()) / (2 * debugCanvas->get_zoom());
+      Point proxyOffset = patches.mean_position() - cv::Point(debugCanvas->width(), debugCanvas->height()) / (2 * debugCanvas->get_zoom());
       proxyDebug.set_offset(-proxyOffset);
       proxyDebug.draw(*img1);
     }
@@ -200,7 +215,7 @@ void ModalityMotionLK::update(Image& image, PatchSet* patchSet, Rect bounds)
 #ifdef BUILD_DEBUG
   if (debugCanvas->get_zoom() > 0)
     {
-      Point2f mean = patches->mean_position();
+      Point2f mean = patches.mean_position();
       proxyDebug.rectangle(mean - Point2f(1,1), mean + Point2f(1,1), COLOR_GREEN);
       proxyDebug.line(mean, mean - referenceMotion, COLOR_BLACK);
       proxyDebug.push();
@@ -22,6 +22,7 @@
 #define _LEGIT_MODALITIES_MOTION
 
 #include "modalities.h"
+#include "common/utils/buffer.h"
 #include <opencv2/imgproc/imgproc.hpp>
 
 using namespace cv;
@@ -43,13 +44,17 @@ public:
 
   virtual void flush();
 
-  virtual void update(Image& image, PatchSet* patches, cv::Rect bounds);
+  virtual void update(Image& image, PatchSelection& patches, cv::Rect bounds);
 
   virtual bool usable();
 
   virtual void probability(Image& image, Mat& p);
 
+  virtual void skip(Image& image, PatchSelection& patches, cv::Rect bounds);
+
 private:
+
+  void record(Image& image, PatchSelection& patches);
   int step;
 
   Buffer<Ptr<Mat> > history;
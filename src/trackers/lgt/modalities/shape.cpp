@@ -53,12 +53,10 @@ void ModalityConvex::flush()
     history.setTo(0);
 }
 
-void ModalityConvex::update(Image& image, PatchSet* patchSet, Rect bounds)
+void ModalityConvex::update(Image& image, PatchSelection& patches, Rect bounds)
 {
 
-  Ptr<PatchSet> patches = reliablePatchesFilter.empty() ? patchSet : patchSet->filter(*reliablePatchesFilter);
-
-  if (patches->size() < 3)
+  if (patches.size() < 3)
     {
       //flush();
       return;
@@ -74,19 +72,19 @@ void ModalityConvex::update(Image& image, PatchSet* patchSet, Rect bounds)
       history.setTo(0);
     }
 
-  Point2f * points = new Point2f[patches->size()];
+  points.resize(patches.size());
   Point2f * hull = NULL;
 
-  Point2f offset = Point2f(image.width()/2, image.height() /2) - patchSet->mean_position();
+  Point2f offset = Point2f(image.width()/2, image.height() /2) - patches.get_set().mean_position();
 
   Point2f mean(0, 0);
 
-  for (int i = 0; i < patches->size(); i++)
+  for (int i = 0; i < patches.size(); i++)
     {
-      points[i] = patches->get_position(i) + offset;
+      points[i] = patches.get_position(i) + offset;
     }
 
-  int size = convex_hull(points, patches->size(), &hull);
+  int size = convex_hull(&points[0], patches.size(), &hull);
 
   for (int i = 0; i < size; i++)
     {
@@ -97,30 +95,27 @@ void ModalityConvex::update(Image& image, PatchSet* patchSet, Rect bounds)
   mean.x /= size;
   mean.y /= size;
 
-  Point * hulli = new Point[size];
-  Point * hullei = new Point[size];
+  hull_inner.resize(size);
+  hull_outer.resize(size);
 
   for (int i = 0; i < size; i++)
     {
-      hulli[i].x = (int) hull[i].x;
-      hulli[i].y = (int) hull[i].y;
+      hull_inner[i].x = (int) hull[i].x;
+      hull_inner[i].y = (int) hull[i].y;
     }
 
   expand(hull, size, mean, margin);
 
   for (int i = 0; i < size; i++)
     {
-      hullei[i].x = (int) hull[i].x;
-      hullei[i].y = (int) hull[i].y;
+      hull_outer[i].x = (int) hull[i].x;
+      hull_outer[i].y = (int) hull[i].y;
     }
 
-  fillConvexPoly(temp, hullei, size, Scalar(1 - margin_diminish));
-  fillConvexPoly(temp, hulli, size, Scalar(1));
+  fillConvexPoly(temp, &hull_outer[0], size, Scalar(1 - margin_diminish));
+  fillConvexPoly(temp, &hull_inner[0], size, Scalar(1));
 
-  delete [] points;
   free(hull);
-  delete [] hulli;
-  delete [] hullei;
 
   history = history * persistence + temp * (1.0f - persistence);
 
@@ -172,11 +167,9 @@ void ModalityBounding::flush()
   bounds.width = -1;
 }
 
-void ModalityBounding::update(Image& image, PatchSet* patchSet, Rect bounds)
+void ModalityBounding::update(Image& image, PatchSelection& patches, Rect bounds)
 {
 
-  //Ptr<PatchSet> patches = reliablePatchesFilter.empty() ? patchSet : patchSet->filter(*reliablePatchesFilter);
-
   this->bounds = expand(bounds, margin);
 
 }
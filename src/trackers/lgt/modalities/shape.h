@@ -42,7 +42,7 @@ public:
 
   virtual void flush();
 
-  virtual void update(Image& image, PatchSet* patches, cv::Rect bounds);
+  virtual void update(Image& image, PatchSelection& patches, cv::Rect bounds);
 
   virtual bool usable();
 
@@ -57,6 +57,13 @@ private:
 
   Mat history;
 
+  // Point buffers of the hull, kept between frames to avoid reallocation
+  vector<Point2f> points;
+
+  vector<Point> hull_inner;
+
+  vector<Point> hull_outer;
+
 };
 
 class ModalityBounding : public Modality
@@ -68,7 +75,7 @@ public:
 
   virtual void flush();
 
-  virtual void update(Image& image, PatchSet* patches, cv::Rect bounds);
+  virtual void update(Image& image, PatchSelection& patches, cv::Rect bounds);
 
   virtual bool usable();
 
@@ -0,0 +1,146 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#include <string.h>
+#include <algorithm>
+#include "activeset.h"
+
+namespace legit
+{
+
+namespace tracker
+{
+
+ActiveSet::ActiveSet(bool enabled, float freeze, float consistency, float reduce) : enabled(enabled), freeze(freeze),
+  consistency(consistency), reduce(reduce)
+{
+
+  memset(&report, 0, sizeof(ActiveSetReport));
+
+}
+
+ActiveSet::~ActiveSet()
+{
+
+}
+
+void ActiveSet::schedule(OptimizationStatus& status, Constraints& constraints, int limit)
+{
+
+  memset(&report, 0, sizeof(ActiveSetReport));
+
+  int count = status.size();
+
+  report.patches = count;
+
+  order.clear();
+
+  if (enabled)
+    {
+
+      if (!constraints.neighbourhoods(offsets, neighbourhoods))
+        {
+          offsets.clear();
+          neighbourhoods.clear();
+
+          for (int i = 0; i < count; i++)
+            {
+              offsets.push_back(neighbourhoods.size());
+
+              for (int j = 0; j < count; j++)
+                {
+                  float weight = constraints.constraint(i, j);
+
+                  if (weight > 0)
+                    {
+                      NeighbourConstraint constraint;
+                      constraint.index = j;
+                      constraint.weight = weight;
+                      neighbourhoods.push_back(constraint);
+                    }
+                }
+            }
+
+          offsets.push_back(neighbourhoods.size());
+        }
+
+    }
+
+  for (int i = 0; i < count; i++)
+    {
+      float value = status.get(i).value;
+
+      if (!enabled)
+        {
+          order.push_back(pair<float, int>(value, i));
+          continue;
+        }
+
+      // Weighted match of the neighbourhood, a patch without neighbours is
+      // only judged by itself
+      float neighbourhood = value;
+      float total = 0, weights = 0;
+
+      for (int n = offsets[i]; n < offsets[i + 1]; n++)
+        {
+          total += status.get(neighbourhoods[n].index).value * neighbourhoods[n].weight;
+          weights += neighbourhoods[n].weight;
+        }
+
+      if (weights > 0) neighbourhood = total / weights;
+
+      if (value >= freeze && neighbourhood >= consistency)
+        {
+          status.set_flags(i, OPTIMIZATION_FIXED);
+          report.frozen++;
+          continue;
+        }
+
+      if (value >= reduce)
+        {
+          status.set_flags(i, OPTIMIZATION_REDUCED);
+          report.reduced++;
+        }
+
+      order.push_back(pair<float, int>(value, i));
+    }
+
+  // Worst matching patches are refined first
+  std::sort(order.begin(), order.end());
+
+  for (int i = std::max(0, limit); i < (int) order.size(); i++)
+    {
+      int p = order[i].second;
+
+      if (status.get(p).flags & OPTIMIZATION_REDUCED)
+        report.reduced--;
+
+      status.unset_flags(p, OPTIMIZATION_REDUCED);
+      status.set_flags(p, OPTIMIZATION_FIXED);
+      report.frozen++;
+    }
+
+  report.refined = count - report.frozen;
+
+}
+
+}
+
+}
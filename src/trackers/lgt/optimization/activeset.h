@@ -0,0 +1,79 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#ifndef LEGIT_OPTIMIZATION_ACTIVESET
+#define LEGIT_OPTIMIZATION_ACTIVESET
+
+#include <vector>
+#include "optimization.h"
+#include "observers.h"
+
+namespace legit
+{
+
+namespace tracker
+{
+
+/**
+    Decides which patches take part in the local refinement. After the
+    global stage every patch is rated by its visual match and by the match
+    of its neighbours. Patches that match well in a well matching
+    neighbourhood are frozen (OPTIMIZATION_FIXED), patches that only match
+    reasonably get the reduced sample budget (OPTIMIZATION_REDUCED) and the
+    rest are refined with the full budget. An upper limit on the number of
+    refined patches freezes the best matching ones first.
+*/
+class ActiveSet
+{
+public:
+  ActiveSet(bool enabled = false, float freeze = 0.8, float consistency = 0.6, float reduce = 0.5);
+  ~ActiveSet();
+
+  inline bool is_enabled()
+  {
+    return enabled;
+  }
+
+  /**
+      Sets the scheduling flags of the status. Values of the status have to
+      be set to the visual match of the patches.
+  */
+  void schedule(OptimizationStatus& status, Constraints& constraints, int limit);
+
+  ActiveSetReport report;
+
+private:
+
+  bool enabled;
+  float freeze;
+  float consistency;
+  float reduce;
+
+  vector<int> offsets;
+  vector<NeighbourConstraint> neighbourhoods;
+  vector<pair<float, int> > order;
+
+};
+
+}
+
+}
+
+#endif
@@ -18,7 +18,9 @@
 ********************************************************************/
 /* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
 
+#include <algorithm>
 #include "crossentropy.h"
+#include "../patches/patch.h"
 #include "common/gui/gui.h"
 #include "common/utils/defs.h"
 
@@ -28,42 +30,261 @@ namespace legit
 namespace tracker
 {
 
-typedef struct PatchCostPair_
-{
-  float cost;
-  int index;
-} PatchCostPair;
-
 int compare_patch_cost_pair (const void* i, const void* j)
 {
   float c = ( ((PatchCostPair*)j)->cost - ((PatchCostPair*)i)->cost );
   return (c < 0) ? -1 : (c > 0) ? 1 : 0;
 }
 
-typedef struct
+// Scores global samples stored in rows of a sample matrix. Each sample is
+// evaluated independently and written to its own slot in the result array,
+// so the outcome does not depend on how the range is split among workers.
+// Patches that are not handled by the histogram path of the batch are
+// evaluated as patches of type P.
+template <class P>
+class GlobalSampleScoring : public WorkerTask
+{
+public:
+  GlobalSampleScoring(PatchBatch& batch, Matrix& samples, float* scores) :
+    batch(batch), samples(samples), scores(scores), offset(0), threshold(-FLT_MAX) {}
+
+  void set_offset(int o)
+  {
+    offset = o;
+  }
+
+  void set_threshold(float t)
+  {
+    threshold = t;
+  }
+
+  virtual void execute(int begin, int end)
+  {
+    batch.scores<P>(samples, begin + offset, end + offset, scores, threshold);
+  }
+
+private:
+  PatchBatch& batch;
+  Matrix& samples;
+  float* scores;
+  int offset;
+  float threshold;
+};
+
+// Scores the samples [begin, end) and adds them to the elite buffer. Once the
+// buffer is full, a sample can only enter it by exceeding its lowest score, so
+// samples that can not reach that score are rejected early. The buffer is
+// filled without bounds first, the rejected samples would not have entered
+// the buffer in any case.
+template <class P>
+static void score_global_samples(WorkerPool* pool, GlobalSampleScoring<P>& scoring, CrossEntropyWorkspace& ws, int begin, int end)
+{
+
+  OrderedBoundedBuffer<int>& elite = ws.global_elite;
+
+  int fill = elite.is_full() ? begin : MIN(end, begin + elite.capacity() - elite.size());
+
+  for (int phase = 0; phase < 2; phase++)
+    {
+      int first = phase ? fill : begin;
+      int last = phase ? end : fill;
+
+      if (first >= last) continue;
+
+      scoring.set_offset(first);
+      scoring.set_threshold(elite.is_full() ? elite.score(elite.size() - 1) : -FLT_MAX);
+      parallel_execute(pool, scoring, last - first);
+
+      for (int k = first; k < last; k++)
+        {
+          if (ws.global_costs[k] < 0)
+            ws.global_rejected++;
+          else
+            elite.push(k, ws.global_costs[k]);
+        }
+
+      ws.global_scored += last - first;
+    }
+
+}
+
+CrossEntropyWorkspace::CrossEntropyWorkspace() : global_costs(NULL), global_scored(0), global_rejected(0), local_means(NULL),
+  local_previous(NULL), local_positions(NULL), local_done(NULL), local_streams(NULL), global_costs_size(0), local_patches_size(0)
+{
+
+}
+
+CrossEntropyWorkspace::~CrossEntropyWorkspace()
+{
+
+  delete [] global_costs;
+  delete [] local_means;
+  delete [] local_previous;
+  delete [] local_positions;
+  delete [] local_done;
+  delete [] local_streams;
+
+  for (size_t i = 0; i < local_scratch.size(); i++)
+    delete local_scratch[i];
+
+}
+
+// Grows the storage matrix if needed and returns a view of the requested size
+static void reserve_matrix(Matrix& storage, Matrix& view, int rows, int cols)
+{
+
+  if (storage.rows < rows || storage.cols < cols)
+    storage.create(MAX(storage.rows, rows), MAX(storage.cols, cols));
+
+  view = storage(Range(0, rows), Range(0, cols));
+
+}
+
+void CrossEntropyWorkspace::prepare_global(CrossEntropyParameters& params, int dimensions)
 {
-  int index;
-  float weight;
-} NeighbourConstraint;
 
-void cross_entropy_global_move(Image& image, PatchSet& patches, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, OptimizationStatus& status)
+  // Batches of added samples may overshoot the maximum
+  int samples = params.max_samples + params.add_samples;
+
+  reserve_matrix(global_samples_storage, global_samples, samples, dimensions);
+  reserve_matrix(global_elite_storage, global_elite_samples, params.elite_samples, dimensions);
+  reserve_matrix(global_weights_storage, global_elite_weights, params.elite_samples, 1);
+  reserve_matrix(global_covariance_storage, global_covariance, dimensions + 1, dimensions);
+
+  global_mean = global_covariance.row(dimensions);
+  global_covariance = global_covariance.rowRange(0, dimensions);
+
+  if (global_costs_size < samples)
+    {
+      delete [] global_costs;
+      global_costs = new float[samples];
+      global_costs_size = samples;
+    }
+
+  // One more than the number of elite samples is needed for the stopping rule
+  global_elite.resize(params.elite_samples + 1);
+
+  global_scored = 0;
+  global_rejected = 0;
+
+}
+
+void CrossEntropyWorkspace::prepare_local(CrossEntropyParameters& params, int patches, int threads)
+{
+
+  if (local_covariances.rows < patches)
+    local_covariances.create(patches, 4);
+
+  if (local_patches_size < patches)
+    {
+      delete [] local_means;
+      delete [] local_previous;
+      delete [] local_positions;
+      delete [] local_done;
+      delete [] local_streams;
+      local_means = new Point2f[patches];
+      local_previous = new Point2f[patches];
+      local_positions = new Point2f[patches];
+      local_done = new bool[patches];
+      local_streams = new tinymt32_t[patches];
+      local_patches_size = patches;
+    }
+
+  while ((int) local_scratch.size() < threads)
+    local_scratch.push_back(new LocalRefineScratch());
+
+  for (int i = 0; i < threads; i++)
+    local_scratch[i]->prepare(params, patches);
+
+}
+
+LocalRefineScratch::LocalRefineScratch() : affine_from(NULL), affine_to(NULL), affine_weights(NULL), patches_size(0)
+{
+
+}
+
+LocalRefineScratch::~LocalRefineScratch()
+{
+
+  delete [] affine_from;
+  delete [] affine_to;
+  delete [] affine_weights;
+
+}
+
+void LocalRefineScratch::prepare(CrossEntropyParameters& params, int patches)
+{
+
+  reserve_matrix(samples_storage, samples, std::max(params.min_samples, params.max_samples), 2);
+  reserve_matrix(elite_storage, elite_samples, params.elite_samples, 2);
+  reserve_matrix(weights_storage, elite_weights, params.elite_samples, 1);
+
+  if (patches_size < patches)
+    {
+      delete [] affine_from;
+      delete [] affine_to;
+      delete [] affine_weights;
+      affine_from = new Point2f[patches];
+      affine_to = new Point2f[patches];
+      affine_weights = new float[patches];
+      patches_size = patches;
+    }
+
+  elite.resize(params.elite_samples);
+
+}
+
+// Copies the best samples and their scores into the elite matrices and returns
+// views of the filled rows.
+static void collect_elite(OrderedBoundedBuffer<int>& elite, int count, Matrix& samples, Matrix& elite_samples,
+                          Matrix& elite_weights, Matrix& samples_view, Matrix& weights_view)
+{
+
+  count = MIN(count, elite.size());
+
+  for (int j = 0; j < count; j++)
+    {
+      Mat r = elite_samples.row(j);
+      samples.row(elite.get(j)).copyTo(r);
+      elite_weights(j, 0) = elite.score(j);
+    }
+
+  samples_view = elite_samples.rowRange(0, count);
+  weights_view = elite_weights.rowRange(0, count);
+
+}
+
+template <class P>
+void cross_entropy_global_move(Image& image, PatchSet& patches, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, OptimizationStatus& status, WorkerPool* pool, CrossEntropyWorkspace* workspace)
 {
 
   status.reset();
 
-  Matrix globalC = covariance;
-  Matrix globalM = mean;
+  CrossEntropyWorkspace temporary_workspace;
+  CrossEntropyWorkspace& ws = workspace ? *workspace : temporary_workspace;
+
+  ws.prepare_global(params, 2);
+
+  Matrix& globalC = ws.global_covariance;
+  Matrix& globalM = ws.global_mean;
+  covariance.copyTo(globalC);
+  mean.copyTo(globalM);
+
+  SmallVector<2> mu;
+  SmallMatrix<2, 2> sigma;
+  mu.load(globalM);
+  sigma.load(globalC);
 
   Point2f center = patches.mean_position();
 
   double gamma_low = 0;
   double gamma_high = 0;
 
-  PatchCostPair* sampled_positions = new PatchCostPair[params.max_samples];
+  Matrix elite_samples, elite_weights;
 
-  Mat_<double> global_samples = Mat_<double>(params.max_samples, 2); // this matrix stores global CE parameters
-  Mat_<double> global_elite_samples = Mat_<double>(params.elite_samples, 2); // this matrix stores elite global CE parameters
-  Mat_<double> global_elite_weights = Mat_<double>(params.elite_samples, 1); // this vector stores elite global CE weighths / responses
+  ws.global_batch.prepare(image, patches, BATCH_TRANSLATION, center);
+
+  GlobalSampleScoring<P> scoring(ws.global_batch, ws.global_samples, ws.global_costs);
 
   Rect4f region = patches.region();
 //    region.x = -region.width / 2;
@@ -77,80 +298,43 @@ void cross_entropy_global_move(Image& image, PatchSet& patches, Matrix& mean, Ma
       int count = patches.size();
 
       int samples_count = 0;
-      sample_gaussian2(globalM, globalC, params.min_samples, global_samples, samples_count);
-
-
-      for (int k = 0; k < params.min_samples; k++)
-        {
-          Point2f A(global_samples.at<double>(k, 0), global_samples.at<double>(k, 1));
+      ws.global_sequence.reset(params.sampling, globalM.cols);
+      ws.global_sequence.sample(mu, sigma, params.min_samples, ws.global_samples, samples_count);
 
-          PatchCostPair response;
-          response.index = k;
-          response.cost = 0.0;
-
-          for (int j = 0; j < patches.size(); j++)
-            {
-              Point2f tp = patches.get_position(j) + A;
-              float cost = exp(- patches.response(image, j, tp) );
-              response.cost += cost * patches.get_weight(j);
-            }
-          sampled_positions[k] = response;
-        }
+      ws.global_elite.flush();
+      score_global_samples(pool, scoring, ws, 0, params.min_samples);
 
       samples_count = params.min_samples;
 
-      // TODO: not all samples are needed : create a dynamic list of N elite samples data structure
-      qsort(sampled_positions, samples_count, sizeof(PatchCostPair), compare_patch_cost_pair);
-
       while (samples_count < params.max_samples)
         {
           // TODO: verify in CE algorithm (pg. 191)
-          if (gamma_low < sampled_positions[params.elite_samples].cost || gamma_high < sampled_positions[0].cost)
+          if (gamma_low < ws.global_elite.score(params.elite_samples) || gamma_high < ws.global_elite.score(0))
             {
-              gamma_low = sampled_positions[params.elite_samples].cost;
-              gamma_high = sampled_positions[1].cost;
+              gamma_low = ws.global_elite.score(params.elite_samples);
+              gamma_high = ws.global_elite.score(1);
               break;
             }
 
-          sample_gaussian2(globalM, globalC, params.add_samples, global_samples, samples_count);
+          ws.global_sequence.sample(mu, sigma, params.add_samples, ws.global_samples, samples_count);
 
-          for (int k = samples_count; k < samples_count + params.add_samples; k++)
-            {
-              Point2f A(global_samples.at<double>(k, 0), global_samples.at<double>(k, 1));
-              PatchCostPair response;
-              response.index = k;
-              response.cost = 0.0;
-
-              for (int j = 0; j < patches.size(); j++)
-                {
-                  Point2f tp = patches.get_position(j) + A;
-                  float cost = exp(-  patches.response(image, j, tp)  );
-                  response.cost +=  cost * patches.get_weight(j);
-                }
+          score_global_samples(pool, scoring, ws, samples_count, samples_count + params.add_samples);
 
-              sampled_positions[k] = response;
-            }
           samples_count += params.add_samples;
 
-          qsort(sampled_positions, samples_count, sizeof(PatchCostPair), compare_patch_cost_pair);
-
         }
 
-      for (int j = 0; j < params.elite_samples; j++)
-        {
-          Mat r = global_elite_samples.row(j);
-          global_samples.row(sampled_positions[j].index).copyTo(r);
-          global_elite_weights(j, 0) = sampled_positions[j].cost;
-        }
+      collect_elite(ws.global_elite, params.elite_samples, ws.global_samples, ws.global_elite_samples,
+                    ws.global_elite_weights, elite_samples, elite_weights);
 
       // TODO: fail?
-      if (global_elite_weights(0, 0) == 0) global_elite_weights.setTo(1);
-
-      globalC = row_weighted_covariance(global_elite_samples, global_elite_weights);
+      if (elite_weights(0, 0) == 0) elite_weights.setTo(1);
 
-      globalM = row_weighted_mean(global_elite_samples, global_elite_weights);
+      weighted_mean_covariance(elite_samples, elite_weights, mu, sigma);
+      mu.store(globalM);
+      sigma.store(globalC);
 
-      double det = globalC.at<double>(0, 0) * globalC.at<double>(1, 1) - globalC.at<double>(1, 0) * globalC.at<double>(0, 1);
+      double det = globalC(0, 0) * globalC(1, 1) - globalC(1, 0) * globalC(0, 1);
 
       if (det < params.terminate || samples_count >= params.max_samples)
         {
@@ -165,7 +349,7 @@ void cross_entropy_global_move(Image& image, PatchSet& patches, Matrix& mean, Ma
         }
     }
 
-  Point2f A(globalM.at<double>(0), globalM.at<double>(1));
+  Point2f A(globalM(0, 0), globalM(0, 1));
 
   for (int j = 0; j < patches.size(); j++)
     {
@@ -176,8 +360,6 @@ void cross_entropy_global_move(Image& image, PatchSet& patches, Matrix& mean, Ma
       status.set(j, p, exp(- patches.response(image, j, p)));
     }
 
-  delete [] sampled_positions;
-
   if (i < params.iterations)
     {
       DEBUGMSG("Global iterations: %d\n", i);
@@ -187,9 +369,12 @@ void cross_entropy_global_move(Image& image, PatchSet& patches, Matrix& mean, Ma
       DEBUGMSG("Warning: global optimization did not converge! \n");
     }
 
+  DEBUGMSG("Global samples: %d, rejected early: %d\n", ws.global_scored, ws.global_rejected);
+
 }
 
-void cross_entropy_global_affine(Image& image, PatchSet& patches, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, SizeConstraints size_constraints, OptimizationStatus& status)
+template <class P>
+void cross_entropy_global_affine(Image& image, PatchSet& patches, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, SizeConstraints size_constraints, OptimizationStatus& status, WorkerPool* pool, CrossEntropyWorkspace* workspace)
 {
 
   status.reset();
@@ -199,19 +384,31 @@ void cross_entropy_global_affine(Image& image, PatchSet& patches, Matrix& mean,
           status[i].flags = 0;
       }*/
 
-  Matrix globalC = covariance;
-  Matrix globalM = mean;
+  CrossEntropyWorkspace temporary_workspace;
+  CrossEntropyWorkspace& ws = workspace ? *workspace : temporary_workspace;
+
+  ws.prepare_global(params, 5);
+
+  Matrix& globalC = ws.global_covariance;
+  Matrix& globalM = ws.global_mean;
+  covariance.copyTo(globalC);
+  mean.copyTo(globalM);
+
+  SmallVector<5> mu;
+  SmallMatrix<5, 5> sigma;
+  mu.load(globalM);
+  sigma.load(globalC);
 
   Point2f center = patches.mean_position();
 
   double gamma_low = 0;
   double gamma_high = 0;
 
-  PatchCostPair* sampled_positions = new PatchCostPair[params.max_samples];
+  Matrix elite_samples, elite_weights;
+
+  ws.global_batch.prepare(image, patches, BATCH_AFFINE, center);
 
-  Mat_<double> global_samples = Mat_<double>(params.max_samples, 5); // this matrix stores global CE parameters
-  Mat_<double> global_elite_samples = Mat_<double>(params.elite_samples, 5); // this matrix stores elite global CE parameters
-  Mat_<double> global_elite_weights = Mat_<double>(params.elite_samples, 1); // this vector stores elite global CE weighths / responses
+  GlobalSampleScoring<P> scoring(ws.global_batch, ws.global_samples, ws.global_costs);
 
   Rect4f region = patches.region();
   region.x = -region.width / 2;
@@ -238,7 +435,9 @@ void cross_entropy_global_affine(Image& image, PatchSet& patches, Matrix& mean,
 
       int samples_count = 0;
 
-      sample_gaussian2(globalM, globalC, params.min_samples, global_samples, samples_count);
+      ws.global_sequence.reset(params.sampling, globalM.cols);
+
+      ws.global_sequence.sample(mu, sigma, params.min_samples, ws.global_samples, samples_count);
 
       // clamp the predicted scale
       /*for (int k = 0; k < params.min_samples; k++) {
@@ -246,43 +445,22 @@ void cross_entropy_global_affine(Image& image, PatchSet& patches, Matrix& mean,
       	global_samples.at<double>(k, 4) = CLAMP3(global_samples.at<double>(k, 4), sy_min, sy_max) ;
       }*/
 
-      for (int k = 0; k < params.min_samples; k++)
-        {
-          Matrix3f A = simple_affine_transformation(global_samples.at<double>(k, 0), global_samples.at<double>(k, 1),
-                       global_samples.at<double>(k, 2), global_samples.at<double>(k, 3), global_samples.at<double>(k, 4));
-
-          PatchCostPair response;
-          response.index = k;
-          response.cost = 0.0;
-
-          for (int j = 0; j < patches.size(); j++)
-            {
-              // TODO: optimize this part (tp = A*point + (I-A)*center = A*point + dconst)
-              Point2f tp = transform_point(patches.get_relative_position(j, center), A);
-              tp.x += center.x;
-              tp.y += center.y;
-              float cost = exp(- patches.response(image, j, tp) );
-              response.cost += cost * patches.get_weight(j);
-            }
-          sampled_positions[k] = response;
-        }
+      ws.global_elite.flush();
+      score_global_samples(pool, scoring, ws, 0, params.min_samples);
 
       samples_count = params.min_samples;
 
-      // TODO: not all samples are needed : create a dynamic list of N elite samples data structure
-      qsort(sampled_positions, samples_count, sizeof(PatchCostPair), compare_patch_cost_pair);
-
       while (samples_count < params.max_samples)
         {
           // TODO: verify in CE algorithm (pg. 191)
-          if (gamma_low < sampled_positions[params.elite_samples].cost || gamma_high < sampled_positions[0].cost)
+          if (gamma_low < ws.global_elite.score(params.elite_samples) || gamma_high < ws.global_elite.score(0))
             {
-              gamma_low = sampled_positions[params.elite_samples].cost;
-              gamma_high = sampled_positions[1].cost;
+              gamma_low = ws.global_elite.score(params.elite_samples);
+              gamma_high = ws.global_elite.score(1);
               break;
             }
 
-          sample_gaussian2(globalM, globalC, params.add_samples, global_samples, samples_count);
+          ws.global_sequence.sample(mu, sigma, params.add_samples, ws.global_samples, samples_count);
 
           // clamp the predicted scale
           /*for (int k = 0; k < params.min_samples; k++) {
@@ -290,46 +468,23 @@ void cross_entropy_global_affine(Image& image, PatchSet& patches, Matrix& mean,
           	global_samples.at<double>(k, 4) = CLAMP3(global_samples.at<double>(k, 4), sy_min, sy_max) ;
           }*/
 
-          for (int k = samples_count; k < samples_count + params.add_samples; k++)
-            {
-              Matrix3f A = simple_affine_transformation(global_samples.at<double>(k, 0), global_samples.at<double>(k, 1),
-                           global_samples.at<double>(k, 2), global_samples.at<double>(k, 3), global_samples.at<double>(k, 4));
-              PatchCostPair response;
-              response.index = k;
-              response.cost = 0.0;
+          score_global_samples(pool, scoring, ws, samples_count, samples_count + params.add_samples);
 
-              for (int j = 0; j < patches.size(); j++)
-                {
-                  Point2f tp = transform_point(patches.get_relative_position(j, center), A);
-                  tp.x += center.x;
-                  tp.y += center.y;
-                  float cost = exp(-  patches.response(image, j, tp)  ); //exp(- patches.response(image, j, tp)  );
-                  response.cost +=  cost * patches.get_weight(j);
-                }
-
-              sampled_positions[k] = response;
-            }
           samples_count += params.add_samples;
 
-          qsort(sampled_positions, samples_count, sizeof(PatchCostPair), compare_patch_cost_pair);
-
         }
 
-      for (int j = 0; j < params.elite_samples; j++)
-        {
-          Mat r = global_elite_samples.row(j);
-          global_samples.row(sampled_positions[j].index).copyTo(r);
-          global_elite_weights(j, 0) = sampled_positions[j].cost;
-        }
+      collect_elite(ws.global_elite, params.elite_samples, ws.global_samples, ws.global_elite_samples,
+                    ws.global_elite_weights, elite_samples, elite_weights);
 
       // TODO: fail?
-      if (global_elite_weights(0, 0) == 0) global_elite_weights.setTo(1);
-
-      globalC = row_weighted_covariance(global_elite_samples, global_elite_weights);
+      if (elite_weights(0, 0) == 0) elite_weights.setTo(1);
 
-      globalM = row_weighted_mean(global_elite_samples, global_elite_weights);
+      weighted_mean_covariance(elite_samples, elite_weights, mu, sigma);
+      mu.store(globalM);
+      sigma.store(globalC);
 
-      double det = globalC.at<double>(0, 0) * globalC.at<double>(1, 1) - globalC.at<double>(1, 0) * globalC.at<double>(0, 1);
+      double det = globalC(0, 0) * globalC(1, 1) - globalC(1, 0) * globalC(0, 1);
 
 #ifdef BUILD_DEBUG
       if (debug->get_zoom() > 0)
@@ -337,8 +492,8 @@ void cross_entropy_global_affine(Image& image, PatchSet& patches, Matrix& mean,
           Mat gray = image.get_gray();
           debug->draw(gray);
 
-          Matrix3f A = simple_affine_transformation(globalM.at<double>(0, 0), globalM.at<double>(0, 1),
-                       globalM.at<double>(0, 2), globalM.at<double>(0, 3), globalM.at<double>(0, 4));
+          Matrix3f A = simple_affine_transformation(globalM(0, 0), globalM(0, 1),
+                       globalM(0, 2), globalM(0, 3), globalM(0, 4));
           for (int j = 0; j < patches.size(); j++)
             {
               Point2f p = transform_point(status.get_position(j), A, center);
@@ -363,8 +518,8 @@ void cross_entropy_global_affine(Image& image, PatchSet& patches, Matrix& mean,
         }
     }
 
-  Matrix3f A = simple_affine_transformation(globalM.at<double>(0, 0), globalM.at<double>(0, 1),
-               globalM.at<double>(0, 2), globalM.at<double>(0, 3), globalM.at<double>(0, 4));
+  Matrix3f A = simple_affine_transformation(globalM(0, 0), globalM(0, 1),
+               globalM(0, 2), globalM(0, 3), globalM(0, 4));
   for (int j = 0; j < patches.size(); j++)
     {
       // TODO: optimize
@@ -372,9 +527,6 @@ void cross_entropy_global_affine(Image& image, PatchSet& patches, Matrix& mean,
       status.set(j, p, exp(- patches.response(image, j, p)));
     }
 
-
-  delete [] sampled_positions;
-
   if (i < params.iterations)
     {
       DEBUGMSG("Global iterations: %d\n", i);
@@ -383,9 +535,85 @@ void cross_entropy_global_affine(Image& image, PatchSet& patches, Matrix& mean,
     {
       DEBUGMSG("Warning: global optimization did not converge! \n");
     }
+
+  DEBUGMSG("Global samples: %d, rejected early: %d\n", ws.global_scored, ws.global_rejected);
+}
+
+void cross_entropy_global_move(Image& image, PatchSet& patches, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, OptimizationStatus& status, WorkerPool* pool, CrossEntropyWorkspace* workspace)
+{
+
+  cross_entropy_global_move<Patch>(image, patches, mean, covariance, params, status, pool, workspace);
+
+}
+
+void cross_entropy_global_affine(Image& image, PatchSet& patches, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, SizeConstraints size_constraints, OptimizationStatus& status, WorkerPool* pool, CrossEntropyWorkspace* workspace)
+{
+
+  cross_entropy_global_affine<Patch>(image, patches, mean, covariance, params, size_constraints, status, pool, workspace);
+
+}
+
+template void cross_entropy_global_move<HistogramPatch>(Image& image, PatchSet& patches, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, OptimizationStatus& status, WorkerPool* pool, CrossEntropyWorkspace* workspace);
+
+template void cross_entropy_global_move<SSDPatch>(Image& image, PatchSet& patches, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, OptimizationStatus& status, WorkerPool* pool, CrossEntropyWorkspace* workspace);
+
+template void cross_entropy_global_affine<HistogramPatch>(Image& image, PatchSet& patches, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, SizeConstraints size_constraints, OptimizationStatus& status, WorkerPool* pool, CrossEntropyWorkspace* workspace);
+
+template void cross_entropy_global_affine<SSDPatch>(Image& image, PatchSet& patches, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, SizeConstraints size_constraints, OptimizationStatus& status, WorkerPool* pool, CrossEntropyWorkspace* workspace);
+
+// Orders the elements of a response function by decreasing bound and computes
+// the bounds of the remaining response after the first j elements
+static void order_by_bound(ResponseFunction& function, int count, vector<int>& order, vector<float>& bounds,
+                           vector<pair<float, int> >& sorted)
+{
+
+  sorted.resize(count);
+
+  for (int j = 0; j < count; j++)
+    sorted[j] = pair<float, int>(-function.bound(j), j);
+
+  // Indices break the ties, so the order is the same as with a stable sort,
+  // which would allocate a temporary buffer
+  std::sort(sorted.begin(), sorted.end());
+
+  order.resize(count);
+  bounds.resize(count + 1);
+
+  for (int j = 0; j < count; j++)
+    order[j] = sorted[j].second;
+
+  bounds[count] = 0;
+  for (int j = count - 1; j >= 0; j--)
+    bounds[j] = bounds[j + 1] + function.bound(order[j]);
+
+}
+
+// Normalized cost of an affine sample or -1 if the sample can not enter the
+// full elite buffer anymore
+static float score_affine_sample(ResponseFunction& function, OptimizationStatus& status, Matrix3f& A, Point2f center,
+                                 vector<int>& order, vector<float>& bounds, OrderedBoundedBuffer<int>& elite)
+{
+
+  float normalization = function.normalization();
+  float threshold = (elite.is_full() && normalization > 0) ? elite.score(elite.size() - 1) / normalization : -FLT_MAX;
+
+  float cost = 0.0;
+
+  for (int j = 0; j < (int) order.size(); j++)
+    {
+      // TODO: optimize this part (tp = A*point + (I-A)*center = A*point + dconst)
+      Point2f tp = transform_point(status.get_position(order[j]), A, center);
+      cost += function.response(order[j], tp);
+
+      if (cost + bounds[j + 1] < threshold)
+        return -1;
+    }
+
+  return cost * normalization;
+
 }
 
-void cross_entropy_global_affine2(OptimizationStatus& status, ResponseFunction& function, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, SizeConstraints size_constraints)
+void cross_entropy_global_affine2(OptimizationStatus& status, ResponseFunction& function, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, SizeConstraints size_constraints, CrossEntropyWorkspace* workspace)
 {
 
   if (status.size() == 0)
@@ -393,17 +621,26 @@ void cross_entropy_global_affine2(OptimizationStatus& status, ResponseFunction&
 
   status.reset();
 
-  Matrix globalC = covariance;
-  Matrix globalM = mean;
+  CrossEntropyWorkspace temporary_workspace;
+  CrossEntropyWorkspace& ws = workspace ? *workspace : temporary_workspace;
+
+  ws.prepare_global(params, 5);
+
+  Matrix& globalC = ws.global_covariance;
+  Matrix& globalM = ws.global_mean;
+  covariance.copyTo(globalC);
+  mean.copyTo(globalM);
+
+  SmallVector<5> mu;
+  SmallMatrix<5, 5> sigma;
+  mu.load(globalM);
+  sigma.load(globalC);
 
   double gamma_low = 0;
   double gamma_high = 0;
 
-  PatchCostPair* sampled_positions = new PatchCostPair[params.max_samples];
-
-  Mat_<double> global_samples = Mat_<double>(params.max_samples, 5); // this matrix stores global CE parameters
-  Mat_<double> global_elite_samples = Mat_<double>(params.elite_samples, 5); // this matrix stores elite global CE parameters
-  Mat_<double> global_elite_weights = Mat_<double>(params.elite_samples, 1); // this vector stores elite global CE weighths / responses
+  Matrix elite_samples, elite_weights;
+  Matrix& global_samples = ws.global_samples;
 
   Point2f center(0, 0);
   Rect4f region(INT_MAX, INT_MAX, 0, 0);
@@ -430,12 +667,31 @@ void cross_entropy_global_affine2(OptimizationStatus& status, ResponseFunction&
   region.x = -region.width / 2;
   region.y = -region.height / 2;
 
-  float sx_min, sx_max, sy_min, sy_max ;
+  // Patches with higher bounds are evaluated first, so that the samples that
+  // can not enter the elite set are rejected early
+  vector<int>& order = ws.global_order;
+  vector<float>& bounds = ws.global_bounds;
 
-  sx_min = (float)(size_constraints.min_size.width) / region.width;
-  sx_max = (float)(size_constraints.max_size.width) / region.width;
-  sy_min = (float)(size_constraints.min_size.height) / region.height;
-  sy_max = (float)(size_constraints.max_size.height) / region.height;
+  order_by_bound(function, status.size(), order, bounds, ws.global_sorted);
+
+  // Size constraints that are not set (non-positive) do not limit the scale
+  float sx_min = -FLT_MAX, sx_max = FLT_MAX, sy_min = -FLT_MAX, sy_max = FLT_MAX;
+
+  if (region.width > 0)
+    {
+      if (size_constraints.min_size.width > 0)
+        sx_min = (float)(size_constraints.min_size.width) / region.width;
+      if (size_constraints.max_size.width > 0)
+        sx_max = (float)(size_constraints.max_size.width) / region.width;
+    }
+
+  if (region.height > 0)
+    {
+      if (size_constraints.min_size.height > 0)
+        sy_min = (float)(size_constraints.min_size.height) / region.height;
+      if (size_constraints.max_size.height > 0)
+        sy_max = (float)(size_constraints.max_size.height) / region.height;
+    }
 
   // Number of global cross entropy iterations ...
   int i;
@@ -445,7 +701,8 @@ void cross_entropy_global_affine2(OptimizationStatus& status, ResponseFunction&
       int count = status.size();
 
       int samples_count = 0;
-      sample_gaussian2(globalM, globalC, params.min_samples, global_samples, samples_count);
+      ws.global_sequence.reset(params.sampling, globalM.cols);
+      ws.global_sequence.sample(mu, sigma, params.min_samples, global_samples, samples_count);
 
       // clamp the predicted scale
       for (int k = 0; k < params.min_samples; k++)
@@ -454,44 +711,38 @@ void cross_entropy_global_affine2(OptimizationStatus& status, ResponseFunction&
           global_samples.at<double>(k, 4) = CLAMP3(global_samples.at<double>(k, 4), sy_min, sy_max) ;
         }
 
+      ws.global_elite.flush();
+
       for (int k = 0; k < params.min_samples; k++)
         {
           Matrix3f A = simple_affine_transformation(global_samples.at<double>(k, 0), global_samples.at<double>(k, 1),
                        global_samples.at<double>(k, 2), global_samples.at<double>(k, 3), global_samples.at<double>(k, 4));
 
-          PatchCostPair response;
-          response.index = k;
-          response.cost = 0.0;
+          float cost = score_affine_sample(function, status, A, center, order, bounds, ws.global_elite);
 
-          for (int j = 0; j < status.size(); j++)
-            {
-              // TODO: optimize this part (tp = A*point + (I-A)*center = A*point + dconst)
-              Point2f tp = transform_point(status.get_position(j), A, center);
-              response.cost += function.response(j, tp);
-            }
-          response.cost *= function.normalization();
-          sampled_positions[k] = response;
+          if (cost < 0)
+            ws.global_rejected++;
+          else
+            ws.global_elite.push(k, cost);
         }
 
       samples_count = params.min_samples;
-
-      // TODO: not all samples are needed : create a dynamic list of N elite samples data structure
-      qsort(sampled_positions, samples_count, sizeof(PatchCostPair), compare_patch_cost_pair);
+      ws.global_scored += params.min_samples;
 
       while (samples_count < params.max_samples)
         {
           // TODO: verify in CE algorithm (pg. 191)
-          if (gamma_low < sampled_positions[params.elite_samples].cost || gamma_high < sampled_positions[0].cost)
+          if (gamma_low < ws.global_elite.score(params.elite_samples) || gamma_high < ws.global_elite.score(0))
             {
-              gamma_low = sampled_positions[params.elite_samples].cost;
-              gamma_high = sampled_positions[1].cost;
+              gamma_low = ws.global_elite.score(params.elite_samples);
+              gamma_high = ws.global_elite.score(1);
               break;
             }
 
-          sample_gaussian2(globalM, globalC, params.add_samples, global_samples, samples_count);
+          ws.global_sequence.sample(mu, sigma, params.add_samples, global_samples, samples_count);
 
           // clamp the predicted scale
-          for (int k = 0; k < params.min_samples; k++)
+          for (int k = samples_count; k < samples_count + params.add_samples; k++)
             {
               global_samples.at<double>(k, 3) = CLAMP3(global_samples.at<double>(k, 3), sx_min, sx_max) ;
               global_samples.at<double>(k, 4) = CLAMP3(global_samples.at<double>(k, 4), sy_min, sy_max) ;
@@ -501,40 +752,30 @@ void cross_entropy_global_affine2(OptimizationStatus& status, ResponseFunction&
             {
               Matrix3f A = simple_affine_transformation(global_samples.at<double>(k, 0), global_samples.at<double>(k, 1),
                            global_samples.at<double>(k, 2), global_samples.at<double>(k, 3), global_samples.at<double>(k, 4));
-              PatchCostPair response;
-              response.index = k;
-              response.cost = 0.0;
 
-              for (int j = 0; j < status.size(); j++)
-                {
-                  Point2f tp = transform_point(status.get_position(j), A, center);
-                  response.cost += function.response(j, tp);
-                }
+              float cost = score_affine_sample(function, status, A, center, order, bounds, ws.global_elite);
 
-              response.cost *= function.normalization();
-              sampled_positions[k] = response;
+              if (cost < 0)
+                ws.global_rejected++;
+              else
+                ws.global_elite.push(k, cost);
             }
           samples_count += params.add_samples;
-
-          qsort(sampled_positions, samples_count, sizeof(PatchCostPair), compare_patch_cost_pair);
+          ws.global_scored += params.add_samples;
 
         }
 
-      for (int j = 0; j < params.elite_samples; j++)
-        {
-          Mat r = global_elite_samples.row(j);
-          global_samples.row(sampled_positions[j].index).copyTo(r);
-          global_elite_weights(j, 0) = sampled_positions[j].cost;
-        }
+      collect_elite(ws.global_elite, params.elite_samples, global_samples, ws.global_elite_samples,
+                    ws.global_elite_weights, elite_samples, elite_weights);
 
       // TODO: fail?
-      if (global_elite_weights(0, 0) == 0) global_elite_weights.setTo(1);
-
-      globalC = row_weighted_covariance(global_elite_samples, global_elite_weights);
+      if (elite_weights(0, 0) == 0) elite_weights.setTo(1);
 
-      globalM = row_weighted_mean(global_elite_samples, global_elite_weights);
+      weighted_mean_covariance(elite_samples, elite_weights, mu, sigma);
+      mu.store(globalM);
+      sigma.store(globalC);
 
-      double det = globalC.at<double>(0, 0) * globalC.at<double>(1, 1) - globalC.at<double>(1, 0) * globalC.at<double>(0, 1);
+      double det = globalC(0, 0) * globalC(1, 1) - globalC(1, 0) * globalC(0, 1);
 
       if (det < params.terminate || samples_count >= params.max_samples)
         {
@@ -547,8 +788,8 @@ void cross_entropy_global_affine2(OptimizationStatus& status, ResponseFunction&
         }
     }
 
-  Matrix3f A = simple_affine_transformation(globalM.at<double>(0, 0), globalM.at<double>(0, 1),
-               globalM.at<double>(0, 2), globalM.at<double>(0, 3), globalM.at<double>(0, 4));
+  Matrix3f A = simple_affine_transformation(globalM(0, 0), globalM(0, 1),
+               globalM(0, 2), globalM(0, 3), globalM(0, 4));
   for (int j = 0; j < status.size(); j++)
     {
       // TODO: optimize
@@ -556,10 +797,6 @@ void cross_entropy_global_affine2(OptimizationStatus& status, ResponseFunction&
       status.set(j, p, function.response(j, p));
     }
 
-
-
-  delete [] sampled_positions;
-
   if (i < params.iterations)
     {
       DEBUGMSG("Global iterations: %d\n", i);
@@ -568,358 +805,365 @@ void cross_entropy_global_affine2(OptimizationStatus& status, ResponseFunction&
     {
       DEBUGMSG("Warning: global optimization did not converge! \n");
     }
+
+  DEBUGMSG("Global samples: %d, rejected early: %d\n", ws.global_scored, ws.global_rejected);
 }
 
+// Visual response of a patch, evaluated directly on the image
+class DirectResponse
+{
+public:
+  DirectResponse(Image& image, PatchSet& patches) : image(image), patches(patches) {}
+  inline float operator()(int i, Point2f position) { return patches.response(image, i, position); }
+private:
+  Image& image;
+  PatchSet& patches;
+};
+
+// Visual response of a patch of a known type, the qualified call is resolved
+// at compile time
+template <class P>
+class PatchResponse
+{
+public:
+  PatchResponse(Image& image, PatchSet& patches) : image(image), patches(patches) {}
+  inline float operator()(int i, Point2f position)
+  {
+    return static_cast<P*>(patches.get_patch(i))->P::response(image, position);
+  }
+private:
+  Image& image;
+  PatchSet& patches;
+};
 
-/*
-void cross_entropy_global_affine2(ResponseMaps& patches, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, OptimizationStatus* status) {
+// Visual response of a patch, looked up in precomputed response maps
+class MapsResponse
+{
+public:
+  MapsResponse(ResponseMaps& maps) : maps(maps) {}
+  inline float operator()(int i, Point2f position) { return maps.value(i, position); }
+private:
+  ResponseMaps& maps;
+};
+
+// Shared state of a local optimization run
+struct LocalRefineContext
+{
+  PatchSet* patches;
+  CrossEntropyWorkspace* workspace;
+  CrossEntropyParameters* params;
+  OptimizationStatus* status;
+  float lambda_geometry;
+  float lambda_visual;
+};
+
+// One cross entropy iteration for a single patch. Neighbour positions are read
+// from the given array, only the state of the patch itself is written.
+template <class Response>
+static void refine_patch(int p, int i, LocalRefineContext& context, Response& response, LocalRefineScratch& scratch,
+                         const Point2f* neighbour_positions, tinymt32_t* random)
+{
 
-    for (int i = 0; i < patches.size(); i++) {
-        status[i].id = patches.get_id(i);
-        status[i].flags = 0;
-    }
+  CrossEntropyWorkspace& ws = *context.workspace;
+  CrossEntropyParameters& params = *context.params;
+  PatchSet& patches = *context.patches;
 
-    Matrix globalC = covariance;
-    Matrix globalM = mean;
+  Point2f* localM = ws.local_means;
+  Point2f* positions = ws.local_positions;
+  vector<int>& offsets = ws.neighbourhood_offsets;
+  vector<NeighbourConstraint>& neighbourhoods = ws.neighbourhoods;
+  Matrix& local_samples = scratch.samples;
+  Matrix local_elite_samples, local_elite_weights;
 
-    Point2f center = patches.mean_position();
+  // Patches that already match reasonably well get the smaller sample budget
+  int samples = (context.status->get(p).flags & OPTIMIZATION_REDUCED) ? params.reduced_samples : params.max_samples;
 
-    double gamma_low = 0;
-    double gamma_high = 0;
+  double* stored = ws.local_covariances.ptr<double>(p);
+  SmallMatrix<2, 2> localC(stored);
+  SmallVector<2> tempM;
 
-    PatchCostPair* sampled_positions = new PatchCostPair[params.max_samples];
+  tempM[0] = localM[p].x;
+  tempM[1] = localM[p].y;
 
-    Mat_<double> global_samples = Mat_<double>(params.max_samples, 5); // this matrix stores global CE parameters
-    Mat_<double> global_elite_samples = Mat_<double>(params.elite_samples, 5); // this matrix stores elite global CE parameters
-    Mat_<double> global_elite_weights = Mat_<double>(params.elite_samples, 1); // this vector stores elite global CE weighths / responses
+  Point2f neighborhoodSuggest(localM[p].x, localM[p].y);
 
-    // Number of global cross entropy iterations ...
-    int i;
-    for (i = 0; i < params.iterations; i++) {
-        int count = patches.size();
-
-        int samples_count = 0;
-        sample_gaussian(globalM, globalC, params.min_samples, global_samples, samples_count);
-
-        for (int k = 0; k < params.min_samples; k++) {
-            Matrix3f A = simple_affine_transformation(global_samples.at<double>(k, 0), global_samples.at<double>(k, 1),
-                    global_samples.at<double>(k, 2), global_samples.at<double>(k, 3), global_samples.at<double>(k, 4));
-            PatchCostPair response; response.index = k; response.cost = 0;
-            for (int j = 0; j < patches.size(); j++) {
-                Point2f tp = transform_point(patches.get_relative_position(j, center), A);
-                tp.x += center.x; tp.y += center.y;
-                float cost = exp(- patches.response(j, tp));
-                response.cost += isinf(cost) || isnan(cost) ? 0 : cost * patches.get_weight(j);
-            }
-                if (isinf(response.cost) || isnan(response.cost)) {
-                    for (int j = 0; j < patches.size(); j++) {
-                        Point2f tp = transform_point(patches.get_relative_position(j, center), A);
-                        tp.x += center.x; tp.y += center.y;
-                        double c = exp(- patches.response(j, tp));
-                        DEBUGMSG("%d - %d %f \n", i, j, c);
-                    }
-                }
-            sampled_positions[k] = response;
-        }
+  int neighbours = offsets[p + 1] - offsets[p];
 
-        samples_count = params.min_samples;
+  if (neighbours > 2)
+    {
 
-        qsort(sampled_positions, samples_count, sizeof(PatchCostPair), compare_patch_cost_pair);
+      for (int n = 0; n < neighbours; n++)
+        {
+          NeighbourConstraint& constraint = neighbourhoods[offsets[p] + n];
+          scratch.affine_from[n] = positions[constraint.index];
+          scratch.affine_to[n] = neighbour_positions[constraint.index];
+          scratch.affine_weights[n] = patches.get_weight(constraint.index) * constraint.weight;
+        }
 
-        while (samples_count < params.max_samples) {
+      Matrix3f t = compute_affine_transformation(scratch.affine_from, scratch.affine_to, scratch.affine_weights, neighbours);
 
-            if (gamma_low < sampled_positions[params.elite_samples].cost || gamma_high < sampled_positions[0].cost) {
-                gamma_low = sampled_positions[params.elite_samples].cost;
-                gamma_high = sampled_positions[1].cost;
-                break;
-            }
+      neighborhoodSuggest = transform_point(positions[p], t);
 
-            sample_gaussian(globalM, globalC, params.add_samples, global_samples, samples_count);
+    }
 
-            for (int k = samples_count; k < samples_count + params.add_samples; k++) {
-                Matrix3f A = simple_affine_transformation(global_samples.at<double>(k, 0), global_samples.at<double>(k, 1),
-                        global_samples.at<double>(k, 2), global_samples.at<double>(k, 3), global_samples.at<double>(k, 4));
-                PatchCostPair response; response.index = k; response.cost = 0;
+  scratch.sequence.reset(params.sampling, 2, random);
+  scratch.sequence.sample(tempM, localC, samples, local_samples, 0, random);
 
-                for (int j = 0; j < patches.size(); j++) {
-                    Point2f tp = transform_point(patches.get_relative_position(j, center), A);
-                    tp.x += center.x; tp.y += center.y;
-                    float cost = exp(- patches.response(j, tp));
-                    response.cost += isinf(cost) || isnan(cost) ? 0 : cost * patches.get_weight(j);
-                }
+  scratch.elite.flush();
 
-                if (isinf(response.cost) || isnan(response.cost)) {
-                    for (int j = 0; j < patches.size(); j++) {
-                        Point2f tp = transform_point(patches.get_relative_position(j, center), A);
-                        tp.x += center.x; tp.y += center.y;
-                        double c = exp(- patches.response(j, tp));
-                        DEBUGMSG("%d - %d %f \n", i, j, c);
-                    }
-                }
+  for (int s = 0; s < samples; s++)
+    {
+      Point2f tp;
+      tp.x = (float)local_samples(s, 0);
+      tp.y = (float)local_samples(s, 1);
 
-                sampled_positions[k] = response;
-            }
-            samples_count += params.add_samples;
+      float d = distance(neighborhoodSuggest - tp);
+      float cost = exp(- response(p, tp) * context.lambda_visual) * exp(-d * context.lambda_geometry);
 
-            qsort(sampled_positions, samples_count, sizeof(PatchCostPair), compare_patch_cost_pair);
+      DEBUGGING
+      {
+        if (isnan(cost) || cost == 0)
+          {
+            DEBUGMSG("%d %d %d - %f %f, %f %f - %f \n", i, p, s, tp.x, tp.y, neighborhoodSuggest.x, neighborhoodSuggest.y, d);
+            cost = 0;
+          }
+      }
 
-        }
+      scratch.elite.push(s, cost);
+    }
 
-        for (int j = 0; j < params.elite_samples; j++) {
-            Mat r = global_elite_samples.row(j);
-            global_samples.row(sampled_positions[j].index).copyTo(r);
-            global_elite_weights(j, 0) = sampled_positions[j].cost;
-            DEBUGMSG("%d %d - %f \n", i, j, sampled_positions[j].cost);
-        }
+  collect_elite(scratch.elite, params.elite_samples, local_samples, scratch.elite_samples,
+                scratch.elite_weights, local_elite_samples, local_elite_weights);
 
-        if (global_elite_weights(0, 0) == 0) global_elite_weights.setTo(1);
+  if (local_elite_weights(0, 0) == 0) local_elite_weights.setTo(1);
 
-        globalC = row_weighted_covariance(global_elite_samples, global_elite_weights);
+  weighted_mean_covariance(local_elite_samples, local_elite_weights, tempM, localC);
+  memcpy(stored, localC.data, sizeof(localC.data));
 
-        globalM = row_weighted_mean(global_elite_samples, global_elite_weights);
+  localM[p].x = tempM[0];
+  localM[p].y = tempM[1];
 
-        double det = globalC.at<double>(0, 0) * globalC.at<double>(1, 1) - globalC.at<double>(1, 0) * globalC.at<double>(0, 1);
+  double det = determinant(localC);
 
-        if (det < params.terminate || samples_count >= params.max_samples) {
-            for (int j = 0; j < patches.size(); j++) {
-                status[j].iterations = i;
-                status[j].flags |= OPTIMIZATION_CONVERGED;
-            }
+  context.status->set(p, localM[p]);
 
-            break;
-        }
+  if (det < params.terminate)
+    {
+      context.status->converged(p, i);
+      ws.local_done[p] = true;
     }
 
-    Matrix3f A = simple_affine_transformation(globalM.at<double>(0, 0), globalM.at<double>(0, 1),
-            globalM.at<double>(0, 2), globalM.at<double>(0, 3), globalM.at<double>(0, 4));
-    for (int j = 0; j < patches.size(); j++) {
-        status[j].position = transform_point(patches.get_relative_position(j, center), A);
-        status[j].position.x += center.x; status[j].position.y += center.y;
-        status[j].value = exp(- patches.response(j, status[j].position));
-    }
+}
 
-	delete [] sampled_positions;
+// Refines all active patches of an iteration against the positions of the
+// previous iteration
+template <class Response>
+class LocalRefineTask : public WorkerTask
+{
+public:
+  LocalRefineTask(LocalRefineContext& context, Response& response) : context(context), response(response), iteration(0) {}
 
-    if (i < params.iterations) {
-        DEBUGMSG("Global iterations: %d\n", i);
-    } else {
-        DEBUGMSG("Warning: global optimization did not converge! \n");
-    }
-}
-*/
+  void set_iteration(int i)
+  {
+    iteration = i;
+  }
 
-void cross_entropy_local_refine(Image& image, PatchSet& patches, Constraints& constraints, float covariance, float lambda_geometry, float lambda_visual,
-                                CrossEntropyParameters params, OptimizationStatus& status)
+  virtual void execute(int begin, int end)
+  {
+    execute(begin, end, 0);
+  }
+
+  virtual void execute(int begin, int end, int chunk)
+  {
+    CrossEntropyWorkspace& ws = *context.workspace;
+    LocalRefineScratch& scratch = ws.get_local_scratch(chunk);
+
+    for (int p = begin; p < end; p++)
+      {
+        if (ws.local_done[p]) continue;
+        refine_patch(p, iteration, context, response, scratch, ws.local_previous, &(ws.local_streams[p]));
+      }
+  }
+
+private:
+  LocalRefineContext& context;
+  Response& response;
+  int iteration;
+};
+
+template <class Response>
+static void local_refine(Image& image, PatchSet& patches, Response& response, Constraints& constraints, float covariance, float lambda_geometry, float lambda_visual,
+                         CrossEntropyParameters& params, OptimizationStatus& status, WorkerPool* pool, CrossEntropyWorkspace* workspace, Matrix* covariances)
 {
 
-  status.reset();
+  // Scheduling decisions are made before the refinement
+  status.reset(OPTIMIZATION_FIXED | OPTIMIZATION_REDUCED);
+
+  if (patches.size() < 4) return;
 
-  /*for (int i = 0; i < patches.size(); i++) {
-      status[i].id = patches.get_id(i);
-      status[i].flags ^= OPTIMIZATION_CONVERGED;
-  }*/
+  CrossEntropyWorkspace temporary_workspace;
+  CrossEntropyWorkspace& ws = workspace ? *workspace : temporary_workspace;
 
-  int samples = params.min_samples;
+  ws.prepare_local(params, patches.size(), pool ? pool->size() : 1);
 
   int i;
-  vector<Matrix> localC;
-  Point2f *localM = new Point2f[patches.size()];
-  Point2f *positions = new Point2f[patches.size()];
-  bool* done = new bool[patches.size()];
-  vector<vector<NeighbourConstraint> > neighborhoods;
-  Matrix tempM = (Matrix(1, 2) << 0, 0);
-  Matrix tempC = (Matrix(2, 2) << 0, 0, 0, 0);
-  Mat_<double> local_samples = Mat_<double>(samples, 2); // this matrix stores local CE parameters
-  Mat_<double> local_elite_samples = Mat_<double>(params.elite_samples, 2); // this matrix stores elite local CE parameters
-  Mat_<double> local_elite_weights = Mat_<double>(params.elite_samples, 1); // this vector stores elite local CE weighths / responses
-  PatchCostPair* local_sampled_positions = new PatchCostPair[samples];
-  vector<Point2f> affine_from;
-  vector<Point2f> affine_to;
-  vector<float> affine_weights;
+  Point2f *localM = ws.local_means;
+  Point2f *positions = ws.local_positions;
+  bool* done = ws.local_done;
+  vector<int>& offsets = ws.neighbourhood_offsets;
+  vector<NeighbourConstraint>& neighbourhoods = ws.neighbourhoods;
+
+  LocalRefineContext context;
+  context.patches = &patches;
+  context.workspace = &ws;
+  context.params = &params;
+  context.status = &status;
+  context.lambda_geometry = lambda_geometry;
+  context.lambda_visual = lambda_visual;
 
 #ifdef BUILD_DEBUG
   Canvas* debug = get_canvas("optimization");
 #endif
 
-  if (patches.size() < 4) return;
-
   int fixed = 0;
 
   for (i = 0; i < patches.size(); i++)
     {
       localM[i] = patches.get_position(i);
       assert(!isnan(localM[i].x) && !isnan(localM[i].y));
+
+      // Covariance of the patch, stored row-wise as a 2x2 matrix
+      double* C = ws.local_covariances.ptr<double>(i);
+      C[1] = 0;
+      C[2] = 0;
+
       if (status.get(i).flags & OPTIMIZATION_FIXED)
         {
           fixed++;
-          localC.push_back(Mat::diag( (Mat_<double>(2, 1) << 0, 0)));
+          C[0] = C[3] = 0;
           done[i] = true;
         }
       else
         {
-          localC.push_back(Mat::diag( (Mat_<double>(2, 1) << covariance, covariance)));
+          if (covariances)
+            {
+              // Initial covariance given per patch, e.g. from the previous frame
+              memcpy(C, covariances->ptr<double>(i), sizeof(double) * 4);
+            }
+          else
+            C[0] = C[3] = covariance;
           done[i] = false;
         }
       positions[i] = localM[i];
-      neighborhoods.push_back(vector<NeighbourConstraint>());
     }
 
   DEBUGMSG("Locally fixed patches: %d\n", fixed);
 
-  for (i = 0; i < patches.size(); i++)
-    {
-
-      for (int j = 0; j < patches.size(); j++)
-        {
-          float weight = constraints.constraint(i, j);
-
-          if (weight > 0)
-            {
-              NeighbourConstraint constraint;
-              constraint.index = j;
-              constraint.weight = weight;
-              neighborhoods[i].push_back(constraint);
-            }
-        }
-    }
-
-  // Number of local cross entropy iterations ...
-  for (i = 0; i < params.iterations; i++)
+  if (!constraints.neighbourhoods(offsets, neighbourhoods))
     {
 
-      bool alldone = true;
+      offsets.clear();
+      neighbourhoods.clear();
 
-      for (int p = 0; p < patches.size(); p++)
+      for (i = 0; i < patches.size(); i++)
         {
 
-          if (done[p])
-            continue;
-          else alldone = false;
-
-          tempM << localM[p].x, localM[p].y;
-          tempC = localC[p];
-
-          Point2f neighborhoodSuggest(localM[p].x, localM[p].y);
+          offsets.push_back(neighbourhoods.size());
 
-          if (neighborhoods[p].size() > 2)
+          for (int j = 0; j < patches.size(); j++)
             {
+              float weight = constraints.constraint(i, j);
 
-              affine_from.clear();
-              affine_to.clear();
-              affine_weights.clear();
-
-              for (int n = 0; n < neighborhoods[p].size(); n++)
+              if (weight > 0)
                 {
-                  affine_from.push_back(positions[neighborhoods[p][n].index]);
-                  affine_to.push_back(localM[neighborhoods[p][n].index]);
-                  affine_weights.push_back(patches.get_weight(neighborhoods[p][n].index) * neighborhoods[p][n].weight);
+                  NeighbourConstraint constraint;
+                  constraint.index = j;
+                  constraint.weight = weight;
+                  neighbourhoods.push_back(constraint);
                 }
-
-              Matrix3f t = compute_affine_transformation(affine_from, affine_to, affine_weights);
-
-              neighborhoodSuggest = transform_point(positions[p], t);
-
             }
+        }
 
-          sample_gaussian2(tempM, localC[p], samples, local_samples, 0);
-
-          /*double* mu_direct = (double *) tempM.data;
-
-          if(isnan(mu_direct[0]) ||isinf(mu_direct[0])||mu_direct[0]==0){
-          		float sdf=0 ;
-          	}*/
+      offsets.push_back(neighbourhoods.size());
 
-          for (int s = 0; s < samples; s++)
-            {
-              Point2f tp;
-              tp.x = (float)local_samples(s, 0);
-              tp.y = (float)local_samples(s, 1);
-
-              float d = distance(neighborhoodSuggest - tp);
-              local_sampled_positions[s].cost = exp(- patches.response(image, p, tp) * lambda_visual) * exp(-d * lambda_geometry);
-              local_sampled_positions[s].index = s;
-
-              DEBUGGING
-              {
-                if (isnan(local_sampled_positions[s].cost ) || local_sampled_positions[s].cost == 0)
-                  {
-                    DEBUGMSG("%d %d %d - %f %f, %f %f - %f \n", i, p, s, tp.x, tp.y, neighborhoodSuggest.x, neighborhoodSuggest.y, d);
-                    local_sampled_positions[s].cost = 0;
-                  }
-              }
-            }
+    }
 
-          qsort(local_sampled_positions, samples, sizeof(PatchCostPair), compare_patch_cost_pair);
-//if (i == 0)printf("P %d\n", p);
-          for (int j = 0; j < params.elite_samples; j++)
-            {
-              Mat r = local_elite_samples.row(j);
-              local_samples.row(local_sampled_positions[j].index).copyTo(r);
-              local_elite_weights(j, 0) = local_sampled_positions[j].cost;
+  LocalRefineTask<Response> task(context, response);
 
-//if (i == 0)
-//printf("%f , %f, %f;\n", local_elite_samples(j, 0), local_elite_samples(j, 1), local_sampled_positions[j].cost);
-            }
-
-          if (local_elite_weights(0, 0) == 0) local_elite_weights.setTo(1);
+  if (pool)
+    {
+      // Every patch gets its own random stream, seeded from the global generator
+      uint32_t seed = (uint32_t) (RANDOM_UNIFORM * 4294967295.0);
+      for (int p = 0; p < patches.size(); p++)
+        tinymt32_init(&(ws.local_streams[p]), seed + 2654435761U * (uint32_t) p);
 
-          tempC = row_weighted_covariance(local_elite_samples, local_elite_weights);
+      // Responses are evaluated concurrently, image formats have to be ready
+      patches.prepare(image);
+    }
 
-          tempM = row_weighted_mean(local_elite_samples, local_elite_weights);
+  // Number of local cross entropy iterations ...
+  for (i = 0; i < params.iterations; i++)
+    {
 
-          localM[p].x = tempM(0, 0);
-          localM[p].y = tempM(0, 1);
-          localC[p] = tempC;
+      bool alldone = true;
 
+      for (int p = 0; p < patches.size(); p++)
+        alldone &= done[p];
 
+      if (alldone)
+        break;
 
-          double det = determinant(tempC);
+      if (pool)
+        {
+          memcpy(ws.local_previous, localM, sizeof(Point2f) * patches.size());
+          task.set_iteration(i);
+          pool->run(task, patches.size());
+        }
+      else
+        {
+          for (int p = 0; p < patches.size(); p++)
+            {
 
-          status.set(p, localM[p]);
+              if (done[p])
+                continue;
 
-          if (det < params.terminate)
-            {
-              status.converged(p, i);
-              done[p] = true;
-            }
+              refine_patch(p, i, context, response, ws.get_local_scratch(0), localM, NULL);
 
 #ifdef BUILD_DEBUG
 
-          if (debug->get_zoom() > 0)
-            {
-              Mat gray = image.get_gray();
-              debug->draw(gray);
-
-              Point2f p1 = localM[p];
-              for (int n = 0; n < neighborhoods[p].size(); n++)
+              if (debug->get_zoom() > 0)
                 {
-                  Point2f p2 = localM[neighborhoods[p][n].index];
-                  debug->line(p1, p2, COLOR_RED);
-                }
+                  Mat gray = image.get_gray();
+                  debug->draw(gray);
+
+                  Point2f p1 = localM[p];
+                  for (int n = offsets[p]; n < offsets[p + 1]; n++)
+                    {
+                      Point2f p2 = localM[neighbourhoods[n].index];
+                      debug->line(p1, p2, COLOR_RED);
+                    }
 
-              for (int j = 0; j < patches.size(); j++)
-                {
-                  Point2f p = localM[j];
-                  debug->cross(p, COLOR_GREEN);
-                }
+                  for (int j = 0; j < patches.size(); j++)
+                    {
+                      Point2f p = localM[j];
+                      debug->cross(p, COLOR_GREEN);
+                    }
 
-              debug->text(cv::Point(3, 13), string("Local optimization, step: ") + as_string(i), COLOR_RED);
+                  debug->text(cv::Point(3, 13), string("Local optimization, step: ") + as_string(i), COLOR_RED);
 
 
-              debug->push();
-            }
+                  debug->push();
+                }
 #endif
 
+            }
         }
 
-      if (alldone)
-        break;
-
     }
 
   for (int j = 0; j < patches.size(); j++)
     {
-      status.value(j, exp(-patches.response(image, j, status.get_position(j))));
+      status.value(j, exp(-response(j, status.get_position(j))));
     }
 
 
@@ -934,11 +1178,36 @@ void cross_entropy_local_refine(Image& image, PatchSet& patches, Constraints& co
       DEBUGMSG("Warning: local optimization did not converge entierly (%d/%d) \n", converged, patches.size());
     }
 
-  delete [] localM;
-  delete [] positions;
-  delete [] local_sampled_positions;
-  delete [] done;
 }
+
+void cross_entropy_local_refine(Image& image, PatchSet& patches, Constraints& constraints, float covariance, float lambda_geometry, float lambda_visual,
+                                CrossEntropyParameters params, OptimizationStatus& status, WorkerPool* pool, CrossEntropyWorkspace* workspace, Matrix* covariances)
+{
+  DirectResponse response(image, patches);
+  local_refine(image, patches, response, constraints, covariance, lambda_geometry, lambda_visual, params, status, pool, workspace, covariances);
+}
+
+void cross_entropy_local_refine(ResponseMaps& maps, PatchSet& patches, Constraints& constraints, float covariance, float lambda_geometry, float lambda_visual,
+                                CrossEntropyParameters params, OptimizationStatus& status, WorkerPool* pool, CrossEntropyWorkspace* workspace, Matrix* covariances)
+{
+  MapsResponse response(maps);
+  local_refine(maps.get_image(), patches, response, constraints, covariance, lambda_geometry, lambda_visual, params, status, pool, workspace, covariances);
+}
+
+template <class P>
+void cross_entropy_local_refine(Image& image, PatchSet& patches, Constraints& constraints, float covariance, float lambda_geometry, float lambda_visual,
+                                CrossEntropyParameters params, OptimizationStatus& status, WorkerPool* pool, CrossEntropyWorkspace* workspace, Matrix* covariances)
+{
+  PatchResponse<P> response(image, patches);
+  local_refine(image, patches, response, constraints, covariance, lambda_geometry, lambda_visual, params, status, pool, workspace, covariances);
+}
+
+template void cross_entropy_local_refine<HistogramPatch>(Image& image, PatchSet& patches, Constraints& constraints, float covariance, float lambda_geometry, float lambda_visual,
+    CrossEntropyParameters params, OptimizationStatus& status, WorkerPool* pool, CrossEntropyWorkspace* workspace, Matrix* covariances);
+
+template void cross_entropy_local_refine<SSDPatch>(Image& image, PatchSet& patches, Constraints& constraints, float covariance, float lambda_geometry, float lambda_visual,
+    CrossEntropyParameters params, OptimizationStatus& status, WorkerPool* pool, CrossEntropyWorkspace* workspace, Matrix* covariances);
+
 /*
 void cross_entropy_local_refine2(Image& image, PatchSet& patches, Constraints& constraints, float covariance, float lambda_geometry, float lambda_visual,
     CrossEntropyParameters params, OptimizationStatus* status) {
@@ -22,6 +22,10 @@
 #define LEGIT_OPTIMIZATION_CE
 
 #include "optimization.h"
+#include "maps.h"
+#include "common/utils/workers.h"
+#include "common/math/sequence.h"
+#include "../patches/batch.h"
 
 namespace legit
 {
@@ -32,8 +36,8 @@ namespace tracker
 class CrossEntropyParameters
 {
 public:
-  CrossEntropyParameters(int min_s, int max_s, int add_s, int elite_s, int iter, float term) : min_samples(min_s),
-    max_samples(max_s), add_samples(add_s), elite_samples(elite_s), iterations(iter), terminate(term) {};
+  CrossEntropyParameters(int min_s, int max_s, int add_s, int elite_s, int iter, float term, int sampl = SEQUENCE_RANDOM) : min_samples(min_s),
+    max_samples(max_s), add_samples(add_s), elite_samples(elite_s), iterations(iter), terminate(term), sampling(sampl), reduced_samples(max_s) {};
 
   int max_samples;
   int min_samples;
@@ -41,128 +45,270 @@ public:
   int elite_samples;
   int iterations;
   float terminate;
+  // Type of the sequence used to generate samples (SEQUENCE_RANDOM, SEQUENCE_HALTON or SEQUENCE_SOBOL)
+  int sampling;
+  // Samples of a local refinement for patches marked OPTIMIZATION_REDUCED
+  int reduced_samples;
 };
-/*
+typedef struct PatchCostPair_
+{
+  float cost;
+  int index;
+} PatchCostPair;
+
+
+/**
+    A bounded buffer that retains only the elements with the highest scores
+    in descending order. Elements with equal score keep the insertion order.
+    Storage only grows, so flushing and refilling it does not allocate.
+*/
 template <class T>
-class OrderedBoundedBuffer {
+class OrderedBoundedBuffer
+{
 private:
-    int last;
-    int _capacity;
-    int _limit;
-    bool full;
-    bool empty;
-    T *buffer;
-    float *scores;
-    int *previous;
+  int _size;
+  int _capacity;
+  int _allocated;
+  T *buffer;
+  float *scores;
 
-public:
-    /
-        capacity: current capacity
-        limit:  max size
-    /
-    OrderedBoundedBuffer(int capacity) {
-        _capacity = capacity;
-        full = false;
-        empty = true;
-        buffer = new T[capacity];
-        previous = new int[capacity];
-        scores = new float[capacity];
-        last = -1;
-        bottom = -1;
-    }
+  OrderedBoundedBuffer(const OrderedBoundedBuffer&) = delete;
+  OrderedBoundedBuffer& operator=(const OrderedBoundedBuffer&) = delete;
 
-    ~OrderedBoundedBuffer() {
+public:
+  /**
+      capacity: number of retained elements
+  */
+  OrderedBoundedBuffer(int capacity = 0) : _size(0), _capacity(0), _allocated(0), buffer(NULL), scores(NULL)
+  {
+    resize(capacity);
+  }
+
+  ~OrderedBoundedBuffer()
+  {
+    delete [] buffer;
+    delete [] scores;
+  }
+
+  void resize(int capacity)
+  {
+    if (capacity > _allocated)
+      {
         delete [] buffer;
         delete [] scores;
-        delete [] previous;
-    }
-
-    void push(T value, float score) {
+        buffer = new T[capacity];
+        scores = new float[capacity];
+        _allocated = capacity;
+      }
+
+    _capacity = MAX(0, capacity);
+    _size = 0;
+  }
+
+  bool push(T value, float score)
+  {
+    if (_capacity < 1)
+      return false;
+
+    if (_size == _capacity)
+      {
+        if (!(score > scores[_size - 1]))
+          return false;
+        _size--;
+      }
+
+    int i = _size;
+    while (i > 0 && scores[i - 1] < score)
+      {
+        buffer[i] = buffer[i - 1];
+        scores[i] = scores[i - 1];
+        i--;
+      }
+
+    buffer[i] = value;
+    scores[i] = score;
+    _size++;
+
+    return true;
+  }
+
+  inline T get(int i)
+  {
+    return buffer[i];
+  }
+
+  /**
+      Returns the score of the i-th best element or zero if there is no such element.
+  */
+  inline float score(int i)
+  {
+    return (i < _size) ? scores[i] : 0;
+  }
+
+  inline int size()
+  {
+    return _size;
+  }
+
+  inline bool is_full()
+  {
+    return _size == _capacity;
+  }
+
+  inline int capacity()
+  {
+    return _capacity;
+  }
+
+  inline void flush()
+  {
+    _size = 0;
+  }
 
-        if (!full) {
-        	int i = bottom;
-        	int j = -1;
+};
 
-        	bottom++;
-        	while (i != -1) {
-        		if (scores[i] > score)
-        			break;
-        		j = i;
-        		i = previous[i];
-        	}
+/**
+    Buffers used to refine a single patch in the local optimization. The
+    workspace keeps one per thread so that patches can be refined concurrently.
+*/
+class LocalRefineScratch
+{
+public:
+  LocalRefineScratch();
+  ~LocalRefineScratch();
 
-        	buffer[bottom] = value;
-        	scores[bottom] = score;
+  void prepare(CrossEntropyParameters& params, int patches);
 
-        	if (i != -1) {
-        		previous[bottom] = i;
-        		if (j != -1) previous[j] = bottom;
-        	} else {
-        		previous[bottom] = -1;
-        		if (j != -1) previous[j] = bottom;
-        	}
+  Matrix samples;
+  Matrix elite_samples;
+  Matrix elite_weights;
+  OrderedBoundedBuffer<int> elite;
 
+  Point2f* affine_from;
+  Point2f* affine_to;
+  float* affine_weights;
 
-            full = bottom == _capacity;
+  GaussianSequence sequence;
 
-        } else {
+private:
 
+  LocalRefineScratch(const LocalRefineScratch&) = delete;
+  LocalRefineScratch& operator=(const LocalRefineScratch&) = delete;
 
+  Matrix samples_storage;
+  Matrix elite_storage;
+  Matrix weights_storage;
+  int patches_size;
 
-        }
-    }
+};
 
-    int size() {
-        return full ? _capacity : last + 1;
-    }
+/**
+    Buffers used by the cross-entropy optimizers. A workspace is kept by the
+    tracker and reused between frames; its buffers only grow, so once they
+    have reached the size required by the parameters no further allocations
+    are made.
+*/
+class CrossEntropyWorkspace
+{
+public:
+  CrossEntropyWorkspace();
+  ~CrossEntropyWorkspace();
+
+  void prepare_global(CrossEntropyParameters& params, int dimensions);
+
+  void prepare_local(CrossEntropyParameters& params, int patches, int threads = 1);
+
+  inline LocalRefineScratch& get_local_scratch(int thread)
+  {
+    return *(local_scratch[thread]);
+  }
+
+  // Global optimization
+  Matrix global_samples;
+  Matrix global_elite_samples;
+  Matrix global_elite_weights;
+  Matrix global_mean;
+  Matrix global_covariance;
+  float* global_costs;
+  OrderedBoundedBuffer<int> global_elite;
+  PatchBatch global_batch;
+  GaussianSequence global_sequence;
+
+  // Patch order and score bounds for response functions
+  vector<int> global_order;
+  vector<float> global_bounds;
+  vector<pair<float, int> > global_sorted;
+
+  // Number of samples scored in the last global optimization and the number
+  // of them that were rejected before all patches were evaluated
+  int global_scored;
+  int global_rejected;
+
+  // Local optimization
+  Matrix local_covariances;
+
+  Point2f* local_means;
+  Point2f* local_previous;
+  Point2f* local_positions;
+  bool* local_done;
+  tinymt32_t* local_streams;
+
+  vector<int> neighbourhood_offsets;
+  vector<NeighbourConstraint> neighbourhoods;
 
-    bool is_full() {
-        return full;
-    }
+private:
 
-    int capacity() {
-        return _capacity;
-    }
+  CrossEntropyWorkspace(const CrossEntropyWorkspace&) = delete;
+  CrossEntropyWorkspace& operator=(const CrossEntropyWorkspace&) = delete;
 
-    void flush() {
-        last = -1;
-        full = false;
-    }
+  Matrix global_samples_storage;
+  Matrix global_elite_storage;
+  Matrix global_weights_storage;
+  Matrix global_covariance_storage;
+  int global_costs_size;
 
-    T* array() {
+  vector<LocalRefineScratch*> local_scratch;
+  int local_patches_size;
 
-        if (size() == 0)
-            return NULL;
+};
+void cross_entropy_global_move(Image& image, PatchSet& patches, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, OptimizationStatus& status, WorkerPool* pool = NULL, CrossEntropyWorkspace* workspace = NULL);
 
-        T* result = malloc(sizeof(T) * size());
+void cross_entropy_global_affine(Image& image, PatchSet& patches, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, SizeConstraints size_constraints, OptimizationStatus& status, WorkerPool* pool = NULL, CrossEntropyWorkspace* workspace = NULL);
 
-        int pos = start;
-        int i = 0;
-        while (pos != end) {
-            result[i] = buffer[pos];
+/**
+    Global searches for a set in which all the patches are of type P. Patches
+    that the batch can not evaluate directly are scored without virtual calls,
+    the functions are instantiated for HistogramPatch and SSDPatch.
+*/
+template <class P>
+void cross_entropy_global_move(Image& image, PatchSet& patches, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, OptimizationStatus& status, WorkerPool* pool = NULL, CrossEntropyWorkspace* workspace = NULL);
 
-            pos++;
-            i++;
+template <class P>
+void cross_entropy_global_affine(Image& image, PatchSet& patches, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, SizeConstraints size_constraints, OptimizationStatus& status, WorkerPool* pool = NULL, CrossEntropyWorkspace* workspace = NULL);
 
-            if (pos >= _capacity) {
-                pos = 0;
-            }
-        }
+void cross_entropy_global_affine2(OptimizationStatus& status, ResponseFunction& function, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, SizeConstraints size_constraints, CrossEntropyWorkspace* workspace = NULL);
 
-        return result;
-    }
 
-};
+/**
+    Refines the positions of individual patches. Without a worker pool the
+    patches are updated one after another within an iteration (Gauss-Seidel).
+    If a pool is given, all patches are refined concurrently against the
+    neighbour positions of the previous iteration (Jacobi), each with its own
+    random stream, so the result does not depend on the number of threads.
+    An optional matrix of initial covariances (one row-wise 2x2 matrix per
+    patch) replaces the isotropic initial covariance.
 */
-void cross_entropy_global_move(Image& image, PatchSet& patches, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, OptimizationStatus& status);
+void cross_entropy_local_refine(Image& image, PatchSet& patches, Constraints& constraints, float covariance, float lambda_geometry, float lambda_visual, CrossEntropyParameters params, OptimizationStatus& status, WorkerPool* pool = NULL, CrossEntropyWorkspace* workspace = NULL, Matrix* covariances = NULL);
 
-void cross_entropy_global_affine(Image& image, PatchSet& patches, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, SizeConstraints size_constraints, OptimizationStatus& status);
+void cross_entropy_local_refine(ResponseMaps& maps, PatchSet& patches, Constraints& constraints, float covariance, float lambda_geometry, float lambda_visual, CrossEntropyParameters params, OptimizationStatus& status, WorkerPool* pool = NULL, CrossEntropyWorkspace* workspace = NULL, Matrix* covariances = NULL);
 
-void cross_entropy_global_affine2(OptimizationStatus& status, ResponseFunction& function, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, SizeConstraints size_constraints);
-
-//void cross_entropy_global_affine2(ResponseMaps& patches, Matrix& mean, Matrix& covariance, CrossEntropyParameters params, OptimizationStatus* status);
-
-void cross_entropy_local_refine(Image& image, PatchSet& patches, Constraints& constraints, float covariance, float lambda_geometry, float lambda_visual, CrossEntropyParameters params, OptimizationStatus& status);
+/**
+    Local refinement for a set in which all the patches are of type P. The
+    responses are computed without virtual calls, the function is
+    instantiated for HistogramPatch and SSDPatch.
+*/
+template <class P>
+void cross_entropy_local_refine(Image& image, PatchSet& patches, Constraints& constraints, float covariance, float lambda_geometry, float lambda_visual, CrossEntropyParameters params, OptimizationStatus& status, WorkerPool* pool = NULL, CrossEntropyWorkspace* workspace = NULL, Matrix* covariances = NULL);
 
 //void cross_entropy_local_refine2(Image& image, PatchSet& patches, Constraints& constraints, float covariance, float lambda_geometry, float lambda_visual, CrossEntropyParameters params, OptimizationStatus* status);
 
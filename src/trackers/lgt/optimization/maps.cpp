@@ -0,0 +1,259 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#include "maps.h"
+
+namespace legit
+{
+
+namespace tracker
+{
+
+ResponseMaps::ResponseMaps() : image(NULL), patches(NULL), count(0), range(0), side(0), half_size(0), total_weight(0),
+  capacity(0), map_capacity(0), maps(NULL), origin_x(NULL), origin_y(NULL), weights(NULL), references(NULL)
+{
+
+}
+
+ResponseMaps::~ResponseMaps()
+{
+
+  delete [] maps;
+  delete [] origin_x;
+  delete [] origin_y;
+  delete [] weights;
+  delete [] references;
+
+}
+
+void ResponseMaps::reserve(int n, int s)
+{
+
+  if (n > capacity)
+    {
+      delete [] origin_x;
+      delete [] origin_y;
+      delete [] weights;
+      delete [] references;
+      origin_x = new int[n];
+      origin_y = new int[n];
+      weights = new float[n];
+      references = new HistogramRoots[n];
+      capacity = n;
+    }
+
+  if (n * s * s > map_capacity)
+    {
+      delete [] maps;
+      maps = new float[n * s * s];
+      map_capacity = n * s * s;
+    }
+
+}
+
+void ResponseMaps::update(Image& img, PatchSet& set, int r)
+{
+
+  image = &img;
+  patches = &set;
+  count = set.size();
+  range = MAX(0, r);
+  side = 2 * range + 1;
+  half_size = set.get_patch_size() >> 1;
+
+  reserve(count, side);
+
+  set.prepare(img);
+
+  gray = img.get_gray();
+
+  total_weight = 0;
+
+  for (int i = 0; i < count; i++)
+    {
+      Point2f p = set.get_position(i);
+      cv::Point origin(cvRound(p.x) - range, cvRound(p.y) - range);
+
+      origin_x[i] = origin.x;
+      origin_y[i] = origin.y;
+      weights[i] = set.get_weight(i);
+      total_weight += weights[i];
+
+      HistogramRoots* h = set.get_histogram_roots(i);
+
+      if (h && (h->size == HIST_SIZE_8 || h->size == HIST_SIZE_16 || h->size == HIST_SIZE_32))
+        {
+          references[i] = *h;
+
+          switch (h->size)
+            {
+            case HIST_SIZE_8:
+              compute_histogram_map<HIST_SIZE_8>(i, origin);
+              break;
+            case HIST_SIZE_32:
+              compute_histogram_map<HIST_SIZE_32>(i, origin);
+              break;
+            default:
+              compute_histogram_map<HIST_SIZE_16>(i, origin);
+              break;
+            }
+        }
+      else
+        {
+          references[i].data = NULL;
+          compute_direct_map(i, origin);
+        }
+    }
+
+}
+
+float ResponseMaps::direct(int i, cv::Point position)
+{
+
+  if (references[i].data)
+    {
+      switch (references[i].size)
+        {
+        case HIST_SIZE_8:
+          return histogram_distance<HIST_SIZE_8>(gray, position, half_size, references[i]);
+        case HIST_SIZE_32:
+          return histogram_distance<HIST_SIZE_32>(gray, position, half_size, references[i]);
+        default:
+          return histogram_distance<HIST_SIZE_16>(gray, position, half_size, references[i]);
+        }
+    }
+
+  return patches->response(*image, i, position);
+
+}
+
+void ResponseMaps::compute_direct_map(int i, cv::Point origin)
+{
+
+  float* map = &(maps[i * side * side]);
+
+  for (int v = 0; v < side; v++)
+    for (int u = 0; u < side; u++)
+      map[v * side + u] = direct(i, cv::Point(origin.x + u, origin.y + v));
+
+}
+
+template <int N>
+void ResponseMaps::compute_histogram_map(int i, cv::Point origin)
+{
+
+  float* map = &(maps[i * side * side]);
+
+  Histogram<N> histogram;
+
+  int h = half_size;
+
+  for (int v = 0; v < side; v++)
+    {
+      cv::Point position(origin.x, origin.y + v);
+
+      // The first position in a row is computed completely, the rest by
+      // moving the window one column to the right.
+      update_histogram<N>(gray, position, h, histogram);
+      map[v * side] = (1.0 - compare_histogram(histogram, references[i]));
+
+      int y1 = MAX(position.y - h, 0);
+      int y2 = MIN(position.y + h, gray.rows);
+
+      for (int u = 1; u < side; u++)
+        {
+          int x = origin.x + u;
+
+          if (h < 1)
+            {
+              update_histogram<N>(gray, cv::Point(x, position.y), h, histogram);
+            }
+          else
+            {
+              int removed = x - 1 - h;
+              int added = x - 1 + h;
+
+              if (removed >= 0 && removed < gray.cols)
+                for (int j = y1; j < y2; j++)
+                  histogram.data[gray.ptr<uchar>(j)[removed] >> (8 - HistogramPower<N>::value)]--;
+
+              if (added >= 0 && added < gray.cols)
+                for (int j = y1; j < y2; j++)
+                  histogram.data[gray.ptr<uchar>(j)[added] >> (8 - HistogramPower<N>::value)]++;
+
+              // Same as in update_histogram
+              int area = (MIN(x + h, gray.cols) - MAX(x - h, 0)) * (y2 - y1);
+              histogram.sum = MAX(area, 0);
+            }
+
+          map[v * side + u] = (1.0 - compare_histogram(histogram, references[i]));
+        }
+    }
+
+}
+
+float ResponseMaps::value(int i, Point2f position)
+{
+
+  float u = position.x - origin_x[i];
+  float v = position.y - origin_y[i];
+
+  if (u < 0 || v < 0 || u > side - 1 || v > side - 1)
+    return direct(i, position);
+
+  if (side < 2)
+    return maps[i];
+
+  int u0 = MIN((int) u, side - 2);
+  int v0 = MIN((int) v, side - 2);
+
+  float fu = u - u0;
+  float fv = v - v0;
+
+  const float* m = &(maps[i * side * side + v0 * side + u0]);
+
+  return (1 - fv) * ((1 - fu) * m[0] + fu * m[1]) + fv * ((1 - fu) * m[side] + fu * m[side + 1]);
+
+}
+
+float ResponseMaps::response(int i, Point2f position)
+{
+
+  return exp(- value(i, position)) * weights[i];
+
+}
+
+float ResponseMaps::normalization()
+{
+
+  return total_weight > 0 ? 1 / total_weight : 1;
+
+}
+
+float ResponseMaps::bound(int i)
+{
+
+  return MAX(0, weights[i]);
+
+}
+
+}
+
+}
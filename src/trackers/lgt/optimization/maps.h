@@ -0,0 +1,120 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#ifndef LEGIT_OPTIMIZATION_MAPS
+#define LEGIT_OPTIMIZATION_MAPS
+
+#include "optimization.h"
+
+namespace legit
+{
+
+namespace tracker
+{
+
+/**
+    Dense per-patch response maps computed once per frame over a square
+    search window around every patch. Histogram maps are computed with a
+    sliding window that only adds and removes one column of pixels per step.
+    Lookups are bilinear; positions outside of the window are evaluated
+    directly. Once updated, the maps are only read, so lookups can run
+    concurrently.
+
+    As a ResponseFunction the maps return the weighted visual similarity
+    exp(-response) of a patch, normalized by the sum of the weights.
+*/
+class ResponseMaps : public ResponseFunction
+{
+public:
+
+  ResponseMaps();
+
+  ~ResponseMaps();
+
+  void update(Image& image, PatchSet& patches, int range);
+
+  virtual float response(int i, Point2f position);
+
+  virtual float normalization();
+
+  virtual float bound(int i);
+
+  /**
+      Returns the response (distance) of the i-th patch at the given position.
+  */
+  float value(int i, Point2f position);
+
+  inline int size()
+  {
+    return count;
+  }
+
+  inline int get_range()
+  {
+    return range;
+  }
+
+  inline Image& get_image()
+  {
+    return *image;
+  }
+
+private:
+
+  ResponseMaps(const ResponseMaps&) = delete;
+  ResponseMaps& operator=(const ResponseMaps&) = delete;
+
+  void reserve(int patches, int side);
+
+  float direct(int i, cv::Point position);
+
+  template <int N>
+  void compute_histogram_map(int i, cv::Point origin);
+
+  void compute_direct_map(int i, cv::Point origin);
+
+  Image* image;
+  PatchSet* patches;
+
+  Mat gray;
+
+  int count;
+  int range;
+  int side;
+  int half_size;
+
+  float total_weight;
+
+  int capacity;
+  int map_capacity;
+
+  float* maps;
+  int* origin_x;
+  int* origin_y;
+  float* weights;
+  HistogramRoots* references;
+
+};
+
+}
+
+}
+
+#endif
@@ -22,7 +22,7 @@
 #include "common/gui/gui.h"
 
 #include "optimization.h"
-#include "../external/delaunay.h"
+#include <algorithm>
 
 namespace legit
 {
@@ -30,36 +30,50 @@ namespace legit
 namespace tracker
 {
 
-OptimizationStatus::OptimizationStatus(PatchSet& patches)
+OptimizationStatus::OptimizationStatus(PatchSet& patches) : dimension(patches.size()), statuses(new PatchStatus[patches.size()]), owned(true)
 {
 
-  statuses = new PatchStatus[patches.size()];
-  dimension = patches.size();
+  initialize(patches);
+
+}
+
+OptimizationStatus::OptimizationStatus(PatchSet& patches, FrameArena& arena) : dimension(patches.size()), statuses(arena.allocate<PatchStatus>(patches.size())), owned(false)
+{
+
+  initialize(patches);
+
+}
+
+OptimizationStatus::~OptimizationStatus()
+{
+
+  if (owned)
+    delete [] statuses;
+
+}
+
+void OptimizationStatus::initialize(PatchSet& patches)
+{
 
   for (int i = 0; i < dimension; i++)
     {
       statuses[i].id = patches.get_id(i);
       statuses[i].position = patches.get_position(i);
+      statuses[i].flags = 0;
     }
 
   reset();
-}
-
-OptimizationStatus::~OptimizationStatus()
-{
-
-  delete [] statuses;
 
 }
 
-void OptimizationStatus::reset()
+void OptimizationStatus::reset(int keep)
 {
 
   for (int i = 0; i < dimension; i++)
     {
       statuses[i].value = 0;
       statuses[i].iterations = 0;
-      statuses[i].flags = 0;
+      statuses[i].flags &= keep;
     }
 
 }
@@ -81,7 +95,7 @@ void OptimizationStatus::set_flags(int i, int mask)
 void OptimizationStatus::unset_flags(int i, int mask)
 {
 
-  statuses[i].flags &= !mask;
+  statuses[i].flags &= ~mask;
 
 }
 
@@ -148,72 +162,108 @@ void OptimizationStatus::print()
       if (statuses[i].flags & OPTIMIZATION_CONVERGED) printf("CONVERGED ");
       if (statuses[i].flags & OPTIMIZATION_FIXED) printf("FIXED ");
       if (statuses[i].flags & OPTIMIZATION_USED) printf("USED ");
+      if (statuses[i].flags & OPTIMIZATION_REDUCED) printf("REDUCED ");
       printf("]\n");
     }
 
 
+}
+
+DelaunayConstraints::DelaunayConstraints()
+{
+
 }
 
 DelaunayConstraints::DelaunayConstraints(PatchSet& patches)
 {
 
-  Point2f *positions = new Point2f[patches.size()];
-  vector<vector<int> > neighborhoods;
+  update(patches);
+
+}
+
+void DelaunayConstraints::update(PatchSet& patches)
+{
 
-  C = Mat_<double>(patches.size(),patches.size());
-  // C = Mat_<float>(patches.size(),patches.size());
+  int count = patches.size();
 
-  for (int i = 0; i < patches.size(); i++)
+  positions.resize(count);
+  ids.resize(count);
+
+  for (int i = 0; i < count; i++)
     {
       positions[i] = patches.get_position(i);
-      neighborhoods.push_back(vector<int>());
+      ids[i] = patches.get_id(i);
     }
 
   // determine neighborhoods using Delaunay triangulation
-  delaunay_neihgbours(positions, patches.size(), neighborhoods);
+  mesh.update(count ? &(positions[0]) : NULL, count ? &(ids[0]) : NULL, count);
+
+  const vector<int>& mesh_offsets = mesh.get_offsets();
+  const vector<int>& mesh_neighbours = mesh.get_neighbours();
+
+  offsets.resize(count + 1);
+  neighbours.clear();
 
-  float* D ;
-  D = new float[patches.size()];
   // add closest non-DT node to the neighborhood for nodes with only two neighbors
-  for (int i = 0; i < patches.size(); i++)   // KAKO DELUJE TA KODA?
+  for (int i = 0; i < count; i++)
     {
-      if (neighborhoods[i].size() > 2) continue; // tovrimo trikotnik na silo, èe sosed nima dveh sosedov
-      // kako prepreèimo kolinearnost izbranih treh toèk?
-      distances(positions[i], positions, patches.size(), D);
+      offsets[i] = neighbours.size();
+
+      int begin = mesh_offsets[i];
+      int end = mesh_offsets[i + 1];
+
+      neighbours.insert(neighbours.end(), mesh_neighbours.begin() + begin, mesh_neighbours.begin() + end);
+
+      if (end - begin > 2) continue;
 
       int minNode = -1;
       float minDistance = FLT_MAX;
 
-      for (int j = 0; j < patches.size(); j++)
+      for (int j = 0; j < count; j++)
         {
-          if (D[j] > 0 && j != neighborhoods[i][0] && j != neighborhoods[i][1] && D[j] < minDistance)
-            {
-              minNode = j;
-              minDistance = D[j];
-            }
-        }
-      if (minNode >= 0) neighborhoods[i].push_back(minNode);
-    }
+          float d = distance(positions[i] - positions[j]);
 
-  delete [] D;
+          if (d <= 0 || d >= minDistance) continue;
 
-  C.setTo(0.0);
-  for (int i = 0; i < neighborhoods.size(); i++)
-    {
-      for (int j = 0; j < neighborhoods[i].size(); j++)
-        {
-          C.at<double>(i, neighborhoods[i][j]) = 1.0;
+          if (std::find(mesh_neighbours.begin() + begin, mesh_neighbours.begin() + end, j) != mesh_neighbours.begin() + end)
+            continue;
+
+          minNode = j;
+          minDistance = d;
         }
+
+      if (minNode >= 0) neighbours.push_back(minNode);
     }
 
-  delete [] positions;
+  offsets[count] = neighbours.size();
+
+  DEBUGMSG("Delaunay neighbourhoods: %d edges, %d flips%s\n", (int) neighbours.size(), mesh.get_flips(), mesh.is_rebuilt() ? " (rebuilt)" : "");
 
 }
 
 float DelaunayConstraints::constraint(int i, int j)
 {
 
-  return (float)C.at<double>(i, j) ; //C.at<float>(i, j);
+  for (int n = offsets[i]; n < offsets[i + 1]; n++)
+    if (neighbours[n] == j) return 1;
+
+  return 0;
+
+}
+
+bool DelaunayConstraints::neighbourhoods(vector<int>& o, vector<NeighbourConstraint>& n)
+{
+
+  o.assign(offsets.begin(), offsets.end());
+  n.resize(neighbours.size());
+
+  for (size_t i = 0; i < neighbours.size(); i++)
+    {
+      n[i].index = neighbours[i];
+      n[i].weight = 1;
+    }
+
+  return true;
 
 }
 
@@ -26,13 +26,16 @@
 #include <opencv2/core/core.hpp>
 #include <vector>
 #include "../patches/patchset.h"
+#include "triangulation.h"
 #include "common/math/geometry.h"
 #include "common/math/statistics.h"
 #include "common/utils/utils.h"
+#include "common/utils/arena.h"
 
 #define OPTIMIZATION_FIXED 1
 #define OPTIMIZATION_CONVERGED 2
 #define OPTIMIZATION_USED 4
+#define OPTIMIZATION_REDUCED 8
 
 #define OPTIMIZATION_VISUAL_DEBUG 10
 
@@ -61,9 +64,16 @@ class OptimizationStatus
 {
 public:
   OptimizationStatus(PatchSet& patches);
+  /**
+      The statuses are placed in the frame arena and released with it.
+  */
+  OptimizationStatus(PatchSet& patches, FrameArena& arena);
   ~OptimizationStatus();
 
-  void reset();
+  /**
+      Clears the state of all elements, only the flags in the mask are kept.
+  */
+  void reset(int keep = 0);
   void set(int i, Point2f position, float value = -1, int iterations = -1, int flags = -1);
   void converged(int i, int iterations);
   void value(int i, float val);
@@ -81,8 +91,11 @@ public:
 
 private:
 
+  void initialize(PatchSet& patches);
+
   int dimension;
   PatchStatus* statuses;
+  bool owned;
 
 };
 
@@ -110,8 +123,22 @@ public:
 
   virtual float normalization() = 0;
 
+  /**
+      Upper bound of the response of the i-th element over all positions.
+  */
+  virtual float bound(int i)
+  {
+    return FLT_MAX;
+  };
+
 };
 
+typedef struct
+{
+  int index;
+  float weight;
+} NeighbourConstraint;
+
 class Constraints
 {
 public:
@@ -120,6 +147,16 @@ public:
 
   virtual float constraint(int i, int j) = 0;
 
+  /**
+      Sparse constraints can list the non-zero constraints of every element
+      directly (in compressed sparse row form), so that the users do not have
+      to query all pairs. Returns false if this is not supported.
+  */
+  virtual bool neighbourhoods(vector<int>& offsets, vector<NeighbourConstraint>& neighbourhoods)
+  {
+    return false;
+  };
+
 };
 
 class FlatConstraints : public Constraints
@@ -135,17 +172,35 @@ public:
 
 };
 
+/**
+    Neighbourhoods given by the Delaunay triangulation of the patch positions.
+    Points with less than three neighbours are additionally connected to the
+    closest point that is not their neighbour. The triangulation is kept
+    between updates and only repaired if the patches stay the same.
+*/
 class DelaunayConstraints : public Constraints
 {
 public:
 
+  DelaunayConstraints();
+
   DelaunayConstraints(PatchSet& patches);
 
+  void update(PatchSet& patches);
+
   virtual float constraint(int i, int j);
 
+  virtual bool neighbourhoods(vector<int>& offsets, vector<NeighbourConstraint>& neighbourhoods);
+
 private:
 
-  Matrix C;
+  DelaunayMesh mesh;
+
+  vector<Point2f> positions;
+  vector<int> ids;
+
+  vector<int> offsets;
+  vector<int> neighbours;
 
 };
 
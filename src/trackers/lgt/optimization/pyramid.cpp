@@ -0,0 +1,286 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#include <algorithm>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "pyramid.h"
+
+namespace legit
+{
+
+namespace tracker
+{
+
+static bool reference_less(const PyramidReference& a, const PyramidReference& b)
+{
+  return a.id < b.id;
+}
+
+template <int N>
+static void coarse_reference(Mat& image, cv::Point position, int half_size, PyramidReference& reference)
+{
+
+  Histogram<N> histogram;
+
+  update_histogram<N>(image, position, half_size, histogram);
+
+  for (int b = 0; b < N; b++)
+    reference.roots[b] = histogram_sqrt(histogram.data[b]);
+
+  reference.size = N;
+  reference.sum = histogram.sum;
+
+}
+
+PyramidResponse::PyramidResponse() : image(NULL), patches(NULL), scale(1), half_size(0), total_weight(0), stored_level(0)
+{
+
+}
+
+PyramidResponse::~PyramidResponse()
+{
+
+}
+
+void PyramidResponse::downsample(Image& img, cv::Rect region, int level)
+{
+
+  region = intersection(region, cv::Rect(0, 0, img.width(), img.height()));
+
+  Mat gray = img.get_gray();
+
+  offset = region.tl();
+  scale = 1;
+
+  if (region.width > 0 && region.height > 0)
+    coarse = gray(region);
+  else
+    coarse = Mat();
+
+  for (int l = 0; l < level && coarse.cols > 1 && coarse.rows > 1; l++)
+    {
+      Mat down;
+      pyrDown(coarse, down);
+      coarse = down;
+      scale *= 2;
+    }
+
+}
+
+PyramidReference* PyramidResponse::find(int id)
+{
+
+  PyramidReference key;
+  key.id = id;
+
+  vector<PyramidReference>::iterator it = std::lower_bound(stored.begin(), stored.end(), key, reference_less);
+
+  if (it == stored.end() || it->id != id)
+    return NULL;
+
+  return &(*it);
+
+}
+
+void PyramidResponse::update(Image& img, PatchSet& set, int level, cv::Rect region)
+{
+
+  image = &img;
+  patches = &set;
+
+  set.prepare(img);
+
+  downsample(img, region, level);
+
+  // The window keeps its size in pixels on the coarse level
+  half_size = MAX(1, set.get_patch_size() >> 1);
+
+  int count = set.size();
+
+  weights.resize(count);
+  references.resize(count);
+
+  total_weight = 0;
+
+  for (int i = 0; i < count; i++)
+    {
+      weights[i] = set.get_weight(i);
+      total_weight += weights[i];
+
+      PyramidReference* r = (level == stored_level && !coarse.empty()) ? find(set.get_id(i)) : NULL;
+
+      if (r)
+        {
+          references[i].data = r->roots;
+          references[i].size = r->size;
+          references[i].sum = r->sum;
+        }
+      else
+        references[i].data = NULL;
+    }
+
+}
+
+void PyramidResponse::remember(Image& img, PatchSet& set, int level)
+{
+
+  int count = set.size();
+
+  if (level != stored_level)
+    {
+      stored.clear();
+      stored_level = level;
+    }
+
+  identifiers.resize(count);
+
+  for (int i = 0; i < count; i++)
+    identifiers[i] = set.get_id(i);
+
+  std::sort(identifiers.begin(), identifiers.end());
+
+  // References of the removed patches are dropped, the order is kept
+  size_t kept = 0;
+
+  for (size_t k = 0; k < stored.size(); k++)
+    if (std::binary_search(identifiers.begin(), identifiers.end(), stored[k].id))
+      stored[kept++] = stored[k];
+
+  stored.resize(kept);
+
+  missing.clear();
+
+  Rect4f bounds;
+
+  for (int i = 0; i < count; i++)
+    {
+      HistogramRoots* h = set.get_histogram_roots(i);
+
+      if (!h || !(h->size == HIST_SIZE_8 || h->size == HIST_SIZE_16 || h->size == HIST_SIZE_32))
+        continue;
+
+      if (find(set.get_id(i)))
+        continue;
+
+      Point2f p = set.get_position(i);
+
+      if (missing.empty())
+        bounds = Rect4f(p.x, p.y, 0, 0);
+      else
+        {
+          float x2 = MAX(bounds.x + bounds.width, p.x);
+          float y2 = MAX(bounds.y + bounds.height, p.y);
+          bounds.x = MIN(bounds.x, p.x);
+          bounds.y = MIN(bounds.y, p.y);
+          bounds.width = x2 - bounds.x;
+          bounds.height = y2 - bounds.y;
+        }
+
+      missing.push_back(i);
+    }
+
+  if (missing.empty())
+    return;
+
+  half_size = MAX(1, set.get_patch_size() >> 1);
+
+  // Only the windows of the new patches are downsampled, with a margin for
+  // the smoothing kernel of every level
+  int margin = (half_size + 2) << level;
+
+  downsample(img, cv::Rect((int) bounds.x - margin, (int) bounds.y - margin,
+                           (int) bounds.width + 2 * margin + 1, (int) bounds.height + 2 * margin + 1), level);
+
+  if (coarse.empty())
+    return;
+
+  for (size_t m = 0; m < missing.size(); m++)
+    {
+      int i = missing[m];
+      Point2f position = set.get_position(i);
+      cv::Point p(cvRound((position.x - offset.x) / scale), cvRound((position.y - offset.y) / scale));
+
+      PyramidReference reference;
+      reference.id = set.get_id(i);
+
+      switch (set.get_histogram_roots(i)->size)
+        {
+        case HIST_SIZE_8:
+          coarse_reference<HIST_SIZE_8>(coarse, p, half_size, reference);
+          break;
+        case HIST_SIZE_32:
+          coarse_reference<HIST_SIZE_32>(coarse, p, half_size, reference);
+          break;
+        default:
+          coarse_reference<HIST_SIZE_16>(coarse, p, half_size, reference);
+          break;
+        }
+
+      stored.push_back(reference);
+    }
+
+  std::sort(stored.begin(), stored.end(), reference_less);
+
+}
+
+float PyramidResponse::value(int i, Point2f position)
+{
+
+  if (!references[i].data)
+    return patches->response(*image, i, position);
+
+  cv::Point p(cvRound((position.x - offset.x) / scale), cvRound((position.y - offset.y) / scale));
+
+  switch (references[i].size)
+    {
+    case HIST_SIZE_8:
+      return histogram_distance<HIST_SIZE_8>(coarse, p, half_size, references[i]);
+    case HIST_SIZE_32:
+      return histogram_distance<HIST_SIZE_32>(coarse, p, half_size, references[i]);
+    default:
+      return histogram_distance<HIST_SIZE_16>(coarse, p, half_size, references[i]);
+    }
+
+}
+
+float PyramidResponse::response(int i, Point2f position)
+{
+
+  return exp(- value(i, position)) * weights[i];
+
+}
+
+float PyramidResponse::normalization()
+{
+
+  return total_weight > 0 ? 1 / total_weight : 1;
+
+}
+
+float PyramidResponse::bound(int i)
+{
+
+  return MAX(0, weights[i]);
+
+}
+
+}
+
+}
@@ -0,0 +1,131 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#ifndef LEGIT_OPTIMIZATION_PYRAMID
+#define LEGIT_OPTIMIZATION_PYRAMID
+
+#include "optimization.h"
+
+namespace legit
+{
+
+namespace tracker
+{
+
+/**
+    Reference histogram of a patch on the coarse level of the pyramid.
+*/
+typedef struct
+{
+  int id;
+  int size;
+  int sum;
+  float roots[HIST_SIZE_32];
+} PyramidReference;
+
+/**
+    Visual responses of patches evaluated on a downsampled level of the
+    image. Positions are given in the coordinates of the full resolution
+    image and are mapped to the coarse level, where histogram patches are
+    compared over a window of the same size in pixels as at full resolution,
+    which covers a correspondingly larger part of the image. The reference
+    histograms for the coarse level are taken from the downsampled frame in
+    which a patch was added, patches without one are evaluated directly at
+    full resolution.
+
+    As a ResponseFunction it returns the weighted visual similarity
+    exp(-response) of a patch, normalized by the sum of the weights.
+*/
+class PyramidResponse : public ResponseFunction
+{
+public:
+
+  PyramidResponse();
+
+  ~PyramidResponse();
+
+  /**
+      Builds the given level of the image pyramid for the region of the image
+      that contains the patches and their search range.
+  */
+  void update(Image& image, PatchSet& patches, int level, cv::Rect region);
+
+  /**
+      Builds the coarse references of the patches that do not have one yet
+      from the given frame and forgets the ones of removed patches. Called
+      once a frame is processed, so that the references of new patches come
+      from the frame in which they were added.
+  */
+  void remember(Image& image, PatchSet& patches, int level);
+
+  virtual float response(int i, Point2f position);
+
+  virtual float normalization();
+
+  virtual float bound(int i);
+
+  /**
+      Returns the response (distance) of the i-th patch at the given position.
+  */
+  float value(int i, Point2f position);
+
+  inline float get_scale()
+  {
+    return scale;
+  }
+
+private:
+
+  PyramidResponse(const PyramidResponse&) = delete;
+  PyramidResponse& operator=(const PyramidResponse&) = delete;
+
+  void downsample(Image& image, cv::Rect region, int level);
+
+  PyramidReference* find(int id);
+
+  Image* image;
+  PatchSet* patches;
+
+  Mat coarse;
+  cv::Point offset;
+
+  float scale;
+  int half_size;
+
+  float total_weight;
+
+  vector<float> weights;
+  vector<HistogramRoots> references;
+
+  // Coarse references sorted by the patch identifier and the level they
+  // were built for
+  vector<PyramidReference> stored;
+  int stored_level;
+
+  vector<int> identifiers;
+  vector<int> missing;
+
+};
+
+}
+
+}
+
+#endif
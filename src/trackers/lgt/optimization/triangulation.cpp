@@ -0,0 +1,684 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#include <algorithm>
+#include "triangulation.h"
+
+namespace legit
+{
+
+namespace tracker
+{
+
+#define NEXT(k) (((k) + 1) % 3)
+#define PREV(k) (((k) + 2) % 3)
+
+DelaunayMesh::DelaunayMesh() : rebuilt(false), flips(0)
+{
+
+}
+
+DelaunayMesh::~DelaunayMesh()
+{
+
+}
+
+void DelaunayMesh::update(const Point2f* points, const int* identifiers, int count)
+{
+
+  int previous = (int) ids.size();
+
+  lookup.resize(count);
+
+  for (int i = 0; i < count; i++)
+    lookup[i] = std::make_pair(identifiers[i], i);
+
+  std::sort(lookup.begin(), lookup.end());
+
+  // New index of every old vertex, the removed vertices are placed after the
+  // new points and keep their old position until they are taken out
+  remap.resize(previous);
+  matched.assign(count, 0);
+
+  int removed = 0;
+
+  for (int i = 0; i < previous; i++)
+    {
+      vector<pair<int, int> >::iterator it = std::lower_bound(lookup.begin(), lookup.end(), std::make_pair(ids[i], -1));
+
+      if (it != lookup.end() && it->first == ids[i])
+        {
+          remap[i] = it->second;
+          matched[it->second] = 1;
+        }
+      else
+        remap[i] = count + removed++;
+    }
+
+  old_xs.swap(xs);
+  old_ys.swap(ys);
+
+  xs.resize(count + removed);
+  ys.resize(count + removed);
+
+  for (int i = 0; i < count; i++)
+    {
+      xs[i] = points[i].x;
+      ys[i] = points[i].y;
+    }
+
+  for (int i = 0; i < previous; i++)
+    {
+      if (remap[i] < count) continue;
+      xs[remap[i]] = old_xs[i];
+      ys[remap[i]] = old_ys[i];
+    }
+
+  for (size_t t = 0; t < triangles.size(); t++)
+    for (int k = 0; k < 3; k++)
+      triangles[t].v[k] = remap[triangles[t].v[k]];
+
+  ids.assign(identifiers, identifiers + count);
+
+  flips = 0;
+  rebuilt = triangles.empty() || !valid();
+
+  // The removed vertices are always the last ones, the mesh is repaired
+  // locally around each of them
+  for (int v = count + removed - 1; !rebuilt && v >= count; v--)
+    rebuilt = !remove_vertex(v);
+
+  if (!rebuilt && triangles.empty())
+    rebuilt = true;
+
+  if (!rebuilt)
+    {
+      // Points have moved a little, the hull has to be convex again before
+      // the new points are inserted
+      close_boundary();
+
+      for (int i = 0; !rebuilt && i < count; i++)
+        if (!matched[i]) rebuilt = !insert_vertex(i);
+    }
+
+  if (!rebuilt)
+    {
+      legalize();
+      rebuilt = !valid();
+    }
+
+  if (rebuilt)
+    {
+      xs.resize(count);
+      ys.resize(count);
+      build();
+    }
+
+  collect_neighbours();
+
+}
+
+double DelaunayMesh::orientation(int a, int b, int c)
+{
+
+  return (xs[b] - xs[a]) * (ys[c] - ys[a]) - (ys[b] - ys[a]) * (xs[c] - xs[a]);
+
+}
+
+// Positive if d lies inside the circumcircle of the counter-clockwise triangle (a, b, c)
+double DelaunayMesh::incircle(int a, int b, int c, int d)
+{
+
+  double adx = xs[a] - xs[d], ady = ys[a] - ys[d];
+  double bdx = xs[b] - xs[d], bdy = ys[b] - ys[d];
+  double cdx = xs[c] - xs[d], cdy = ys[c] - ys[d];
+
+  double ad = adx * adx + ady * ady;
+  double bd = bdx * bdx + bdy * bdy;
+  double cd = cdx * cdx + cdy * cdy;
+
+  return adx * (bdy * cd - bd * cdy) - ady * (bdx * cd - bd * cdx) + ad * (bdx * cdy - bdy * cdx);
+
+}
+
+bool DelaunayMesh::valid()
+{
+
+  for (size_t t = 0; t < triangles.size(); t++)
+    {
+      Triangle& tr = triangles[t];
+      if (orientation(tr.v[0], tr.v[1], tr.v[2]) <= 0)
+        return false;
+    }
+
+  return true;
+
+}
+
+void DelaunayMesh::build()
+{
+
+  int count = (int) xs.size();
+
+  triangles.clear();
+
+  if (count < 3)
+    return;
+
+  double x1 = xs[0], x2 = xs[0], y1 = ys[0], y2 = ys[0];
+
+  for (int i = 1; i < count; i++)
+    {
+      x1 = std::min(x1, xs[i]);
+      x2 = std::max(x2, xs[i]);
+      y1 = std::min(y1, ys[i]);
+      y2 = std::max(y2, ys[i]);
+    }
+
+  double d = std::max(std::max(x2 - x1, y2 - y1), 1.0) * 100;
+  double mx = (x1 + x2) / 2, my = (y1 + y2) / 2;
+
+  // Temporary super triangle that contains all the points
+  xs.push_back(mx - d);
+  ys.push_back(my - d);
+  xs.push_back(mx + d);
+  ys.push_back(my - d);
+  xs.push_back(mx);
+  ys.push_back(my + d);
+
+  Triangle super = {{count, count + 1, count + 2}, {-1, -1, -1}};
+  triangles.push_back(super);
+
+  for (int i = 0; i < count; i++)
+    {
+      bad.clear();
+      polygon.clear();
+
+      for (size_t t = 0; t < triangles.size(); t++)
+        {
+          Triangle& tr = triangles[t];
+          if (incircle(tr.v[0], tr.v[1], tr.v[2], i) > 0)
+            bad.push_back(t);
+        }
+
+      // Coincides with an existing point
+      if (bad.empty())
+        continue;
+
+      // Boundary of the cavity consists of the edges that are not shared by two bad triangles
+      for (size_t b = 0; b < bad.size(); b++)
+        {
+          Triangle& tr = triangles[bad[b]];
+          for (int k = 0; k < 3; k++)
+            {
+              int e1 = tr.v[NEXT(k)], e2 = tr.v[PREV(k)];
+              bool shared = false;
+
+              for (size_t o = 0; o < bad.size() && !shared; o++)
+                {
+                  if (o == b) continue;
+                  Triangle& other = triangles[bad[o]];
+                  for (int l = 0; l < 3; l++)
+                    if (other.v[NEXT(l)] == e2 && other.v[PREV(l)] == e1)
+                      shared = true;
+                }
+
+              if (!shared)
+                {
+                  polygon.push_back(e1);
+                  polygon.push_back(e2);
+                }
+            }
+        }
+
+      for (int b = (int) bad.size() - 1; b >= 0; b--)
+        {
+          triangles[bad[b]] = triangles.back();
+          triangles.pop_back();
+        }
+
+      for (size_t e = 0; e < polygon.size(); e += 2)
+        {
+          Triangle tr = {{polygon[e], polygon[e + 1], i}, {-1, -1, -1}};
+          triangles.push_back(tr);
+        }
+    }
+
+  for (int t = (int) triangles.size() - 1; t >= 0; t--)
+    {
+      Triangle& tr = triangles[t];
+      if (tr.v[0] >= count || tr.v[1] >= count || tr.v[2] >= count)
+        {
+          triangles[t] = triangles.back();
+          triangles.pop_back();
+        }
+    }
+
+  xs.resize(count);
+  ys.resize(count);
+
+  link();
+  close_boundary();
+  legalize();
+
+}
+
+// Takes the last vertex out of the mesh, the hole is filled by clipping the
+// ears of the polygon of its neighbours
+bool DelaunayMesh::remove_vertex(int v)
+{
+
+  bad.clear();
+  polygon.clear();
+
+  // Edges opposite to the vertex are oriented counter-clockwise around it
+  for (size_t t = 0; t < triangles.size(); t++)
+    for (int k = 0; k < 3; k++)
+      if (triangles[t].v[k] == v)
+        {
+          bad.push_back(t);
+          polygon.push_back(triangles[t].v[NEXT(k)]);
+          polygon.push_back(triangles[t].v[PREV(k)]);
+        }
+
+  int edges = (int) polygon.size() / 2;
+
+  if (edges > 0)
+    {
+      // A vertex on the hull has an open chain of neighbours
+      int start = 0, starts = 0;
+
+      for (int e = 0; e < edges; e++)
+        {
+          bool head = true;
+          for (int f = 0; f < edges && head; f++)
+            head = polygon[f * 2 + 1] != polygon[e * 2];
+
+          if (head)
+            {
+              start = e;
+              starts++;
+            }
+        }
+
+      if (starts > 1)
+        return false;
+
+      bool closed = starts == 0;
+
+      chain.clear();
+      chain.push_back(polygon[start * 2]);
+
+      int current = polygon[start * 2 + 1];
+
+      while ((int) chain.size() <= edges && !(closed && current == chain[0]))
+        {
+          chain.push_back(current);
+
+          int f = 0;
+          while (f < edges && polygon[f * 2] != current) f++;
+
+          if (f == edges) break;
+
+          current = polygon[f * 2 + 1];
+        }
+
+      if ((int) chain.size() != (closed ? edges : edges + 1))
+        return false;
+
+      for (int b = (int) bad.size() - 1; b >= 0; b--)
+        {
+          triangles[bad[b]] = triangles.back();
+          triangles.pop_back();
+        }
+
+      // Ears turn towards the removed vertex, an open chain is clipped until
+      // it is convex and becomes a part of the hull
+      while ((int) chain.size() > (closed ? 3 : 2))
+        {
+          int m = (int) chain.size();
+          bool clipped = false;
+
+          for (int i = closed ? 0 : 1; i < (closed ? m : m - 1) && !clipped; i++)
+            {
+              int a = chain[(i + m - 1) % m], b = chain[i], c = chain[(i + 1) % m];
+
+              if (orientation(a, b, c) <= 0) continue;
+
+              bool empty = true;
+              for (int j = 0; j < m && empty; j++)
+                {
+                  int q = chain[j];
+                  if (q == a || q == b || q == c) continue;
+                  empty = !(orientation(a, b, q) >= 0 && orientation(b, c, q) >= 0 && orientation(c, a, q) >= 0);
+                }
+
+              if (!empty) continue;
+
+              Triangle tr = {{a, b, c}, {-1, -1, -1}};
+              triangles.push_back(tr);
+              chain.erase(chain.begin() + i);
+              clipped = true;
+            }
+
+          if (!clipped)
+            {
+              if (closed) return false;
+              break;
+            }
+        }
+
+      if (closed)
+        {
+          if (orientation(chain[0], chain[1], chain[2]) <= 0)
+            return false;
+
+          Triangle tr = {{chain[0], chain[1], chain[2]}, {-1, -1, -1}};
+          triangles.push_back(tr);
+        }
+    }
+
+  xs.pop_back();
+  ys.pop_back();
+
+  link();
+
+  return true;
+
+}
+
+// Adds a point to a mesh with a convex hull, the point either splits the
+// triangle that contains it or is connected to the hull edges that it sees
+bool DelaunayMesh::insert_vertex(int p)
+{
+
+  int inside = -1;
+
+  for (size_t t = 0; t < triangles.size() && inside < 0; t++)
+    {
+      Triangle& tr = triangles[t];
+      double o0 = orientation(tr.v[0], tr.v[1], p);
+      double o1 = orientation(tr.v[1], tr.v[2], p);
+      double o2 = orientation(tr.v[2], tr.v[0], p);
+
+      if (o0 > 0 && o1 > 0 && o2 > 0)
+        inside = t;
+      else if (o0 >= 0 && o1 >= 0 && o2 >= 0)
+        return false; // On an edge or a vertex
+    }
+
+  if (inside >= 0)
+    {
+      Triangle tr = triangles[inside];
+      Triangle t0 = {{tr.v[0], tr.v[1], p}, {-1, -1, -1}};
+      Triangle t1 = {{tr.v[1], tr.v[2], p}, {-1, -1, -1}};
+      Triangle t2 = {{tr.v[2], tr.v[0], p}, {-1, -1, -1}};
+
+      triangles[inside] = t0;
+      triangles.push_back(t1);
+      triangles.push_back(t2);
+    }
+  else
+    {
+      size_t existing = triangles.size();
+      int added = 0;
+
+      for (size_t t = 0; t < existing; t++)
+        for (int k = 0; k < 3; k++)
+          {
+            if (triangles[t].n[k] >= 0) continue;
+
+            int a = triangles[t].v[NEXT(k)], b = triangles[t].v[PREV(k)];
+            double o = orientation(a, b, p);
+
+            if (o == 0) return false;
+            if (o > 0) continue;
+
+            Triangle tr = {{a, p, b}, {-1, -1, -1}};
+            triangles.push_back(tr);
+            added++;
+          }
+
+      if (!added) return false;
+    }
+
+  link();
+
+  return true;
+
+}
+
+void DelaunayMesh::link()
+{
+
+  long long count = (long long) xs.size();
+
+  edges.clear();
+
+  for (size_t t = 0; t < triangles.size(); t++)
+    {
+      for (int k = 0; k < 3; k++)
+        {
+          int a = triangles[t].v[NEXT(k)], b = triangles[t].v[PREV(k)];
+          Edge e;
+          e.key = std::min(a, b) * count + std::max(a, b);
+          e.triangle = t;
+          e.index = k;
+          edges.push_back(e);
+          triangles[t].n[k] = -1;
+        }
+    }
+
+  std::sort(edges.begin(), edges.end());
+
+  for (size_t i = 1; i < edges.size(); i++)
+    {
+      if (edges[i].key != edges[i - 1].key) continue;
+      triangles[edges[i].triangle].n[edges[i].index] = edges[i - 1].triangle;
+      triangles[edges[i - 1].triangle].n[edges[i - 1].index] = edges[i].triangle;
+    }
+
+}
+
+// Fills the concave parts of the boundary so that the mesh covers the convex hull
+void DelaunayMesh::close_boundary()
+{
+
+  int count = (int) xs.size();
+
+  vector<int>& next = boundary;
+  next.resize(count);
+
+  // Points that are not a part of the mesh yet do not block the filling
+  present.assign(count, 0);
+
+  for (size_t t = 0; t < triangles.size(); t++)
+    for (int k = 0; k < 3; k++)
+      present[triangles[t].v[k]] = 1;
+
+  for (int pass = 0; pass < count; pass++)
+    {
+      std::fill(next.begin(), next.end(), -1);
+
+      // Boundary edges are oriented counter-clockwise around the mesh
+      for (size_t t = 0; t < triangles.size(); t++)
+        for (int k = 0; k < 3; k++)
+          if (triangles[t].n[k] < 0)
+            next[triangles[t].v[NEXT(k)]] = triangles[t].v[PREV(k)];
+
+      bool added = false;
+
+      for (int a = 0; a < count; a++)
+        {
+          int b = next[a];
+          if (b < 0) continue;
+          int c = next[b];
+          if (c < 0 || c == a) continue;
+
+          if (orientation(a, b, c) >= 0) continue;
+
+          bool empty = true;
+          for (int i = 0; i < count && empty; i++)
+            {
+              if (i == a || i == b || i == c || !present[i]) continue;
+              empty = !(orientation(a, c, i) > 0 && orientation(c, b, i) > 0 && orientation(b, a, i) > 0);
+            }
+
+          if (!empty) continue;
+
+          Triangle tr = {{a, c, b}, {-1, -1, -1}};
+          triangles.push_back(tr);
+          next[a] = c;
+          next[b] = -1;
+          added = true;
+        }
+
+      if (!added) break;
+
+      link();
+    }
+
+}
+
+void DelaunayMesh::replace_neighbour(int t, int from, int to)
+{
+
+  if (t < 0) return;
+
+  for (int k = 0; k < 3; k++)
+    if (triangles[t].n[k] == from)
+      triangles[t].n[k] = to;
+
+}
+
+bool DelaunayMesh::flip(int t, int k)
+{
+
+  int u = triangles[t].n[k];
+
+  if (u < 0) return false;
+
+  int j = 0;
+  while (j < 3 && triangles[u].n[j] != t) j++;
+
+  if (j == 3) return false;
+
+  int a = triangles[t].v[k];
+  int b = triangles[t].v[NEXT(k)];
+  int c = triangles[t].v[PREV(k)];
+  int d = triangles[u].v[j];
+
+  if (incircle(a, b, c, d) <= 0)
+    return false;
+
+  // The quadrilateral has to be convex
+  if (orientation(a, b, d) <= 0 || orientation(a, d, c) <= 0)
+    return false;
+
+  int ca = triangles[t].n[NEXT(k)];
+  int ab = triangles[t].n[PREV(k)];
+  int bd = triangles[u].n[NEXT(j)];
+  int dc = triangles[u].n[PREV(j)];
+
+  Triangle t1 = {{a, b, d}, {bd, u, ab}};
+  Triangle t2 = {{a, d, c}, {dc, ca, t}};
+
+  triangles[t] = t1;
+  triangles[u] = t2;
+
+  replace_neighbour(bd, u, t);
+  replace_neighbour(ca, t, u);
+
+  stack.push_back(t * 3 + 0);
+  stack.push_back(t * 3 + 2);
+  stack.push_back(u * 3 + 0);
+  stack.push_back(u * 3 + 1);
+
+  return true;
+
+}
+
+void DelaunayMesh::legalize()
+{
+
+  stack.clear();
+
+  for (size_t t = 0; t < triangles.size(); t++)
+    for (int k = 0; k < 3; k++)
+      if (triangles[t].n[k] > (int) t)
+        stack.push_back(t * 3 + k);
+
+  // Lawson flips always terminate, the limit only guards against
+  // numerical problems with (nearly) cocircular points
+  int limit = (int) (triangles.size() * triangles.size()) + 16;
+
+  while (!stack.empty() && flips < limit)
+    {
+      int e = stack.back();
+      stack.pop_back();
+
+      if (flip(e / 3, e % 3))
+        flips++;
+    }
+
+}
+
+void DelaunayMesh::collect_neighbours()
+{
+
+  int count = (int) xs.size();
+
+  offsets.assign(count + 1, 0);
+
+  // Every edge is counted once, from the triangle with the lower index
+  for (size_t t = 0; t < triangles.size(); t++)
+    for (int k = 0; k < 3; k++)
+      {
+        int m = triangles[t].n[k];
+        if (m >= 0 && m < (int) t) continue;
+        offsets[triangles[t].v[NEXT(k)] + 1]++;
+        offsets[triangles[t].v[PREV(k)] + 1]++;
+      }
+
+  for (int i = 0; i < count; i++)
+    offsets[i + 1] += offsets[i];
+
+  neighbours.resize(offsets[count]);
+
+  cursor.assign(offsets.begin(), offsets.end() - 1);
+
+  for (size_t t = 0; t < triangles.size(); t++)
+    for (int k = 0; k < 3; k++)
+      {
+        int m = triangles[t].n[k];
+        if (m >= 0 && m < (int) t) continue;
+        int a = triangles[t].v[NEXT(k)], b = triangles[t].v[PREV(k)];
+        neighbours[cursor[a]++] = b;
+        neighbours[cursor[b]++] = a;
+      }
+
+  for (int i = 0; i < count; i++)
+    std::sort(neighbours.begin() + offsets[i], neighbours.begin() + offsets[i + 1]);
+
+}
+
+}
+
+}
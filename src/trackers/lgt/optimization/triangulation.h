@@ -0,0 +1,170 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#ifndef LEGIT_OPTIMIZATION_TRIANGULATION
+#define LEGIT_OPTIMIZATION_TRIANGULATION
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+using namespace std;
+using namespace cv;
+
+namespace legit
+{
+
+namespace tracker
+{
+
+/**
+    Delaunay triangulation specialized for the small point sets of the
+    tracker. The mesh is kept between updates: points are matched to the
+    previous update by their identifiers, removed points are taken out of the
+    mesh locally, new points are inserted into it and the Delaunay property
+    is restored with Lawson edge flips. The mesh is only rebuilt
+    (Bowyer-Watson) when a triangle is inverted by the motion or a local
+    change runs into a degenerate configuration.
+
+    Adjacency of the points is available in compressed sparse row form:
+    neighbours of the i-th point are get_neighbours()[get_offsets()[i] ...
+    get_offsets()[i + 1] - 1].
+*/
+class DelaunayMesh
+{
+public:
+
+  DelaunayMesh();
+
+  ~DelaunayMesh();
+
+  void update(const Point2f* points, const int* ids, int count);
+
+  inline int size()
+  {
+    return (int) xs.size();
+  }
+
+  inline const vector<int>& get_offsets()
+  {
+    return offsets;
+  }
+
+  inline const vector<int>& get_neighbours()
+  {
+    return neighbours;
+  }
+
+  /**
+      Returns true if the mesh was built from scratch in the last update.
+  */
+  inline bool is_rebuilt()
+  {
+    return rebuilt;
+  }
+
+  /**
+      Returns the number of edge flips performed in the last update.
+  */
+  inline int get_flips()
+  {
+    return flips;
+  }
+
+private:
+
+  struct Triangle
+  {
+    int v[3]; // vertices in counter-clockwise order
+    int n[3]; // neighbour across the edge opposite to v[k] or -1
+  };
+
+  struct Edge
+  {
+    long long key;
+    int triangle;
+    int index;
+
+    bool operator<(const Edge& e) const
+    {
+      return key < e.key;
+    }
+  };
+
+  DelaunayMesh(const DelaunayMesh&) = delete;
+  DelaunayMesh& operator=(const DelaunayMesh&) = delete;
+
+  void build();
+
+  bool remove_vertex(int v);
+
+  bool insert_vertex(int p);
+
+  bool valid();
+
+  void close_boundary();
+
+  void link();
+
+  void legalize();
+
+  bool flip(int t, int k);
+
+  void replace_neighbour(int t, int from, int to);
+
+  void collect_neighbours();
+
+  double orientation(int a, int b, int c);
+
+  double incircle(int a, int b, int c, int d);
+
+  vector<double> xs;
+  vector<double> ys;
+  vector<int> ids;
+
+  vector<Triangle> triangles;
+  vector<int> stack;
+
+  vector<int> offsets;
+  vector<int> neighbours;
+
+  // Scratch space of the updates, kept to avoid reallocation
+  vector<Edge> edges;
+  vector<int> boundary;
+  vector<int> cursor;
+  vector<int> bad;
+  vector<int> polygon;
+  vector<int> chain;
+  vector<int> remap;
+  vector<char> matched;
+  vector<char> present;
+  vector<pair<int, int> > lookup;
+  vector<double> old_xs;
+  vector<double> old_ys;
+
+  bool rebuilt;
+  int flips;
+
+};
+
+}
+
+}
+
+#endif
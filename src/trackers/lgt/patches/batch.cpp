@@ -0,0 +1,308 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#include <algorithm>
+#include "batch.h"
+#include "patch.h"
+#include "common/math/geometry.h"
+
+// Number of patch positions transformed together
+#define BATCH_BLOCK 64
+
+namespace legit
+{
+
+namespace tracker
+{
+
+PatchBatch::PatchBatch() : patches(NULL), image(NULL), transform(BATCH_TRANSLATION), count(0), capacity(0),
+  x(NULL), y(NULL), rx(NULL), ry(NULL), weights(NULL), bounds(NULL), order(NULL), sorted(NULL), histogram(NULL), references(NULL), reference_sums(NULL),
+  half_size(0)
+{
+
+}
+
+PatchBatch::~PatchBatch()
+{
+
+  delete [] x;
+  delete [] y;
+  delete [] rx;
+  delete [] ry;
+  delete [] weights;
+  delete [] bounds;
+  delete [] order;
+  delete [] sorted;
+  delete [] histogram;
+  delete [] references;
+  delete [] reference_sums;
+
+}
+
+void PatchBatch::reserve(int size)
+{
+
+  if (size <= capacity)
+    return;
+
+  delete [] x;
+  delete [] y;
+  delete [] rx;
+  delete [] ry;
+  delete [] weights;
+  delete [] bounds;
+  delete [] order;
+  delete [] sorted;
+  delete [] histogram;
+  delete [] references;
+  delete [] reference_sums;
+
+  x = new float[size];
+  y = new float[size];
+  rx = new float[size];
+  ry = new float[size];
+  weights = new float[size];
+  bounds = new float[size + 1];
+  order = new int[size];
+  sorted = new pair<float, int>[size];
+  histogram = new int[size];
+  references = new float[size * HIST_SIZE_32];
+  reference_sums = new int[size];
+
+  capacity = size;
+
+}
+
+void PatchBatch::prepare(Image& img, PatchSet& set, BatchTransform t, Point2f c)
+{
+
+  patches = &set;
+  image = &img;
+  transform = t;
+  center = c;
+  count = set.size();
+
+  reserve(count);
+
+  set.prepare(img);
+
+  gray = img.get_gray();
+  half_size = set.get_patch_size() >> 1;
+
+  // Patches with higher weights are evaluated first
+  for (int j = 0; j < count; j++)
+    sorted[j] = pair<float, int>(-set.get_weight(j), j);
+
+  // Indices break the ties, so this gives the same order as a stable sort
+  // without its temporary buffer
+  std::sort(sorted, sorted + count);
+
+  for (int j = 0; j < count; j++)
+    {
+      int index = sorted[j].second;
+      order[j] = index;
+
+      Point2f p = set.get_position(index);
+      Point2f r = set.get_relative_position(index, center);
+      x[j] = p.x;
+      y[j] = p.y;
+      rx[j] = r.x;
+      ry[j] = r.y;
+      weights[j] = set.get_weight(index);
+
+      HistogramRoots* h = set.get_histogram_roots(index);
+
+      histogram[j] = (h && (h->size == HIST_SIZE_8 || h->size == HIST_SIZE_16 || h->size == HIST_SIZE_32)) ? h->size : 0;
+
+      if (histogram[j])
+        {
+          memcpy(&(references[j * HIST_SIZE_32]), h->data, sizeof(float) * h->size);
+          reference_sums[j] = h->sum;
+        }
+    }
+
+  // Upper bounds of the remaining score after the first j patches
+  bounds[count] = 0;
+  for (int j = count - 1; j >= 0; j--)
+    bounds[j] = bounds[j + 1] + MAX(0, weights[j]);
+
+}
+
+void PatchBatch::transform_positions(Matrix& samples, int k, int begin, int end, float* px, float* py)
+{
+
+  const double* s = samples.ptr<double>(k);
+  int n = end - begin;
+
+  if (transform == BATCH_TRANSLATION)
+    {
+      float tx = (float) s[0];
+      float ty = (float) s[1];
+      const float* bx = &(x[begin]);
+      const float* by = &(y[begin]);
+
+      for (int j = 0; j < n; j++)
+        {
+          px[j] = bx[j] + tx;
+          py[j] = by[j] + ty;
+        }
+    }
+  else
+    {
+      Matrix3f A = simple_affine_transformation(s[0], s[1], s[2], s[3], s[4]);
+      const float* bx = &(rx[begin]);
+      const float* by = &(ry[begin]);
+      float cx = center.x;
+      float cy = center.y;
+
+      for (int j = 0; j < n; j++)
+        {
+          px[j] = (A.m00 * bx[j] + A.m10 * by[j] + A.m20) + cx;
+          py[j] = (A.m01 * bx[j] + A.m11 * by[j] + A.m21) + cy;
+        }
+    }
+
+}
+
+template <int N>
+float PatchBatch::distance(int j, cv::Point position)
+{
+
+  // Same as HistogramPatch::response, but without the virtual call
+  HistogramRoots reference;
+  reference.size = N;
+  reference.data = &(references[j * HIST_SIZE_32]);
+  reference.sum = reference_sums[j];
+
+  IntegralHistogram* integral = image->find_integral_histogram(N);
+
+  if (integral && integral->covers(position, half_size))
+    return histogram_distance<N>(*integral, position, half_size, reference);
+  else
+    return histogram_distance<N>(gray, position, half_size, reference);
+
+}
+
+// Response of a patch that is known to be of type P, the generic version
+// goes through the virtual call
+template <class P>
+static inline float batch_response(PatchSet& patches, Image& image, int index, cv::Point position)
+{
+  return static_cast<P*>(patches.get_patch(index))->P::response(image, position);
+}
+
+template <>
+inline float batch_response<Patch>(PatchSet& patches, Image& image, int index, cv::Point position)
+{
+  return patches.get_patch(index)->response(image, position);
+}
+
+template <class P>
+float PatchBatch::evaluate(int j, float px, float py)
+{
+
+  cv::Point position(cvRound(px), cvRound(py));
+
+  switch (histogram[j])
+    {
+    case HIST_SIZE_8:
+      return exp(- distance<HIST_SIZE_8>(j, position));
+    case HIST_SIZE_16:
+      return exp(- distance<HIST_SIZE_16>(j, position));
+    case HIST_SIZE_32:
+      return exp(- distance<HIST_SIZE_32>(j, position));
+    default:
+      return exp(- batch_response<P>(*patches, *image, order[j], position));
+    }
+
+}
+
+void PatchBatch::costs(Matrix& samples, int begin, int end, float* costs)
+{
+
+  float px[BATCH_BLOCK];
+  float py[BATCH_BLOCK];
+
+  for (int k = begin; k < end; k++)
+    {
+      float* row = &(costs[(k - begin) * count]);
+
+      for (int b = 0; b < count; b += BATCH_BLOCK)
+        {
+          int e = MIN(b + BATCH_BLOCK, count);
+          transform_positions(samples, k, b, e, px, py);
+
+          for (int j = b; j < e; j++)
+            row[order[j]] = evaluate<Patch>(j, px[j - b], py[j - b]);
+        }
+    }
+
+}
+
+void PatchBatch::scores(Matrix& samples, int begin, int end, float* scores, float threshold)
+{
+
+  this->scores<Patch>(samples, begin, end, scores, threshold);
+
+}
+
+template <class P>
+void PatchBatch::scores(Matrix& samples, int begin, int end, float* scores, float threshold)
+{
+
+  float px[BATCH_BLOCK];
+  float py[BATCH_BLOCK];
+
+  for (int k = begin; k < end; k++)
+    {
+      float score = 0;
+      bool rejected = false;
+
+      for (int b = 0; b < count && !rejected; b += BATCH_BLOCK)
+        {
+          int e = MIN(b + BATCH_BLOCK, count);
+          transform_positions(samples, k, b, e, px, py);
+
+          for (int j = b; j < e; j++)
+            {
+              score += evaluate<P>(j, px[j - b], py[j - b]) * weights[j];
+
+              if (score + bounds[j + 1] < threshold)
+                {
+                  rejected = true;
+                  break;
+                }
+            }
+        }
+
+      scores[k] = rejected ? -1 : score;
+    }
+
+}
+
+template void PatchBatch::scores<Patch>(Matrix& samples, int begin, int end, float* scores, float threshold);
+
+template void PatchBatch::scores<HistogramPatch>(Matrix& samples, int begin, int end, float* scores, float threshold);
+
+template void PatchBatch::scores<SSDPatch>(Matrix& samples, int begin, int end, float* scores, float threshold);
+
+}
+
+}
@@ -0,0 +1,140 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#ifndef LEGIT_PATCH_BATCH
+#define LEGIT_PATCH_BATCH
+
+#include <float.h>
+#include <opencv2/core/core.hpp>
+#include "patchset.h"
+#include "common/math/statistics.h"
+
+using namespace cv;
+using namespace std;
+using namespace legit::common;
+
+namespace legit
+{
+
+namespace tracker
+{
+
+enum BatchTransform {BATCH_TRANSLATION, BATCH_AFFINE};
+
+/**
+    Evaluates the responses of all patches in a set for many sample
+    transformations at once. Patch positions, weights and reference histograms
+    are copied to flat arrays when the batch is prepared, so the evaluation
+    works on a single grayscale plane without virtual calls for histogram
+    patches. Other patch types fall back to the generic response.
+
+    Samples are rows of a matrix: (tx, ty) for translation and
+    (tx, ty, r, sx, sy) for the affine transformation around the center.
+    After prepare has been called, evaluation does not modify the batch and
+    can run concurrently on disjoint sample ranges.
+
+    Patches are stored in the order of decreasing weight. Since every term
+    exp(-response) is at most one, the weight of the patches that have not
+    been evaluated yet bounds the remaining score, and this bound tightens
+    quickly in that order.
+*/
+class PatchBatch
+{
+public:
+  PatchBatch();
+  ~PatchBatch();
+
+  void prepare(Image& image, PatchSet& patches, BatchTransform transform, Point2f center);
+
+  /**
+      Writes exp(-response) of every patch for samples [begin, end) to costs,
+      one row of size() values per sample.
+  */
+  void costs(Matrix& samples, int begin, int end, float* costs);
+
+  /**
+      Writes the weighted sum of exp(-response) over all patches for samples
+      [begin, end) to scores[begin] ... scores[end - 1]. The evaluation of a
+      sample stops as soon as its score can not exceed the threshold anymore,
+      such samples are rejected with a negative score.
+  */
+  void scores(Matrix& samples, int begin, int end, float* scores, float threshold = -FLT_MAX);
+
+  /**
+      Same as scores, but patches that are not handled by the histogram path
+      are assumed to be of type P and are evaluated without a virtual call.
+      Instantiated for Patch (generic), HistogramPatch and SSDPatch.
+  */
+  template <class P>
+  void scores(Matrix& samples, int begin, int end, float* scores, float threshold = -FLT_MAX);
+
+  inline int size()
+  {
+    return count;
+  }
+
+private:
+
+  PatchBatch(const PatchBatch&) = delete;
+  PatchBatch& operator=(const PatchBatch&) = delete;
+
+  void reserve(int size);
+
+  void transform_positions(Matrix& samples, int k, int begin, int end, float* px, float* py);
+
+  template <class P>
+  float evaluate(int j, float px, float py);
+
+  template <int N>
+  float distance(int j, cv::Point position);
+
+  PatchSet* patches;
+  Image* image;
+
+  BatchTransform transform;
+  Point2f center;
+
+  int count;
+  int capacity;
+
+  float* x;
+  float* y;
+  float* rx;
+  float* ry;
+  float* weights;
+  float* bounds;
+  int* order;
+  pair<float, int>* sorted;
+  // Number of reference histogram bins of every patch, zero if the patch is
+  // not histogram based
+  int* histogram;
+  float* references;
+  int* reference_sums;
+
+  Mat gray;
+  int half_size;
+
+};
+
+}
+
+}
+
+#endif
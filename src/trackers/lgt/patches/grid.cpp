@@ -0,0 +1,307 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#include <algorithm>
+#include <math.h>
+#include "grid.h"
+
+// Limits the number of cells in each direction for widely spread points
+#define GRID_MAX_CELLS 256
+
+namespace legit
+{
+
+namespace tracker
+{
+
+SpatialGrid::SpatialGrid() : cell(1), cols(1), rows(1)
+{
+
+  offsets.resize(2, 0);
+
+}
+
+SpatialGrid::~SpatialGrid()
+{
+
+}
+
+void SpatialGrid::build(const Point2f* source, int count, float size)
+{
+
+  points.assign(source, source + count);
+
+  if (count == 0)
+    {
+      cols = rows = 1;
+      offsets.assign(2, 0);
+      items.clear();
+      return;
+    }
+
+  Point2f low = points[0], high = points[0];
+
+  for (int i = 1; i < count; i++)
+    {
+      low.x = std::min(low.x, points[i].x);
+      low.y = std::min(low.y, points[i].y);
+      high.x = std::max(high.x, points[i].x);
+      high.y = std::max(high.y, points[i].y);
+    }
+
+  cell = std::max(size, 1.0f);
+  cell = std::max(cell, std::max(high.x - low.x, high.y - low.y) / GRID_MAX_CELLS);
+
+  origin = low;
+  cols = (int) floor((high.x - low.x) / cell) + 1;
+  rows = (int) floor((high.y - low.y) / cell) + 1;
+
+  offsets.assign(cols * rows + 1, 0);
+  items.resize(count);
+
+  // counting sort of the points by their cell
+  cells.resize(count);
+
+  for (int i = 0; i < count; i++)
+    {
+      cells[i] = cell_y(points[i].y) * cols + cell_x(points[i].x);
+      offsets[cells[i] + 1]++;
+    }
+
+  for (int c = 0; c < cols * rows; c++)
+    offsets[c + 1] += offsets[c];
+
+  fill.assign(offsets.begin(), offsets.end() - 1);
+
+  for (int i = 0; i < count; i++)
+    items[fill[cells[i]]++] = i;
+
+}
+
+void SpatialGrid::query(Point2f center, float radius, vector<int>& result)
+{
+
+  result.clear();
+
+  if (points.empty()) return;
+
+  int x1 = cell_x(center.x - radius), x2 = cell_x(center.x + radius);
+  int y1 = cell_y(center.y - radius), y2 = cell_y(center.y + radius);
+
+  float radius2 = radius * radius;
+
+  for (int y = y1; y <= y2; y++)
+    {
+      for (int x = x1; x <= x2; x++)
+        {
+          int c = y * cols + x;
+          for (int k = offsets[c]; k < offsets[c + 1]; k++)
+            {
+              float dx = points[items[k]].x - center.x;
+              float dy = points[items[k]].y - center.y;
+              if (dx * dx + dy * dy < radius2)
+                result.push_back(items[k]);
+            }
+        }
+    }
+
+}
+
+void SpatialGrid::query(Rect region, vector<int>& result)
+{
+
+  result.clear();
+
+  if (points.empty()) return;
+
+  int x1 = cell_x(region.x), x2 = cell_x(region.x + region.width);
+  int y1 = cell_y(region.y), y2 = cell_y(region.y + region.height);
+
+  for (int y = y1; y <= y2; y++)
+    {
+      for (int x = x1; x <= x2; x++)
+        {
+          int c = y * cols + x;
+          for (int k = offsets[c]; k < offsets[c + 1]; k++)
+            {
+              Point2f p = points[items[k]];
+              if (p.x >= region.x && p.y >= region.y && p.x < region.x + region.width && p.y < region.y + region.height)
+                result.push_back(items[k]);
+            }
+        }
+    }
+
+}
+
+float SpatialGrid::median_distance(int index)
+{
+
+  int count = size();
+
+  if (count == 0) return 0;
+
+  int high = count / 2;
+  int low = (count % 2 == 0) ? high - 1 : high;
+
+  Point2f center = points[index];
+  int cx = cell_x(center.x), cy = cell_y(center.y);
+  int rings = std::max(cols, rows);
+
+  buffer.clear();
+
+  // Visit cells in rings of growing Chebyshev distance. After ring r all the
+  // points closer than r * cell have been seen, so once there are enough of
+  // them the median can not change anymore.
+  for (int r = 0; r <= rings; r++)
+    {
+      for (int y = cy - r; y <= cy + r; y++)
+        {
+          if (y < 0 || y >= rows) continue;
+
+          int step = (y == cy - r || y == cy + r) ? 1 : std::max(2 * r, 1);
+
+          for (int x = cx - r; x <= cx + r; x += step)
+            {
+              if (x < 0 || x >= cols) continue;
+
+              int c = y * cols + x;
+              for (int k = offsets[c]; k < offsets[c + 1]; k++)
+                {
+                  float dx = points[items[k]].x - center.x;
+                  float dy = points[items[k]].y - center.y;
+                  buffer.push_back(sqrt(dx * dx + dy * dy));
+                }
+            }
+        }
+
+      if ((int) buffer.size() == count) break;
+
+      if ((int) buffer.size() > high)
+        {
+          float bound = r * cell;
+          int complete = 0;
+
+          for (size_t i = 0; i < buffer.size(); i++)
+            if (buffer[i] <= bound) complete++;
+
+          if (complete > high) break;
+        }
+    }
+
+  std::nth_element(buffer.begin(), buffer.begin() + high, buffer.end());
+
+  float median = buffer[high];
+
+  if (low < high)
+    median = (median + *std::max_element(buffer.begin(), buffer.begin() + high)) / 2;
+
+  return median;
+
+}
+
+static int find_root(vector<int>& parents, int i)
+{
+
+  while (parents[i] != i)
+    {
+      parents[i] = parents[parents[i]];
+      i = parents[i];
+    }
+
+  return i;
+
+}
+
+int SpatialGrid::clusters(float threshold, vector<vector<int> >& groups)
+{
+
+  int count = size();
+
+  // The groups of the previous call are kept aside so that their storage
+  // is reused by the new ones
+  for (size_t g = 0; g < groups.size(); g++)
+    {
+      spare.push_back(vector<int>());
+      spare.back().swap(groups[g]);
+    }
+
+  groups.clear();
+
+  parents.resize(count);
+
+  for (int i = 0; i < count; i++)
+    parents[i] = i;
+
+  for (int i = 0; i < count; i++)
+    {
+      query(points[i], threshold, neighbours);
+
+      for (size_t k = 0; k < neighbours.size(); k++)
+        {
+          int j = neighbours[k];
+          if (j <= i) continue;
+
+          int a = find_root(parents, i);
+          int b = find_root(parents, j);
+
+          if (a != b) parents[std::max(a, b)] = std::min(a, b);
+        }
+    }
+
+  // Sizes of the groups first, so that only the groups with more than one
+  // point are created, in the order of their first point
+  fill.assign(count, 0);
+
+  for (int i = 0; i < count; i++)
+    fill[find_root(parents, i)]++;
+
+  labels.assign(count, -1);
+
+  for (int i = 0; i < count; i++)
+    {
+      int root = find_root(parents, i);
+
+      if (fill[root] < 2) continue;
+
+      if (labels[root] < 0)
+        {
+          labels[root] = groups.size();
+          groups.push_back(vector<int>());
+
+          if (!spare.empty())
+            {
+              groups.back().swap(spare.back());
+              groups.back().clear();
+              spare.pop_back();
+            }
+
+          groups.back().reserve(fill[root]);
+        }
+
+      groups[labels[root]].push_back(i);
+    }
+
+  return groups.size();
+
+}
+
+}
+
+}
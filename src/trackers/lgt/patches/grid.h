@@ -0,0 +1,120 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#ifndef LEGIT_PATCH_GRID
+#define LEGIT_PATCH_GRID
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+using namespace cv;
+using namespace std;
+
+namespace legit
+{
+
+namespace tracker
+{
+
+/**
+    Uniform grid over a set of points that answers proximity queries without
+    computing all pairwise distances. Points are bucketed by cell in a single
+    counting pass, the buckets are stored contiguously.
+*/
+class SpatialGrid
+{
+public:
+  SpatialGrid();
+  ~SpatialGrid();
+
+  void build(const Point2f* points, int count, float cell);
+
+  /**
+      Indices of the points that are closer than radius to the given point.
+  */
+  void query(Point2f center, float radius, vector<int>& result);
+
+  /**
+      Indices of the points that lie inside the given region.
+  */
+  void query(Rect region, vector<int>& result);
+
+  /**
+      Median of the distances from the point at the given index to all
+      points (including itself). Equal to the median of the corresponding
+      row of the full distance matrix, but only the cells close enough to
+      contain the median are visited.
+  */
+  float median_distance(int index);
+
+  /**
+      Groups points that are (transitively) closer than threshold to each
+      other. Only groups with more than one point are returned.
+  */
+  int clusters(float threshold, vector<vector<int> >& groups);
+
+  inline int size()
+  {
+    return (int) points.size();
+  }
+
+  inline float get_cell()
+  {
+    return cell;
+  }
+
+private:
+
+  inline int cell_x(float x)
+  {
+    return std::min(std::max((int) floor((x - origin.x) / cell), 0), cols - 1);
+  }
+
+  inline int cell_y(float y)
+  {
+    return std::min(std::max((int) floor((y - origin.y) / cell), 0), rows - 1);
+  }
+
+  vector<Point2f> points;
+  vector<int> offsets;
+  vector<int> items;
+  vector<float> buffer;
+  vector<int> parents;
+
+  // Scratch space of build and clusters, kept to avoid allocations
+  vector<int> cells;
+  vector<int> fill;
+  vector<int> neighbours;
+  vector<int> labels;
+  // Group vectors returned by the previous call to clusters
+  vector<vector<int> > spare;
+
+  Point2f origin;
+  float cell;
+  int cols;
+  int rows;
+
+};
+
+}
+
+}
+
+#endif
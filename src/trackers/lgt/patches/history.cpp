@@ -0,0 +1,107 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#include <string.h>
+#include "history.h"
+
+namespace legit
+{
+
+namespace tracker
+{
+
+PatchHistory::PatchHistory(int length) : data(NULL), capacity(0), head(0)
+{
+
+  frames = 1;
+  while (frames < length)
+    frames <<= 1;
+
+  mask = frames - 1;
+
+}
+
+PatchHistory::~PatchHistory()
+{
+
+  delete [] data;
+
+}
+
+void PatchHistory::reserve(int slots)
+{
+
+  if (slots <= capacity)
+    return;
+
+  State* resized = new State[frames * slots]();
+
+  for (int f = 0; f < frames && data; f++)
+    memcpy(resized + f * slots, data + f * capacity, sizeof(State) * capacity);
+
+  delete [] data;
+  data = resized;
+
+  for (int i = slots - 1; i >= capacity; i--)
+    free.push_back(i);
+
+  capacity = slots;
+
+}
+
+int PatchHistory::acquire()
+{
+
+  if (free.empty())
+    reserve(capacity < 16 ? 16 : capacity * 2);
+
+  int slot = free.back();
+  free.pop_back();
+
+  return slot;
+
+}
+
+void PatchHistory::release(int slot)
+{
+
+  free.push_back(slot);
+
+}
+
+void PatchHistory::push(const int* slots, const Point2f* positions, const float* weights, int count)
+{
+
+  State* row = data + (head & mask) * capacity;
+
+  for (int i = 0; i < count; i++)
+    {
+      State& s = row[slots[i]];
+      s.position = positions[i];
+      s.weight = weights[i];
+    }
+
+  head++;
+
+}
+
+}
+
+}
@@ -0,0 +1,103 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#ifndef LEGIT_PATCH_HISTORY
+#define LEGIT_PATCH_HISTORY
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+using namespace cv;
+using namespace std;
+
+namespace legit
+{
+
+namespace tracker
+{
+
+typedef struct _State
+{
+  Point2f position;
+  float weight;
+} State;
+
+/**
+    States of the patches in the past frames. The states are stored in a
+    single preallocated block of frames by slots, every patch owns a slot
+    for its lifetime. The number of frames is a power of two, so the ring
+    is indexed with a mask and the oldest frame is overwritten by a push.
+*/
+class PatchHistory
+{
+public:
+  PatchHistory(int length);
+  ~PatchHistory();
+
+  /**
+      Preallocates storage for the given number of slots.
+  */
+  void reserve(int slots);
+
+  /**
+      Takes a free slot. The history of the slot is not cleared, the age of
+      the patch tells how much of it is valid.
+  */
+  int acquire();
+
+  void release(int slot);
+
+  /**
+      Stores the states of a frame and advances the ring.
+  */
+  void push(const int* slots, const Point2f* positions, const float* weights, int count);
+
+  /**
+      State of the slot in the frame offset frames back, the offset has to
+      be between 1 and the length of the history.
+  */
+  inline State& get(int slot, int offset)
+  {
+    return data[((head - offset) & mask) * capacity + slot];
+  }
+
+  inline int length()
+  {
+    return frames;
+  }
+
+private:
+
+  State* data;
+
+  int frames;
+  int mask;
+  int capacity;
+  int head;
+
+  vector<int> free;
+
+};
+
+}
+
+}
+
+#endif
@@ -33,45 +33,126 @@ namespace tracker
 {
 
 // -- Gray Histogram ---------------------------------------------------------------------- //
-void HistogramPatch::initialize(Image& image, Point position)
+HistogramPatch::HistogramPatch(int id, int width, int height, int bins) : Patch(id, width, height), bins(bins)
 {
 
-  Mat grayscale = image.get_gray();
+  switch (bins)
+    {
+    case HIST_SIZE_8:
+      bind<HIST_SIZE_8>();
+      break;
+    case HIST_SIZE_16:
+      bind<HIST_SIZE_16>();
+      break;
+    case HIST_SIZE_32:
+      bind<HIST_SIZE_32>();
+      break;
+    default:
+      throw LegitException("Unsupported bins number");
+    }
+
+}
+
+template <int N>
+void HistogramPatch::bind()
+{
 
-  histogram = calculate_histogram16(grayscale, position, width);
+  HistogramReference<N>& r = get_reference<N>();
 
-  temporary = allocate_histogram(16);
+  memset(&r, 0, sizeof(HistogramReference<N>));
+
+  histogram.data = r.histogram.data;
+  histogram.size = N;
+  histogram.sum = 0;
+
+  roots.data = r.roots;
+  roots.size = N;
+  roots.sum = 0;
 
 }
 
-HistogramPatch::~HistogramPatch()
+template <int N>
+void HistogramPatch::update_reference(Image& image, Point position)
 {
 
-  release_histogram(histogram);
+  HistogramReference<N>& r = get_reference<N>();
 
-  release_histogram(temporary);
+  // Use the integral histogram if the image already has one that covers the patch
+  IntegralHistogram* integral = image.find_integral_histogram(N);
+
+  if (integral && integral->covers(position, width >> 1))
+    {
+      integral->sum(position, width >> 1, r.histogram);
+    }
+  else
+    {
+      Mat grayscale = image.get_gray();
+      update_histogram<N>(grayscale, position, width >> 1, r.histogram);
+    }
+
+  // Roots of the reference are computed only once, comparisons then only
+  // need the roots of the candidate histogram
+  compute_histogram_roots(r);
+
+  histogram.sum = r.histogram.sum;
+  roots.sum = r.histogram.sum;
 
 }
 
-float HistogramPatch::response(Image& image, Point position)
+void HistogramPatch::initialize(Image& image, Point position)
 {
-  // 1-Bhattacharryya : 1 complete difference, 0 complete similarity
-  Mat grayscale = image.get_gray();
-  update_histogram16(grayscale, position, width >> 1, temporary);
-  return (1.0-compare_histogram(temporary, histogram));
 
+  switch (bins)
+    {
+    case HIST_SIZE_8:
+      update_reference<HIST_SIZE_8>(image, position);
+      break;
+    case HIST_SIZE_32:
+      update_reference<HIST_SIZE_32>(image, position);
+      break;
+    default:
+      update_reference<HIST_SIZE_16>(image, position);
+      break;
+    }
 
 }
 
-void HistogramPatch::responses(Image& image, Point2f* positions, int pcount, float* responses)
+HistogramPatch::~HistogramPatch()
 {
-  // 1-Bhattacharryya : 1 complete difference, 0 complete similarity
+
+}
+
+template <int N>
+void HistogramPatch::distances(Image& image, Point2f* positions, int pcount, float* responses)
+{
+
   Mat grayscale = image.get_gray();
+  IntegralHistogram* integral = image.find_integral_histogram(N);
   int half_size = width >> 1;
   for (int i = 0; i < pcount; i++)
     {
-      update_histogram16(grayscale, positions[i], half_size, temporary);
-      responses[i] = (1.0-compare_histogram(temporary, histogram));
+      if (integral && integral->covers(positions[i], half_size))
+        responses[i] = histogram_distance<N>(*integral, positions[i], half_size, roots);
+      else
+        responses[i] = histogram_distance<N>(grayscale, positions[i], half_size, roots);
+    }
+
+}
+
+void HistogramPatch::responses(Image& image, Point2f* positions, int pcount, float* responses)
+{
+  // 1-Bhattacharryya : 1 complete difference, 0 complete similarity
+  switch (bins)
+    {
+    case HIST_SIZE_8:
+      distances<HIST_SIZE_8>(image, positions, pcount, responses);
+      break;
+    case HIST_SIZE_32:
+      distances<HIST_SIZE_32>(image, positions, pcount, responses);
+      break;
+    default:
+      distances<HIST_SIZE_16>(image, positions, pcount, responses);
+      break;
     }
 
 }
@@ -244,47 +325,12 @@ void SSDPatch::initialize(Image& image, Point position)
 
 }
 
-float SSDPatch::response(Image& image, Point position)
-{
-
-  Mat gray = image.get_gray();
-
-  int x1 = MAX(position.x - width / 2, 0);
-  int y1 = MAX(position.y - height / 2, 0);
-
-  int x2 = MIN(position.x + width / 2, gray.cols);
-  int y2 = MIN(position.y + height / 2, gray.rows);
-
-  int ox = x1 - (position.x - width / 2);
-  int oy = y1 - (position.y - height / 2);
-
-  if (x1 >= x2 || y1 >= y2)
-    return -50;
-
-  float dist = 0;
-  for (int j = 0; j < y2 - y1; j++)
-    {
-      uchar* data = & (gray.ptr<uchar>(j + y1)[x1]);
-      uchar* tt = & (tmpl.ptr<uchar>(j + oy)[ox]);
-      for (int i = 0; i < x2 - x1; i++)
-        {
-          int bin = data[i] - tt[i];
-          dist += bin * bin;
-        }
-    }
-
-//DEBUGMSG("%d %d %d %d %d %d %f %d\n", x1, x2, y1, y2, ox, oy, dist, c);
-
-  return -(dist / ((x2 - x1) * (y2 - y1) * 255 * 255)) * 50;
-
-}
-
 void SSDPatch::responses(Image& image, Point2f* positions, int pcount, float* responses)
 {
 
   for (int i = 0; i < pcount; i++)
     {
-      responses[i] = response(image, positions[i]);
+      responses[i] = SSDPatch::response(image, positions[i]);
     }
 
 }
@@ -37,7 +37,7 @@ namespace tracker
 class HistogramPatch : public Patch
 {
 public:
-  HistogramPatch(int id, int capacity, int limit, int width, int height) : Patch(id, capacity, limit, width, height) {}
+  HistogramPatch(int id, int width, int height, int bins = HIST_SIZE_16);
   ~HistogramPatch();
 
   virtual void initialize(Image& image, cv::Point position);
@@ -48,11 +48,61 @@ public:
     return HISTOGRAM;
   }
 
+  static const PatchType TYPE = HISTOGRAM;
+
+  virtual SimpleHistogram* get_histogram()
+  {
+    return &histogram;
+  }
+
+  virtual HistogramRoots* get_histogram_roots()
+  {
+    return &roots;
+  }
+
+  inline int get_bins()
+  {
+    return bins;
+  }
+
 private:
 
+  HistogramPatch(const HistogramPatch&) = delete;
+  HistogramPatch& operator=(const HistogramPatch&) = delete;
+
+  template <int N>
+  inline HistogramReference<N>& get_reference()
+  {
+    return *(HistogramReference<N>*) &reference;
+  }
+
+  template <int N>
+  void bind();
+
+  template <int N>
+  void update_reference(Image& image, cv::Point position);
+
+  template <int N>
+  inline float distance(Image& image, cv::Point position);
+
+  template <int N>
+  void distances(Image& image, cv::Point2f* positions, int pcount, float* responses);
+
+  int bins;
+
+  // The number of bins is chosen at construction, the reference is stored
+  // inline for the chosen size
+  union
+  {
+    HistogramReference<HIST_SIZE_8> bins8;
+    HistogramReference<HIST_SIZE_16> bins16;
+    HistogramReference<HIST_SIZE_32> bins32;
+  } reference;
+
+  // Views of the reference for the code that is not specialized
   SimpleHistogram histogram;
 
-  SimpleHistogram temporary;
+  HistogramRoots roots;
 
   Point3f color; // hack
 };
@@ -61,7 +111,7 @@ private:
 class RGBPatch : public Patch
 {
 public:
-  RGBPatch(int id, int capacity, int limit) : Patch(id, capacity, limit, 1, 1) {}
+  RGBPatch(int id) : Patch(id, 1, 1) {}
   ~RGBPatch();
 
   virtual void initialize(Image& image, cv::Point position);
@@ -79,7 +129,7 @@ private:
 class HSPatch : public Patch
 {
 public:
-  HSPatch(int id, int capacity, int limit) : Patch(id, capacity, limit, 1, 1) {}
+  HSPatch(int id) : Patch(id, 1, 1) {}
   ~HSPatch();
 
   virtual void initialize(Image& image, cv::Point position);
@@ -98,7 +148,7 @@ private:
 class SSDPatch : public Patch
 {
 public:
-  SSDPatch(int id, int capacity, int limit, int width, int height) : Patch(id, capacity, limit, width, height) {}
+  SSDPatch(int id, int width, int height) : Patch(id, width, height) {}
   ~SSDPatch() {}
 
   virtual void initialize(Image& image, cv::Point position);
@@ -110,10 +160,80 @@ public:
     return SSD;
   }
 
+  static const PatchType TYPE = SSD;
+
 private:
   Mat tmpl;
 };
 
+// Responses of the patch types that the tracker can be specialized for are
+// defined here, so that a qualified call can be inlined
+
+template <int N>
+inline float HistogramPatch::distance(Image& image, Point position)
+{
+  // The temporary histogram lives on the stack so that responses can be
+  // evaluated from several threads at once.
+  IntegralHistogram* integral = image.find_integral_histogram(N);
+
+  if (integral && integral->covers(position, width >> 1))
+    return histogram_distance<N>(*integral, position, width >> 1, roots);
+
+  Mat grayscale = image.get_gray();
+  return histogram_distance<N>(grayscale, position, width >> 1, roots);
+
+}
+
+inline float HistogramPatch::response(Image& image, Point position)
+{
+  // 1-Bhattacharryya : 1 complete difference, 0 complete similarity
+  switch (bins)
+    {
+    case HIST_SIZE_8:
+      return distance<HIST_SIZE_8>(image, position);
+    case HIST_SIZE_32:
+      return distance<HIST_SIZE_32>(image, position);
+    default:
+      return distance<HIST_SIZE_16>(image, position);
+    }
+
+}
+
+inline float SSDPatch::response(Image& image, Point position)
+{
+
+  Mat gray = image.get_gray();
+
+  int x1 = MAX(position.x - width / 2, 0);
+  int y1 = MAX(position.y - height / 2, 0);
+
+  int x2 = MIN(position.x + width / 2, gray.cols);
+  int y2 = MIN(position.y + height / 2, gray.rows);
+
+  int ox = x1 - (position.x - width / 2);
+  int oy = y1 - (position.y - height / 2);
+
+  if (x1 >= x2 || y1 >= y2)
+    return -50;
+
+  float dist = 0;
+  for (int j = 0; j < y2 - y1; j++)
+    {
+      uchar* data = & (gray.ptr<uchar>(j + y1)[x1]);
+      uchar* tt = & (tmpl.ptr<uchar>(j + oy)[ox]);
+      for (int i = 0; i < x2 - x1; i++)
+        {
+          int bin = data[i] - tt[i];
+          dist += bin * bin;
+        }
+    }
+
+//DEBUGMSG("%d %d %d %d %d %d %f %d\n", x1, x2, y1, y2, ox, oy, dist, c);
+
+  return -(dist / ((x2 - x1) * (y2 - y1) * 255 * 255)) * 50;
+
+}
+
 }
 
 }
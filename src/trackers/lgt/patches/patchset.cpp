@@ -28,65 +28,34 @@ namespace legit
 namespace tracker
 {
 
-bool _isempty (Ptr<Patch> i)
+void Patch::reset(int id, int slot)
 {
-  return i.empty();
-}
 
-void Patch::set_position(Point2f p)
-{
-  State s = states.get(0);
-  s.position = p;
-  states.set(s);
-}
+  active = true;
+  this->id = id;
+  this->slot = slot;
 
-void Patch::move_position(Point2f m)
-{
-  State s = states.get(0);
-  s.position += m;
-  states.set(s);
 }
 
-
-void Patch::set_weight(float weight)
+PatchSet::PatchSet(int size) : patches(), history(NULL), psize(size)
 {
-  State s = states.get(0);
-  s.weight = weight;
-  states.set(s);
-}
 
-void Patch::push()
-{
-
-  if (states.size() == 0)
-    {
-      State s;
-      s.position.x = 0;
-      s.position.y = 0;
-      s.weight = 0;
-      s.active = active;
-      states.push(s);
-    }
-  else states.push(states.get(0));
-  age++;
+  accumulate();
 
 }
 
-PatchSet::PatchSet(int size) : psize(size), patches()
-{
-
-}
-
-PatchSet::PatchSet(PatchSet& set)
+PatchSet::PatchSet(PatchSet& set) : history(set.history), psize(set.psize)
 {
 
   patches.reserve(set.size());
 
-  for (int i = 0; i < size(); i++)
+  for (int i = 0; i < set.size(); i++)
     {
-      patches.push_back(set.patches[i]);
+      append(set.patches[i], set.positions[i], set.weights[i], set.ages[i]);
     }
 
+  accumulate();
+
 }
 
 PatchSet::~PatchSet()
@@ -100,26 +69,11 @@ int PatchSet::size()
 
 }
 
-float PatchSet::get_weight(int index)
-{
-
-  return patches[index]->get_weight(0);
-
-}
-
-
-Point2f PatchSet::get_position(int index, int offset)
-{
-
-  return patches[index]->get_position(offset);
-
-}
-
 Point2f PatchSet::get_relative_position(int index, Point2f origin)
 {
 
   Point2f out;
-  Point2f p = patches[index]->get_position();
+  Point2f p = positions[index];
   out.x = p.x - origin.x;
   out.y = p.y - origin.y;
 
@@ -131,38 +85,53 @@ bool PatchSet::is_active(int index)
   return patches[index]->is_active();
 }
 
-int PatchSet::get_age(int index)
+PatchType PatchSet::get_type(int index)
 {
 
-  return patches[index]->get_age();
+  return patches[index]->get_type();
 
 }
 
-int PatchSet::get_id(int index)
+SimpleHistogram* PatchSet::get_histogram(int index)
 {
 
-  return patches[index]->get_id();
+  return patches[index]->get_histogram();
 
 }
 
-PatchType PatchSet::get_type(int index)
+HistogramRoots* PatchSet::get_histogram_roots(int index)
 {
 
-  return patches[index]->get_type();
+  return patches[index]->get_histogram_roots();
 
 }
 
 void PatchSet::set_weight(int index, float weight)
 {
 
-  patches[index]->set_weight(weight);
+  float change = weight - weights[index];
+
+  sum_weights += change;
+  sum_weighted_x += change * positions[index].x;
+  sum_weighted_y += change * positions[index].y;
+
+  weights[index] = weight;
 
 }
 
 void PatchSet::set_position(int index, Point2f position)
 {
 
-  patches[index]->set_position(position);
+  Point2f change = position - positions[index];
+
+  sum_weighted_x += weights[index] * change.x;
+  sum_weighted_y += weights[index] * change.y;
+  sum_x += change.x;
+  sum_y += change.y;
+
+  positions[index] = position;
+
+  bounds_valid = false;
 
 }
 
@@ -175,22 +144,11 @@ void PatchSet::set_active(int index, bool active)
 Point2f PatchSet::mean_position(bool weighted)
 {
 
-  Point2f mean;
-  float wsum = 0;
-
-  for (int i = 0; i < patches.size(); i++)
-    {
-      float w = weighted ? patches[i]->get_weight() : 1;
-      Point2f p = patches[i]->get_position();
-      mean.x += p.x * w;
-      mean.y += p.y * w;
-      wsum += w;
-    }
+  if (weighted)
+    return Point2f(sum_weighted_x / sum_weights, sum_weighted_y / sum_weights);
+  else
+    return Point2f(sum_x / (double) size(), sum_y / (double) size());
 
-  mean.x /= wsum;
-  mean.y /= wsum;
-
-  return mean;
 }
 
 Matrix2f PatchSet::position_covariance(bool weighted)
@@ -201,10 +159,9 @@ Matrix2f PatchSet::position_covariance(bool weighted)
 
   for (int i = 0; i < patches.size(); i++)
     {
-      Point2f p = patches[i]->get_position();
-      pt(i, 0) = p.x;
-      pt(i, 1) = p.y;
-      we(i, 0) = weighted ? patches[i]->get_weight() : 1;
+      pt(i, 0) = positions[i].x;
+      pt(i, 1) = positions[i].y;
+      we(i, 0) = weighted ? weights[i] : 1;
     }
 
   Matrix cov = row_weighted_covariance(pt, we);
@@ -227,13 +184,16 @@ Rect4f PatchSet::region()
       return Rect4f(0, 0, 0, 0);
     }
 
+  if (bounds_valid)
+    return bounds;
+
   Rect4f r;
   r.x = INT_MAX;
   r.y = INT_MAX;
   int x2 = 0, y2 = 0;
-  for (int i = 0; i < patches.size(); i++)
+  for (int i = 0; i < positions.size(); i++)
     {
-      Point2f p = patches[i]->get_position();
+      Point2f p = positions[i];
       r.x = MIN(p.x, r.x);
       r.y = MIN(p.y, r.y);
       x2 = MAX(p.x, x2);
@@ -243,9 +203,89 @@ Rect4f PatchSet::region()
   r.width = x2 - r.x;
   r.height = y2 - r.y;
 
+  bounds = r;
+  bounds_valid = true;
+
   return r;
 }
 
+void PatchSet::append(Ptr<Patch>& patch, Point2f position, float weight, int age)
+{
+
+  Point2f p = position;
+  float w = weight;
+
+  patches.push_back(patch);
+  positions.push_back(p);
+  weights.push_back(w);
+  ages.push_back(age);
+  ids.push_back(patch->get_id());
+  slots.push_back(patch->get_slot());
+
+  sum_weights += w;
+  sum_weighted_x += w * p.x;
+  sum_weighted_y += w * p.y;
+  sum_x += p.x;
+  sum_y += p.y;
+
+  bounds_valid = false;
+
+}
+
+void PatchSet::compact()
+{
+
+  int j = 0;
+
+  for (int i = 0; i < patches.size(); i++)
+    {
+      if (patches[i].empty()) continue;
+
+      if (i != j)
+        {
+          patches[j] = patches[i];
+          positions[j] = positions[i];
+          weights[j] = weights[i];
+          ages[j] = ages[i];
+          ids[j] = ids[i];
+          slots[j] = slots[i];
+        }
+      j++;
+    }
+
+  patches.resize(j);
+  positions.resize(j);
+  weights.resize(j);
+  ages.resize(j);
+  ids.resize(j);
+  slots.resize(j);
+
+  accumulate();
+
+}
+
+void PatchSet::accumulate()
+{
+
+  sum_weights = 0;
+  sum_weighted_x = 0;
+  sum_weighted_y = 0;
+  sum_x = 0;
+  sum_y = 0;
+
+  for (int i = 0; i < positions.size(); i++)
+    {
+      sum_weights += weights[i];
+      sum_weighted_x += weights[i] * positions[i].x;
+      sum_weighted_y += weights[i] * positions[i].y;
+      sum_x += positions[i].x;
+      sum_y += positions[i].y;
+    }
+
+  bounds_valid = false;
+
+}
+
 void PatchSet::print(int i)
 {
 
@@ -260,8 +300,8 @@ void PatchSet::print_all()
 
   for (int i = 0; i < patches.size(); i++)
     {
-      Point2f p = patches[i]->get_position();
-      printf("Position = (%.2f, %.2f), Weight = %.2f, Age = %d\n", p.x, p.y,  patches[i]->get_weight(0),  patches[i]->get_age());
+      Point2f p = positions[i];
+      printf("Position = (%.2f, %.2f), Weight = %.2f, Age = %d\n", p.x, p.y, weights[i], ages[i]);
     }
 }
 
@@ -279,9 +319,38 @@ void PatchSet::responses(Image& image, int index, Point2f* positions, int pcount
 
 }
 
+void PatchSet::prepare(Image& image)
+{
+
+  // Image formats are converted lazily, so they have to be available before
+  // the responses are evaluated concurrently.
+  for (int i = 0; i < size(); i++)
+    {
+      switch (get_type(i))
+        {
+        case HISTOGRAM:
+        case SSD:
+          image.get_gray();
+          break;
+        case RGBPIXEL:
+          image.get_rgb();
+          break;
+        case HSPIXEL:
+          image.get_hsv();
+          break;
+        default:
+          break;
+        }
+    }
+
+}
+
 
-Patches::Patches(int size, int limit) : PatchSet(size), count(0), bufferlimit(limit)
+Patches::Patches(int size, int limit) : PatchSet(size), count(0), bufferlimit(limit), histogram_bins(HIST_SIZE_16), states(limit), grid_valid(false)
 {
+
+  history = &states;
+
   /*
       if (t == "histogram")
           type = HISTOGRAM;
@@ -305,54 +374,112 @@ Patches::~Patches()
 void Patches::push()
 {
 
+  if (size() > 0)
+    states.push(&(slots[0]), &(positions[0]), &(weights[0]), size());
+
   for (int i = 0; i < patches.size(); i++)
     {
-      patches[i]->push();
+      ages[i]++;
     }
 
+  // The sums are recomputed once per frame to keep the rounding errors of
+  // the incremental updates from accumulating
+  accumulate();
+
 }
 
 void Patches::move(Point2f vector)
 {
 
   for (int i = 0; i < patches.size(); i++)
-    patches[i]->move_position(vector);
+    {
+      positions[i] += vector;
+    }
+
+  accumulate();
+
+  grid_valid = false;
 
 }
 
+void Patches::set_histogram_bins(int bins)
+{
 
-int Patches::add(Image& image, PatchType type, Point2f position, float weight)
+  if (bins != HIST_SIZE_8 && bins != HIST_SIZE_16 && bins != HIST_SIZE_32)
+    throw LegitException("Unsupported number of histogram bins");
+
+  if (bins == histogram_bins)
+    return;
+
+  pool[HISTOGRAM].clear();
+  histogram_bins = bins;
+
+}
+
+Ptr<Patch> Patches::acquire(PatchType type)
 {
 
+  if (!pool[type].empty())
+    {
+      Ptr<Patch> pch = pool[type].back();
+      pool[type].pop_back();
+      pch->reset(count++, states.acquire());
+      return pch;
+    }
+
   Ptr<Patch> pch;
 
   switch (type)
     {
     case HISTOGRAM:
-      pch = new HistogramPatch(count++, 10, bufferlimit, psize, psize);
+      pch = new HistogramPatch(count, psize, psize, histogram_bins);
       break;
     case RGBPIXEL:
-      pch = new RGBPatch(count++, 10, bufferlimit);
+      pch = new RGBPatch(count);
       break;
     case HSPIXEL:
-      pch = new HSPatch(count++, 10, bufferlimit);
+      pch = new HSPatch(count);
       break;
     case SSD:
-      pch = new SSDPatch(count++, 10, bufferlimit, psize, psize);
+      pch = new SSDPatch(count, psize, psize);
       break;
     default:
       throw LegitException("Unknown type");
     }
 
-  pch->push();
-  pch->set_position(position);
-  pch->set_weight(weight);
+  pch->reset(count++, states.acquire());
+
+  return pch;
+
+}
+
+void Patches::discard(int index)
+{
+
+  if (patches[index].empty())
+    return;
+
+  states.release(slots[index]);
+
+  pool[patches[index]->get_type()].push_back(patches[index]);
+  patches[index].release();
+
+}
+
+
+int Patches::add(Image& image, PatchType type, Point2f position, float weight)
+{
+
+  Ptr<Patch> pch = acquire(type);
 
   pch->initialize(image, position);
 
   //calculate_histogram(image, position, psize, pch->histogram);
 
-  patches.push_back(pch);
+  // New patches start with the age of one frame
+  append(pch, position, weight, 1);
+
+  grid_valid = false;
 
   return patches.size();
 }
@@ -360,7 +487,10 @@ int Patches::add(Image& image, PatchType type, Point2f position, float weight)
 void Patches::remove(int index)
 {
 
-  patches.erase(patches.begin() + index);
+  discard(index);
+  compact();
+
+  grid_valid = false;
 
 }
 
@@ -368,10 +498,12 @@ void Patches::remove(vector<int>& indices)
 {
   for (int i = 0; i < indices.size(); i++)
     {
-      patches[indices[i]].release();
+      discard(indices[i]);
     }
 
-  patches.erase(remove_if(patches.begin(), patches.end(), _isempty), patches.end());
+  compact();
+
+  grid_valid = false;
 
 }
 
@@ -380,7 +512,7 @@ int Patches::remove(Filter& filter)
   vector<int> selection;
   for (int i = 0; i < size(); i++)
     {
-      if (filter(patches[i])) selection.push_back(i);
+      if (filter(*this, i)) selection.push_back(i);
     }
 
   if (selection.size() > 0)
@@ -393,7 +525,12 @@ int Patches::remove(Filter& filter)
 
 void Patches::flush()
 {
-  patches.clear();
+  for (int i = 0; i < patches.size(); i++)
+    discard(i);
+
+  compact();
+
+  grid_valid = false;
 }
 
 int Patches::merge(Image& image, vector<int>& indices, PatchType type)
@@ -409,17 +546,16 @@ int Patches::merge(Image& image, vector<int>& indices, PatchType type)
 
   for (int i = 0; i < indices.size(); i++)
     {
-      Point2f m = patches[indices[i]]->get_position();
-      float mw = patches[indices[i]]->get_weight();
+      Point2f m = positions[indices[i]];
+      float mw = weights[indices[i]];
       p.x += m.x * mw;
       p.y += m.y * mw;
       w += mw;
       types.push_back(patches[indices[i]]->get_type());
-      // a hacky way to remove patches with as little fuss as possible
-      patches[indices[i]].release();
+      discard(indices[i]);
     }
 
-  patches.erase(remove_if(patches.begin(), patches.end(), _isempty), patches.end());
+  compact();
 
   p.x /= w;
   p.y /= w;
@@ -432,6 +568,50 @@ int Patches::merge(Image& image, vector<int>& indices, PatchType type)
   return patches.size();
 }
 
+int Patches::merge(Image& image, vector<vector<int> >& groups, PatchType type)
+{
+
+  vector<Point2f> merged_positions;
+  vector<float> merged_weights;
+
+  for (int g = 0; g < groups.size(); g++)
+    {
+      if (groups[g].size() < 2) continue;
+
+      Point2f p(0, 0);
+      float w = 0;
+
+      for (int i = 0; i < groups[g].size(); i++)
+        {
+          Point2f m = positions[groups[g][i]];
+          float mw = weights[groups[g][i]];
+          p.x += m.x * mw;
+          p.y += m.y * mw;
+          w += mw;
+          discard(groups[g][i]);
+        }
+
+      p.x /= w;
+      p.y /= w;
+      w /= groups[g].size();
+
+      merged_positions.push_back(p);
+      merged_weights.push_back(w);
+    }
+
+  if (merged_positions.empty())
+    return patches.size();
+
+  compact();
+
+  assert(type < PATCH_TYPE_COUNT);
+
+  for (int i = 0; i < merged_positions.size(); i++)
+    add(image, type, merged_positions[i], merged_weights[i]);
+
+  return patches.size();
+}
+
 int Patches::inhibit(Image& image, vector<int>& indices)
 {
 
@@ -443,21 +623,22 @@ int Patches::inhibit(Image& image, vector<int>& indices)
 
   for (int i = 0; i < indices.size(); i++)
     {
-      if (patches[indices[i]]->get_weight() > best_weight)
+      if (weights[indices[i]] > best_weight)
         {
           best = indices[i];
-          best_weight = patches[indices[i]]->get_weight();
+          best_weight = weights[indices[i]];
         }
     }
 
   for (int i = 0; i < indices.size(); i++)
     {
       if (indices[i] == best) continue;
-      // a hacky way to remove patches with as little fuss as possible
-      patches[indices[i]].release();
+      discard(indices[i]);
     }
 
-  patches.erase(remove_if(patches.begin(), patches.end(), _isempty), patches.end());
+  compact();
+
+  grid_valid = false;
 
   return patches.size();
 }
@@ -465,16 +646,23 @@ int Patches::inhibit(Image& image, vector<int>& indices)
 int Patches::get_motion_history(int index, Point2f* buffer, int maxlen)
 {
 
-  int size = MIN(patches[index]->history_size(), maxlen);
+  int size = MIN(MIN(ages[index], states.length() + 1), maxlen);
 
   for (int i = 0; i < size; i++)
     {
-      buffer[i] = patches[index]->get_position(i);
+      buffer[i] = get_position(index, i);
     }
 
   return size;
 }
 
+void Patches::reserve(int size)
+{
+
+  states.reserve(size);
+
+}
+
 void Patches::normalize_weights()
 {
 
@@ -492,21 +680,112 @@ void Patches::normalize_weights()
 
 }
 
-PatchSet* PatchSet::filter(Filter& filter)
+void Patches::set_position(int index, Point2f position)
 {
 
-  PatchSet* patchSet = new PatchSet(psize);
-  patchSet->patches.reserve(size());
+  PatchSet::set_position(index, position);
+
+  grid_valid = false;
+
+}
+
+SpatialGrid& Patches::get_grid()
+{
+
+  if (!grid_valid)
+    {
+      grid.build(positions.empty() ? NULL : &(positions[0]), positions.size(), psize);
+
+      grid_valid = true;
+    }
+
+  return grid;
+
+}
+
+void PatchSet::select(Filter& filter, vector<int>& result)
+{
+
+  result.clear();
 
   for (int i = 0; i < size(); i++)
     {
-      if (filter(patches[i]))
-        {
-          patchSet->patches.push_back(patches[i]);
-        }
+      if (filter(*this, i))
+        result.push_back(i);
+    }
+
+}
+
+PatchSelection::PatchSelection() : set(NULL)
+{
+
+}
+
+void PatchSelection::select(PatchSet& set, Filter& filter)
+{
+
+  this->set = &set;
+  set.select(filter, indices);
+
+}
+
+void PatchSelection::select(PatchSet& set)
+{
+
+  this->set = &set;
+  indices.resize(set.size());
+
+  for (int i = 0; i < set.size(); i++)
+    indices[i] = i;
+
+}
+
+Point2f PatchSelection::mean_position(bool weighted)
+{
+
+  Point2f mean;
+  float wsum = 0;
+
+  for (int i = 0; i < size(); i++)
+    {
+      float w = weighted ? get_weight(i) : 1;
+      Point2f p = get_position(i);
+      mean.x += p.x * w;
+      mean.y += p.y * w;
+      wsum += w;
     }
 
-  return patchSet;
+  mean.x /= wsum;
+  mean.y /= wsum;
+
+  return mean;
+}
+
+Rect4f PatchSelection::region()
+{
+
+  if (size() == 0)
+    {
+      return Rect4f(0, 0, 0, 0);
+    }
+
+  Rect4f r;
+  r.x = INT_MAX;
+  r.y = INT_MAX;
+  int x2 = 0, y2 = 0;
+  for (int i = 0; i < size(); i++)
+    {
+      Point2f p = get_position(i);
+      r.x = MIN(p.x, r.x);
+      r.y = MIN(p.y, r.y);
+      x2 = MAX(p.x, x2);
+      y2 = MAX(p.y, y2);
+    }
+
+  r.width = x2 - r.x;
+  r.height = y2 - r.y;
+
+  return r;
 }
 
 }
@@ -24,10 +24,11 @@
 #include <string.h>
 #include <functional>
 #include <opencv2/core/core.hpp>
-#include "common/utils/buffer.h"
 #include "common/math/geometry.h"
 #include "common/image/image.h"
 #include "common/image/histogram.h"
+#include "grid.h"
+#include "history.h"
 
 using namespace cv;
 using namespace std;
@@ -41,50 +42,23 @@ namespace tracker
 
 enum PatchType {HISTOGRAM, SSD, RGBPIXEL, HSPIXEL, PATCH_TYPE_COUNT, PATCH_TYPE_ANY};
 
-typedef struct _State
-{
-  Point2f position;
-  float weight;
-  bool active;
-} State;
-
 class Patch
 {
 public:
-  Patch(int id, int capacity, int limit, int width, int height) : states(capacity, limit), age(0), id(id), width(width), height(height), active(true) {}
+  Patch(int id, int width, int height) : id(id), slot(-1), width(width), height(height), active(true) {}
   ~Patch() {}
 
-  inline Point2f get_position(int offset)
-  {
-    return states.get(offset).position;
-  }
-
-  inline float get_weight(int offset)
-  {
-    return states.get(offset).weight;
-  }
-
-  inline Point2f get_position()
-  {
-    return states.get().position;
-  }
-
-  inline float get_weight()
-  {
-    return states.get().weight;
-  }
-
-  void set_position(Point2f p);
-  void set_weight(float weight);
-  void move_position(Point2f p);
-  inline int get_age()
-  {
-    return age;
-  };
   inline int get_id()
   {
     return id;
   };
+  /**
+      Slot of the patch in the history of the set that owns it.
+  */
+  inline int get_slot()
+  {
+    return slot;
+  };
   inline int get_width()
   {
     return width;
@@ -107,11 +81,11 @@ public:
     return active;
   };
 
-  void push();
-  int history_size()
-  {
-    return states.size();
-  };
+  /**
+      Resets the patch so that the object can be reused for a new patch with
+      the given id and history slot. The patch has to be initialized again.
+  */
+  void reset(int id, int slot);
 
 
   virtual void initialize(Image& image, cv::Point position) = 0;
@@ -119,61 +93,34 @@ public:
   virtual void responses(Image& image, cv::Point2f* positions, int pcount, float* responses) = 0;
   virtual PatchType get_type() = 0;
 
+  /**
+      Returns the reference histogram of the patch or NULL if the patch is not histogram based.
+  */
+  virtual SimpleHistogram* get_histogram()
+  {
+    return NULL;
+  };
+
+  /**
+      Returns the square roots of the reference histogram bins or NULL if the patch is not histogram based.
+  */
+  virtual HistogramRoots* get_histogram_roots()
+  {
+    return NULL;
+  };
+
 protected:
 
-  Buffer<State> states;
-  int age;
+  // Position, weight and age of the patch are kept by the set that owns it
   int id;
+  int slot;
   int width;
   int height;
   bool active;
 
 };
 
-struct Filter : public unary_function<Ptr<Patch>&,bool>
-{
-  virtual bool operator() (Ptr<Patch>& patch)
-  {
-    return true;
-  };
-};
-
-class WeightGreaterFilter : public Filter
-{
-public:
-  WeightGreaterFilter(float threshold) : threshold(threshold) {}
-  ~WeightGreaterFilter() {}
-  virtual bool operator() (Ptr<Patch>& patch)
-  {
-    return (patch->get_weight(0) > threshold);
-  }
-private:
-  float threshold;
-};
-
-class WeightLowerFilter : public Filter
-{
-public:
-  WeightLowerFilter(float threshold) : threshold(threshold) {}
-  ~WeightLowerFilter() {}
-  virtual bool operator() (Ptr<Patch>& patch)
-  {
-    return (patch->get_weight(0) < threshold);
-  }
-private:
-  float threshold;
-};
-
-class ActiveFilter : public Filter
-{
-public:
-  ActiveFilter() {}
-  ~ActiveFilter() {}
-  virtual bool operator() (Ptr<Patch>& patch)
-  {
-    return patch->is_active();
-  }
-};
+struct Filter;
 
 class PatchSet
 {
@@ -187,19 +134,40 @@ public:
 
   virtual int size();
 
-  virtual float get_weight(int index);
+  inline float get_weight(int index)
+  {
+    return weights[index];
+  }
 
-  virtual Point2f get_position(int index, int offset = 0);
+  inline Point2f get_position(int index, int offset = 0)
+  {
+    return offset == 0 ? positions[index] : history->get(slots[index], offset).position;
+  }
 
   virtual Point2f get_relative_position(int index, Point2f origin);
 
   virtual PatchType get_type(int index);
 
+  inline Patch* get_patch(int index)
+  {
+    return (Patch*) patches[index];
+  }
+
+  virtual SimpleHistogram* get_histogram(int index);
+
+  virtual HistogramRoots* get_histogram_roots(int index);
+
   virtual bool is_active(int index);
 
-  virtual int get_age(int index);
+  inline int get_age(int index)
+  {
+    return ages[index];
+  }
 
-  virtual int get_id(int index);
+  inline int get_id(int index)
+  {
+    return ids[index];
+  }
 
   virtual void set_weight(int index, float weight);
 
@@ -221,6 +189,8 @@ public:
 
   void responses(Image& matrix, int index, Point2f* positions, int pcount, float* responses);
 
+  void prepare(Image& image);
+
   int get_patch_size()
   {
     return psize;
@@ -231,15 +201,165 @@ public:
     return psize / 2;
   }
 
-  PatchSet* filter(Filter& filter);
+  /**
+      Indices of the patches accepted by the filter, without copying them.
+  */
+  void select(Filter& filter, vector<int>& result);
 
 protected:
 
+  /**
+      Appends a patch to the set, the columns are filled from its current state.
+  */
+  void append(Ptr<Patch>& patch, Point2f position, float weight, int age);
+
+  /**
+      Removes the released (empty) patches from the set and from the columns,
+      the order of the remaining patches is kept.
+  */
+  void compact();
+
+  /**
+      Recomputes the aggregates of the set from the columns.
+  */
+  void accumulate();
+
   vector<Ptr<Patch> > patches;
 
+  // Current state of the patches stored by columns, index aligned with the
+  // patch objects. Past states are kept in the shared history.
+  vector<Point2f> positions;
+  vector<float> weights;
+  vector<int> ages;
+  vector<int> ids;
+  vector<int> slots;
+
+  PatchHistory* history;
+
   int hsize;
   int psize;
 
+private:
+
+  // Sums for the mean position, updated with every change of the state
+  double sum_weights;
+  double sum_weighted_x, sum_weighted_y;
+  double sum_x, sum_y;
+
+  // Bounds are recomputed lazily after a change
+  Rect4f bounds;
+  bool bounds_valid;
+
+};
+
+struct Filter
+{
+  virtual bool operator() (PatchSet& set, int index)
+  {
+    return true;
+  };
+};
+
+class WeightGreaterFilter : public Filter
+{
+public:
+  WeightGreaterFilter(float threshold) : threshold(threshold) {}
+  ~WeightGreaterFilter() {}
+  virtual bool operator() (PatchSet& set, int index)
+  {
+    return (set.get_weight(index) > threshold);
+  }
+private:
+  float threshold;
+};
+
+class WeightLowerFilter : public Filter
+{
+public:
+  WeightLowerFilter(float threshold) : threshold(threshold) {}
+  ~WeightLowerFilter() {}
+  virtual bool operator() (PatchSet& set, int index)
+  {
+    return (set.get_weight(index) < threshold);
+  }
+private:
+  float threshold;
+};
+
+class ActiveFilter : public Filter
+{
+public:
+  ActiveFilter() {}
+  ~ActiveFilter() {}
+  virtual bool operator() (PatchSet& set, int index)
+  {
+    return set.is_active(index);
+  }
+};
+
+/**
+    A view of the patches of a set that were accepted by a filter. Only the
+    indices are stored, so no patches are copied and the storage is reused
+    between selections. The view is valid until the set is changed.
+*/
+class PatchSelection
+{
+public:
+
+  PatchSelection();
+
+  void select(PatchSet& set, Filter& filter);
+
+  /**
+      Selects all the patches of the set.
+  */
+  void select(PatchSet& set);
+
+  inline int size()
+  {
+    return (int) indices.size();
+  }
+
+  inline int get_index(int i)
+  {
+    return indices[i];
+  }
+
+  inline PatchSet& get_set()
+  {
+    return *set;
+  }
+
+  inline float get_weight(int i)
+  {
+    return set->get_weight(indices[i]);
+  }
+
+  inline Point2f get_position(int i, int offset = 0)
+  {
+    return set->get_position(indices[i], offset);
+  }
+
+  inline int get_age(int i)
+  {
+    return set->get_age(indices[i]);
+  }
+
+  inline int get_radius()
+  {
+    return set->get_radius();
+  }
+
+  Point2f mean_position(bool weighted = true);
+
+  Rect4f region();
+
+private:
+
+  PatchSet* set;
+
+  vector<int> indices;
+
 };
 
 class Patches : public PatchSet
@@ -267,22 +387,68 @@ public:
 
   int merge(Image& image, vector<int>& indices, PatchType type = PATCH_TYPE_ANY);
 
+  /**
+      Merges every group of patches into a single patch. Indices refer to
+      the set before the merge.
+  */
+  int merge(Image& image, vector<vector<int> >& groups, PatchType type = PATCH_TYPE_ANY);
+
   int inhibit(Image& image, vector<int>& indices);
 
   int get_motion_history(int index, Point2f* buffer, int maxlen);
 
+  /**
+      Preallocates the history for the given number of patches.
+  */
+  void reserve(int size);
+
   void normalize_weights();
 
+  virtual void set_position(int index, Point2f position);
+
+  /**
+      Spatial index of the current patch positions. It is rebuilt lazily
+      after the positions or the set itself have changed.
+  */
+  SpatialGrid& get_grid();
+
   void set_patch_size(int size)
   {
     flush();
+    for (int i = 0; i < PATCH_TYPE_COUNT; i++)
+      pool[i].clear();
     psize = size;
   }
 
+  /**
+      Sets the number of bins of the histogram patches that are added from now
+      on (8, 16 or 32). Removed patches with the old number of bins are not
+      reused.
+  */
+  void set_histogram_bins(int bins);
+
+  inline int get_histogram_bins()
+  {
+    return histogram_bins;
+  }
+
 private:
 
+  Ptr<Patch> acquire(PatchType type);
+
+  void discard(int index);
+
   int count;
   int bufferlimit;
+  int histogram_bins;
+
+  // Removed patches by type, reused when new patches are added
+  vector<Ptr<Patch> > pool[PATCH_TYPE_COUNT];
+
+  PatchHistory states;
+
+  SpatialGrid grid;
+  bool grid_valid;
 
 };
 
@@ -0,0 +1,117 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#include <math.h>
+#include "common/utils/debug.h"
+#include "selector.h"
+
+namespace legit
+{
+
+namespace tracker
+{
+
+ModelSelector::ModelSelector(bool enabled, float rotation, float scale, int quiet) : enabled(enabled), rotation(rotation),
+  scale(scale), quiet(quiet), affine(false), calm(0)
+{
+
+}
+
+ModelSelector::~ModelSelector()
+{
+
+}
+
+void ModelSelector::reset()
+{
+
+  affine = false;
+  calm = 0;
+  start.clear();
+
+}
+
+void ModelSelector::begin(PatchSet& patches)
+{
+
+  if (!enabled) return;
+
+  start.resize(patches.size());
+
+  for (int i = 0; i < patches.size(); i++)
+    start[i] = patches.get_position(i);
+
+}
+
+void ModelSelector::update(PatchSet& patches)
+{
+
+  if (!enabled) return;
+
+  int count = patches.size();
+
+  if (count < 3 || (int) start.size() != count) return;
+
+  end.resize(count);
+  weights.resize(count);
+
+  // Coordinates are centered for a better conditioned fit
+  Point2f center(0, 0);
+  for (int i = 0; i < count; i++)
+    center += start[i];
+  center *= 1.0f / count;
+
+  for (int i = 0; i < count; i++)
+    {
+      end[i] = patches.get_position(i) - center;
+      weights[i] = MAX(0.0001f, patches.get_weight(i));
+    }
+
+  for (int i = 0; i < count; i++)
+    start[i] -= center;
+
+  Matrix3f t = compute_affine_transformation(&(start[0]), &(end[0]), &(weights[0]), count);
+
+  if (isnan_matrix(t)) return;
+
+  float angle = atan2(t.m01 - t.m10, t.m00 + t.m11);
+  float change = sqrt(fabs(t.m00 * t.m11 - t.m10 * t.m01)) - 1;
+
+  bool evidence = fabs(angle) > rotation || fabs(change) > scale;
+
+  if (evidence)
+    {
+      if (!affine)
+        DEBUGMSG("Switching to affine model (rotation %.3f, scale %.3f)\n", angle, change);
+      affine = true;
+      calm = 0;
+    }
+  else if (affine && ++calm >= quiet)
+    {
+      DEBUGMSG("Switching to translation model after %d quiet frames\n", calm);
+      affine = false;
+      calm = 0;
+    }
+
+}
+
+}
+
+}
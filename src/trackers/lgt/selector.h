@@ -0,0 +1,91 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#ifndef LEGIT_LGT_SELECTOR
+#define LEGIT_LGT_SELECTOR
+
+#include <vector>
+#include "common/math/geometry.h"
+#include "patches/patchset.h"
+
+namespace legit
+{
+
+namespace tracker
+{
+
+/**
+    Chooses the transformation model of the global optimization. The cheap
+    translation model is used by default. After every frame a weighted
+    affine transformation is fitted to the motion of the patches over the
+    whole optimization (global and local). If its rotation or scale change
+    exceeds the thresholds, the affine model is used from the next frame
+    on, until no such evidence has been seen for a number of frames.
+*/
+class ModelSelector
+{
+public:
+  ModelSelector(bool enabled = false, float rotation = 0.02, float scale = 0.01, int quiet = 10);
+  ~ModelSelector();
+
+  inline bool is_enabled()
+  {
+    return enabled;
+  }
+
+  inline bool is_affine()
+  {
+    return affine;
+  }
+
+  void reset();
+
+  /**
+      Remembers the positions of the patches before the optimization.
+  */
+  void begin(PatchSet& patches);
+
+  /**
+      Estimates the rotation and scale change from the optimized positions
+      and updates the model for the next frame.
+  */
+  void update(PatchSet& patches);
+
+private:
+
+  bool enabled;
+  float rotation;
+  float scale;
+  int quiet;
+
+  bool affine;
+  int calm;
+
+  std::vector<Point2f> start;
+  std::vector<Point2f> end;
+  std::vector<float> weights;
+
+};
+
+}
+
+}
+
+#endif
@@ -0,0 +1,188 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#include <math.h>
+#include <algorithm>
+#include "common/utils/debug.h"
+#include "warmstart.h"
+
+namespace legit
+{
+
+namespace tracker
+{
+
+WarmStart::WarmStart(bool enabled, float inflation, float gate, float floor) : enabled(enabled), inflation(inflation),
+  gate(gate), floor(floor), factor(0), valid(false)
+{
+
+}
+
+WarmStart::~WarmStart()
+{
+
+}
+
+void WarmStart::reset()
+{
+
+  factor = 0;
+  valid = false;
+  local_ids.clear();
+
+}
+
+void WarmStart::innovation(SmallKalmanFilter<4, 2>& filter, cv::Point2f measurement)
+{
+
+  if (!enabled) return;
+
+  SmallVector<2> z, y;
+  SmallMatrix<2, 2> S, Si;
+
+  z[0] = measurement.x;
+  z[1] = measurement.y;
+
+  filter.innovation(z, y, S);
+
+  // Normalized innovation squared, chi-square distributed with two degrees
+  // of freedom if the motion model is correct
+  double distance = invert(S, Si) ? y[0] * (Si(0, 0) * y[0] + Si(0, 1) * y[1]) + y[1] * (Si(1, 0) * y[0] + Si(1, 1) * y[1]) : NAN;
+
+  if (isnan(distance) || distance > gate)
+    {
+      DEBUGMSG("Warm start gated (innovation %.2f)\n", distance);
+      reset();
+      return;
+    }
+
+  factor = inflation * (1 + distance / 2);
+
+}
+
+double WarmStart::bounded(double value, double cold)
+{
+
+  return std::min(cold, std::max(value * factor, cold * floor));
+
+}
+
+bool WarmStart::global(Matrix& mean, Matrix& covariance)
+{
+
+  if (!enabled || !valid || factor <= 0) return false;
+
+  int dimensions = covariance.rows;
+
+  if (global_covariance.rows != dimensions || global_mean.cols != mean.cols)
+    return false;
+
+  Matrix scaled(dimensions, 1);
+
+  for (int i = 0; i < dimensions; i++)
+    {
+      double previous = global_covariance(i, i);
+      double variance = bounded(previous, covariance(i, i));
+      scaled(i, 0) = (previous > 0) ? sqrt(variance / previous) : 0;
+      covariance(i, i) = variance;
+    }
+
+  // Off-diagonal elements are scaled so that the correlations are kept
+  for (int i = 0; i < dimensions; i++)
+    for (int j = 0; j < dimensions; j++)
+      if (i != j) covariance(i, j) = global_covariance(i, j) * scaled(i, 0) * scaled(j, 0);
+
+  // Translation is predicted by the motion model, the remaining parameters
+  // are assumed to change at a constant rate
+  for (int i = 2; i < mean.cols; i++)
+    mean(0, i) = global_mean(0, i);
+
+  return true;
+
+}
+
+void WarmStart::store_global(const Matrix& mean, const Matrix& covariance, bool converged)
+{
+
+  if (!enabled) return;
+
+  mean.copyTo(global_mean);
+  covariance.copyTo(global_covariance);
+  valid = converged;
+
+}
+
+bool WarmStart::local(PatchSet& patches, float covariance, Matrix& covariances)
+{
+
+  if (covariances.rows < patches.size() || covariances.cols != 4)
+    covariances.create(std::max(1, patches.size()), 4);
+
+  int warm = 0;
+
+  for (int i = 0; i < patches.size(); i++)
+    {
+      double* C = covariances.ptr<double>(i);
+      C[0] = C[3] = covariance;
+      C[1] = C[2] = 0;
+
+      if (!enabled || factor <= 0) continue;
+
+      std::vector<std::pair<int, int> >::iterator it = std::lower_bound(local_ids.begin(), local_ids.end(),
+          std::pair<int, int>(patches.get_id(i), -1));
+
+      if (it == local_ids.end() || it->first != patches.get_id(i)) continue;
+
+      const double* P = local_covariances.ptr<double>(it->second);
+
+      if (P[0] <= 0 || P[3] <= 0) continue;
+
+      C[0] = bounded(P[0], covariance);
+      C[3] = bounded(P[3], covariance);
+      C[1] = C[2] = P[1] * sqrt((C[0] * C[3]) / (P[0] * P[3]));
+
+      warm++;
+    }
+
+  return warm > 0;
+
+}
+
+void WarmStart::store_local(PatchSet& patches, const Matrix& covariances)
+{
+
+  if (!enabled) return;
+
+  local_ids.clear();
+
+  if (patches.size() < 1) return;
+
+  covariances.rowRange(0, patches.size()).copyTo(local_covariances);
+
+  for (int i = 0; i < patches.size(); i++)
+    local_ids.push_back(std::pair<int, int>(patches.get_id(i), i));
+
+  std::sort(local_ids.begin(), local_ids.end());
+
+}
+
+}
+
+}
@@ -0,0 +1,114 @@
+/********************************************************************
+* LGT tracker - The official C++ implementation of the LGT tracker
+* Copyright (C) 2013  Luka Cehovin
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*
+********************************************************************/
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#ifndef LEGIT_LGT_WARMSTART
+#define LEGIT_LGT_WARMSTART
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "common/math/statistics.h"
+#include "common/math/kalman.h"
+#include "patches/patchset.h"
+
+namespace legit
+{
+
+namespace tracker
+{
+
+/**
+    Carries the converged cross entropy distributions from one frame to the
+    next. The final mean and elite covariance of the global search and of
+    every refined patch are stored and used to seed the search in the next
+    frame, inflated according to the normalized innovation of the Kalman
+    motion model. Large innovations (unexpected motion) fall back to the
+    regular, cold initialization.
+*/
+class WarmStart
+{
+public:
+  WarmStart(bool enabled = false, float inflation = 4, float gate = 9.21, float floor = 0.1);
+  ~WarmStart();
+
+  inline bool is_enabled()
+  {
+    return enabled;
+  }
+
+  /**
+      Drops all stored distributions, the next search starts cold.
+  */
+  void reset();
+
+  /**
+      Computes the inflation for the next frame from the innovation of the
+      measurement. Has to be called after predict and before correct.
+  */
+  void innovation(SmallKalmanFilter<4, 2>& filter, cv::Point2f measurement);
+
+  /**
+      Replaces the cold mean and covariance with the stored ones if possible.
+      The cold covariance is used as the upper bound. Returns true if the
+      search was warm started.
+  */
+  bool global(Matrix& mean, Matrix& covariance);
+
+  void store_global(const Matrix& mean, const Matrix& covariance, bool converged);
+
+  /**
+      Fills a row-wise 2x2 covariance for every patch. Patches that were not
+      refined in the previous frame get the isotropic cold covariance.
+      Returns true if at least one patch was warm started.
+  */
+  bool local(PatchSet& patches, float covariance, Matrix& covariances);
+
+  void store_local(PatchSet& patches, const Matrix& covariances);
+
+  inline float get_inflation()
+  {
+    return factor;
+  }
+
+private:
+
+  double bounded(double value, double cold);
+
+  bool enabled;
+  float inflation;
+  float gate;
+  float floor;
+
+  float factor;
+  bool valid;
+
+  Matrix global_mean;
+  Matrix global_covariance;
+
+  // Patch identifiers, sorted, and their rows in the covariance matrix
+  std::vector<std::pair<int, int> > local_ids;
+  Matrix local_covariances;
+
+};
+
+}
+
+}
+
+#endif